@@ -12,6 +12,41 @@ typedef struct app
 	bool verbose;
 
 	const char *mcu;
+	const char *cycles;
+	const char *f_cpu;
+	const char *symbols;
+
+	const char *profile;
+	const char *profile_format;
+	const char *callgraph;
+	const char *budget;
+	const char *trace;
+	const char *lcov;
+
+	const char *breaks;
+	const char *watches;
+	const char *irqs;
+	const char *irq_stats;
+	const char *gdb;
+
+	const char *fuzz;
+	const char *fuzz_runs;
+	const char *fuzz_cycles;
+	const char *fuzz_start;
+
+	const char *cosim;
+	const char *cosim_cycles;
+
+	const char *realtime;
+	const char *realtime_tolerance;
+
+	const char *semihost;
+
+	const char *snapshot;
+	const char *compare;
+	const char *compare_areas;
+
+	const char *log_levels;
 
 	file_t log;
 	file_t upload;
@@ -1,50 +1,44 @@
-#include "hw/devices.h"
+#include "hw/cores.h"
 
-#include "util/bitmanip.h"
+/* Expand register names to plain data-space addresses */
+#define _SFR_MEM8(addr)		(addr)
+#define _SFR_MEM16(addr)	(addr)
+#define _SFR_IO8(addr)		IO2MEM(addr)
+#define _SFR_IO16(addr)		IO2MEM(addr)
+#define _VECTOR(n)		(n)
 
 #define _AVR_IO_H_
 #include "hw/atmel/iom328p.h"
 
-#include <stdlib.h>
-#include <string.h>
+CORE_CHECK(flashend, FLASHEND == ATMEGA328P_FLASHEND);
+CORE_CHECK(ramend, RAMEND == ATMEGA328P_RAMEND);
 
-static void
-p_destroy(hw_t **hw)
+const device_t DEVICE_ATMEGA328P =
 {
-	hw_t *_hw = *hw;
+	.name = "atmega328p",
+	.display = "ATmega328P",
 
-	if (_hw)
-	{
-		flash_destroy(_hw->flash);
-		data_destroy(_hw->data);
-		free(_hw);
-		*hw = NULL;
-	}
-}
-
-hw_t *
-atmega328p_init(void)
-{
-	hw_t *hw = malloc(sizeof *hw);
-
-	if (hw)
-	{
-		memset(hw, 0, sizeof *hw);
+	.signature = { SIGNATURE_0, SIGNATURE_1, SIGNATURE_2 },
 
-		hw->name = "ATmega328P";
+	.flashend = FLASHEND,
+	.ramstart = RAMSTART,
+	.ramend = RAMEND,
+	.e2size = E2END + 1,
+	.spm_pagesize = SPM_PAGESIZE,
 
-		hw->sp[0] = LOW(RAMEND);
-		hw->sp[1] = HIGH(RAMEND);
+	.n_vectors = _VECTORS_SIZE / 4,
+	.vector_words = 2,
+	.pc_bytes = ATMEGA328P_PC_BYTES,
 
-		hw->flash = flash_init(FLASHEND);
-		hw->flashend = FLASHEND;
-		hw->data = data_init(RAMSTART, RAMEND, hw->sp);
-		hw->ramend = RAMEND;
+	.features = ATMEGA328P_FEATURES,
 
-		hw->state = AVR_NORMAL;
-
-		hw->destroy = p_destroy;
-	}
-
-	return hw;
-}
+	.io =
+	{
+		.spmcsr = SPMCSR,
+		.ucsra = UCSR0A,
+		.udr = UDR0
+	},
+
+	/* Nothing is defined past UDR0 */
+	.reserved = { UDR0 + 1, RAMSTART - (UDR0 + 1) }
+};
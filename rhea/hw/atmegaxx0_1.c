@@ -0,0 +1,69 @@
+#include "hw/cores.h"
+
+/* Values from avr-libc's iomxx0_1.h, which is not bundled; the core
+ * parameters live in hw/cores.h. The 2560 is the only member of the family
+ * with more than 64K words of flash and therefore the only one with EIND and
+ * a 3-byte PC.
+ */
+const device_t DEVICE_ATMEGA2560 =
+{
+	.name = "atmega2560",
+	.display = "ATmega2560",
+
+	.signature = { 0x1E, 0x98, 0x01 },
+
+	.flashend = ATMEGA2560_FLASHEND,
+	.ramstart = 0x200,
+	.ramend = ATMEGA2560_RAMEND,
+	.e2size = 0x1000,
+	.spm_pagesize = 256,
+
+	.n_vectors = 57,
+	.vector_words = 2,
+	.pc_bytes = ATMEGA2560_PC_BYTES,
+
+	.features = ATMEGA2560_FEATURES,
+
+	.io =
+	{
+		.rampz = ATMEGA2560_RAMPZ,
+		.eind = ATMEGA2560_EIND,
+		.spmcsr = IO2MEM(0x37),
+		.ucsra = 0xC0,
+		.udr = 0xC6
+	},
+
+	/* Everything past UDR3 */
+	.reserved = { 0x137, 0x200 - 0x137 }
+};
+
+const device_t DEVICE_ATMEGA1280 =
+{
+	.name = "atmega1280",
+	.display = "ATmega1280",
+
+	.signature = { 0x1E, 0x97, 0x03 },
+
+	.flashend = ATMEGA1280_FLASHEND,
+	.ramstart = 0x200,
+	.ramend = ATMEGA1280_RAMEND,
+	.e2size = 0x1000,
+	.spm_pagesize = 256,
+
+	.n_vectors = 57,
+	.vector_words = 2,
+	.pc_bytes = ATMEGA1280_PC_BYTES,
+
+	.features = ATMEGA1280_FEATURES,
+
+	.io =
+	{
+		.rampz = ATMEGA1280_RAMPZ,
+		.spmcsr = IO2MEM(0x37),
+		.ucsra = 0xC0,
+		.udr = 0xC6
+	},
+
+	/* Everything past UDR3 */
+	.reserved = { 0x137, 0x200 - 0x137 }
+};
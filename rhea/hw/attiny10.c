@@ -0,0 +1,25 @@
+#include "hw/cores.h"
+
+/* Values from avr-libc's iotn10.h, which is not bundled; the core parameters
+ * live in hw/cores.h. The ATtiny10 is an AVRrc part: 16 registers, 16-bit
+ * LDS/STS and flash mapped into data space instead of LPM. Data-space
+ * addresses below are the ones the part itself uses.
+ */
+const device_t DEVICE_ATTINY10 =
+{
+	.name = "attiny10",
+	.display = "ATtiny10",
+
+	.signature = { 0x1E, 0x90, 0x03 },
+
+	.flashend = ATTINY10_FLASHEND,
+	.ramstart = 0x40,
+	.ramend = ATTINY10_RAMEND,
+	.spm_pagesize = 16,
+
+	.n_vectors = 11,
+	.vector_words = 1,
+	.pc_bytes = ATTINY10_PC_BYTES,
+
+	.features = ATTINY10_FEATURES
+};
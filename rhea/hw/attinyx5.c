@@ -0,0 +1,30 @@
+#include "hw/cores.h"
+
+/* Values from avr-libc's iotnx5.h, which is not bundled; the core parameters
+ * live in hw/cores.h. The ATtiny85 is an AVR25 core: the full register file
+ * and LPM/SPM, but neither MUL nor JMP/CALL, and vectors are single RJMPs.
+ */
+const device_t DEVICE_ATTINY85 =
+{
+	.name = "attiny85",
+	.display = "ATtiny85",
+
+	.signature = { 0x1E, 0x93, 0x0B },
+
+	.flashend = ATTINY85_FLASHEND,
+	.ramstart = 0x60,
+	.ramend = ATTINY85_RAMEND,
+	.e2size = 0x200,
+	.spm_pagesize = 64,
+
+	.n_vectors = 15,
+	.vector_words = 1,
+	.pc_bytes = ATTINY85_PC_BYTES,
+
+	.features = ATTINY85_FEATURES,
+
+	.io =
+	{
+		.spmcsr = IO2MEM(0x37)
+	}
+};
@@ -0,0 +1,65 @@
+#ifndef RHEA_HW_CORES_H
+#define RHEA_HW_CORES_H
+
+#include "hw/devices.h"
+
+/* Core parameters of the catalog devices. The device definitions build their
+ * entries from these and runtime/emu.c specializes a run loop on each, so a
+ * part changed here changes in both places at once. Parts described by a
+ * bundled vendor header check these against it at compile time.
+ *
+ * The ATmega1280, ATmega2560, ATtiny10 and ATtiny85 values come from
+ * avr-libc's iomxx0_1.h, iotn10.h and iotnx5.h, which are not bundled.
+ */
+
+#define ATMEGA_FEATURES \
+	(DEV_HAS_MUL | DEV_HAS_MOVW | DEV_HAS_JMP_CALL | DEV_HAS_LPMX | DEV_HAS_SPM)
+
+#define ATMEGA328P_FLASHEND	0x7FFF
+#define ATMEGA328P_RAMEND	0x8FF
+#define ATMEGA328P_FEATURES	ATMEGA_FEATURES
+#define ATMEGA328P_RAMPZ	0
+#define ATMEGA328P_EIND		0
+#define ATMEGA328P_PC_BYTES	2
+
+#define ATMEGA1280_FLASHEND	0x1FFFF
+#define ATMEGA1280_RAMEND	0x21FF
+#define ATMEGA1280_FEATURES	(ATMEGA_FEATURES | DEV_HAS_ELPM)
+#define ATMEGA1280_RAMPZ	IO2MEM(0x3B)
+#define ATMEGA1280_EIND		0
+#define ATMEGA1280_PC_BYTES	2
+
+#define ATMEGA2560_FLASHEND	0x3FFFF
+#define ATMEGA2560_RAMEND	0x21FF
+#define ATMEGA2560_FEATURES	(ATMEGA_FEATURES | DEV_HAS_ELPM | DEV_HAS_EIJMP)
+#define ATMEGA2560_RAMPZ	IO2MEM(0x3B)
+#define ATMEGA2560_EIND		IO2MEM(0x3C)
+#define ATMEGA2560_PC_BYTES	3
+
+#define ATTINY10_FLASHEND	0x3FF
+#define ATTINY10_RAMEND		0x5F
+#define ATTINY10_FEATURES	DEV_REDUCED_CORE
+#define ATTINY10_RAMPZ		0
+#define ATTINY10_EIND		0
+#define ATTINY10_PC_BYTES	2
+
+#define ATTINY85_FLASHEND	0x1FFF
+#define ATTINY85_RAMEND		0x25F
+#define ATTINY85_FEATURES	(DEV_HAS_MOVW | DEV_HAS_LPMX | DEV_HAS_SPM)
+#define ATTINY85_RAMPZ		0
+#define ATTINY85_EIND		0
+#define ATTINY85_PC_BYTES	2
+
+/* X(name, PREFIX) for every part above, PREFIX selecting its constants */
+#define DEVICE_CORES(X) \
+	X(atmega328p, ATMEGA328P) \
+	X(atmega1280, ATMEGA1280) \
+	X(atmega2560, ATMEGA2560) \
+	X(attiny10, ATTINY10) \
+	X(attiny85, ATTINY85)
+
+/* C99 has no _Static_assert; a negative array size fails the build instead */
+#define CORE_CHECK(name, cond) \
+	typedef char core_check_##name[(cond) ? 1 : -1]
+
+#endif
@@ -1,16 +1,28 @@
 #include "hw/data.h"
 
+#include "rhea_log.h"
+
 #include "util/bitmanip.h"
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+struct io_hook
+{
+	io_read_t read;
+	io_write_t write;
+	void *ctx;
+};
+
 struct avr_data
 {
-	uint8_t regs[32];
-	uint8_t *io;
-	uint8_t *sram;
+	/* Register file, I/O and SRAM share one flat allocation laid out exactly
+	 * like the AVR data space so that the whole of it can be saved/restored
+	 * with a single memcpy.
+	 */
+	uint8_t *mem;
 	uint32_t ramstart;
 	uint32_t ramend;
 
@@ -18,17 +30,26 @@ struct avr_data
 	uint8_t *membrane;
 #endif
 
+	/* One bit per DATA_BLOCK_SIZE bytes written since the last save/load */
+	uint64_t *dirty;
+	uint32_t n_dirty;
+
+	/* Indexed by data address, covers [0, ramstart) */
+	struct io_hook *hooks;
+
 	uint8_t **mmap;
 };
 
+#define DIRTY_WORD(addr)	((addr) >> (DATA_BLOCK_SHIFT + 6))
+#define DIRTY_BIT(addr)		(1ULL << (((addr) >> DATA_BLOCK_SHIFT) & 63))
+
 data_t *
 data_init(uint32_t start, uint32_t end, uint8_t sp[static 2])
 {
 	data_t *data = malloc(sizeof *data);
 	if (data)
 	{
-		data->io = calloc(start - 32, 1);
-		data->sram = calloc(end - start + 1, 1);
+		data->mem = calloc(end + 1, 1);
 		data->ramstart = start;
 		data->ramend = end;
 
@@ -36,24 +57,15 @@ data_init(uint32_t start, uint32_t end, uint8_t sp[static 2])
 		data->membrane = calloc(end + 1, 1);
 #endif
 
-		data->mmap = malloc((end + 1) * sizeof *data->mmap);
-
-		/* Technically this is not correct */
-		memset(data->regs, 0, 32);
-		memset(data->io, 0, start - 32);
-		memset(data->sram, 0, end - start + 1);
-
-		/* MMAP -> Register File */
-		for (size_t i = 0; i < 32; i++)
-			data->mmap[i] = &data->regs[i];
+		data->n_dirty = DIRTY_WORD(end) + 1;
+		data->dirty = calloc(data->n_dirty, sizeof *data->dirty);
+		data->hooks = calloc(start, sizeof *data->hooks);
 
-		/* MMAP -> IO & Ext. IO Space */
-		for (size_t i = 32; i < start; i++)
-			data->mmap[i] = data->io + (i - 32);
+		data->mmap = malloc((end + 1) * sizeof *data->mmap);
 
-		/* MMAP -> SRAM */
-		for (size_t i = start; i <= end; i++)
-			data->mmap[i] = data->sram + (i - start);
+		/* MMAP -> Register File, IO & Ext. IO Space, SRAM */
+		for (size_t i = 0; i <= end; i++)
+			data->mmap[i] = &data->mem[i];
 
 		data->mmap[SPL] = sp;
 		data->mmap[SPH] = sp + 1;
@@ -67,79 +79,185 @@ data_destroy(data_t *data)
 {
 	if (data)
 	{
-		free(data->io);
-		free(data->sram);
+		free(data->mem);
 #ifdef USE_MEMTRACK
 		free(data->membrane);
 #endif
+		free(data->dirty);
+		free(data->hooks);
 		free(data->mmap);
 		free(data);
 	}
 }
 
+/* Appends a literal to a data_dump() line */
+#define PUT(lit) \
+	do { memcpy(line + pos, lit, sizeof(lit) - 1); pos += sizeof(lit) - 1; } while (0)
+
 void
 data_dump(data_t *data, uint32_t from, uint32_t to)
 {
-	for (uint32_t base = from; base <= to; base += 32)
+	static const char HEX[] = "0123456789ABCDEF";
+
+	/* 32 bytes of at most 13 characters each, spacing, ASCII and newline */
+	char line[32 * 13 + 3 + 1 + 32 + 1];
+
+	for (uint32_t base = from; base <= to && base <= data->ramend; base += 32)
 	{
-		for (uint32_t offs = 0; offs < 32; offs++)
+		uint32_t n = (data->ramend - base < 32) ? data->ramend - base + 1 : 32;
+		size_t pos = 0;
+
+		for (uint32_t offs = 0; offs < n; offs++)
 		{
-			uint16_t addr = base + offs;
-			if (addr > data->ramend)
-				break;
+			uint32_t addr = base + offs;
 			uint8_t byte = *data->mmap[addr];
+			bool sp = (addr == SPH) || (addr == SPL);
+			bool blue = !sp && byte && (offs%2);
 
 			if (offs && !(offs%8))
-				printf(" ");
+				line[pos++] = ' ';
 
-			if ((addr == SPH) || (addr == SPL))
-				printf("\e[1m%02X\e[0m", byte);
-			else if (byte)
+			if (sp)
+				PUT("\033[1m");
+			else if (blue)
+				PUT("\033[34m");
+
+			if (sp || byte)
 			{
-				if (offs%2)
-					printf("\e[34m");
-				printf("%02X", byte);
-				if (offs%2)
-					printf("\e[0m");
+				line[pos++] = HEX[byte >> 4];
+				line[pos++] = HEX[byte & 0xF];
 			}
 			else
-			{
-				printf("..");
-			}
+				PUT("..");
+
+			if (sp || blue)
+				PUT("\033[0m");
 		}
 
-		printf(" ");
+		line[pos++] = ' ';
 
-		for (uint32_t offs = 0; offs < 32; offs++)
+		for (uint32_t offs = 0; offs < n; offs++)
 		{
-			uint16_t addr = base + offs;
-			char c = *data->mmap[addr];
+			char c = *data->mmap[base + offs];
+			line[pos++] = (c >= ' ' && c <= '~') ? c : '.';
+		}
 
-			if (!(c >= ' ' && c <= '~'))
-				c = '.';
+		line[pos++] = '\n';
+		fwrite(line, 1, pos, stdout);
+	}
+}
+
+#undef PUT
+
+size_t
+data_state_size(const data_t *data)
+{
+	size_t size = data->ramend + 1;
+
+#ifdef USE_MEMTRACK
+	size += data->ramend + 1;
+#endif
+
+	return size;
+}
 
-			printf("%c", c);
+void
+data_save(const data_t *data, uint8_t *dst)
+{
+	memcpy(dst, data->mem, data->ramend + 1);
+
+#ifdef USE_MEMTRACK
+	memcpy(dst + data->ramend + 1, data->membrane, data->ramend + 1);
+#endif
+}
+
+void
+data_load(data_t *data, const uint8_t *src)
+{
+	memcpy(data->mem, src, data->ramend + 1);
+
+#ifdef USE_MEMTRACK
+	memcpy(data->membrane, src + data->ramend + 1, data->ramend + 1);
+#endif
+
+	data_mark_clean(data);
+}
+
+void
+data_load_dirty(data_t *data, const uint8_t *src)
+{
+	const uint32_t size = data->ramend + 1;
+
+	for (uint32_t w = 0; w < data->n_dirty; w++)
+	{
+		uint64_t bits = data->dirty[w];
+
+		while (bits)
+		{
+			uint32_t block = (w << 6) + __builtin_ctzll(bits);
+			uint32_t from = block << DATA_BLOCK_SHIFT;
+			uint32_t len = DATA_BLOCK_SIZE;
+
+			if (from + len > size)
+				len = size - from;
+
+			memcpy(data->mem + from, src + from, len);
+#ifdef USE_MEMTRACK
+			memcpy(data->membrane + from, src + size + from, len);
+#endif
+
+			bits &= bits - 1;
 		}
 
-		printf("\n");
+		data->dirty[w] = 0;
 	}
 }
 
+void
+data_mark_clean(data_t *data)
+{
+	memset(data->dirty, 0, data->n_dirty * sizeof *data->dirty);
+}
+
+int
+data_hook(data_t *data, uint32_t addr, io_read_t read, io_write_t write,
+		void *ctx)
+{
+	if (addr < 32 || addr >= data->ramstart || addr == SPL || addr == SPH)
+		return -1;
+
+	bool taken = data->hooks[addr].read || data->hooks[addr].write;
+	if (taken && (read || write))
+		return -1;
+
+	data->hooks[addr].read = read;
+	data->hooks[addr].write = write;
+	data->hooks[addr].ctx = ctx;
+
+	return 0;
+}
+
 void
 data_write(data_t *data, uint32_t addr, uint8_t val)
 {
 	if (addr > data->ramend)
 	{
-		printf("Attempted to write beyond data memory 0x%04X (%d)\n", addr, addr);
-		addr %= data->ramend;
-		printf(" => wrapping to 0x%04X (%d)\n", addr, addr);
+		uint32_t wrapped = addr % data->ramend;
+		LOG_WARN(LOG_DATA, "write beyond data memory 0x%04X, "
+				"wrapping to 0x%04X", addr, wrapped);
+		addr = wrapped;
 	}
 
 #ifdef USE_MEMTRACK
 	++data->membrane[addr];
 #endif
 
+	data->dirty[DIRTY_WORD(addr)] |= DIRTY_BIT(addr);
+
 	*data->mmap[addr] = val;
+
+	if (addr < data->ramstart && data->hooks[addr].write)
+		data->hooks[addr].write(data->hooks[addr].ctx, addr, val);
 }
 
 void
@@ -157,18 +275,23 @@ data_read(data_t *data, uint32_t addr)
 {
 	if (addr > data->ramend)
 	{
-		printf("Attempted to read beyond data memory 0x%04X (%d)\n", addr, addr);
-		addr %= data->ramend;
-		printf(" => wrapping to 0x%04X (%d)\n", addr, addr);
+		uint32_t wrapped = addr % data->ramend;
+		LOG_WARN(LOG_DATA, "read beyond data memory 0x%04X, "
+				"wrapping to 0x%04X", addr, wrapped);
+		addr = wrapped;
 	}
 
 #ifdef USE_MEMTRACK
 	if (addr >= data->ramstart && data->membrane[addr] == 0)
 	{
-		printf("warning: reading from uninitialized data memory (0x%04X)\n", addr);
+		LOG_WARN(LOG_DATA, "reading from uninitialized data memory (0x%04X)", addr);
 	}
 #endif
 
+	if (addr < data->ramstart && data->hooks[addr].read)
+		return data->hooks[addr].read(data->hooks[addr].ctx, addr,
+				*data->mmap[addr]);
+
 	return *data->mmap[addr];
 }
 
@@ -184,3 +307,17 @@ data_read_word(data_t *data, uint32_t addr)
 
 	return result;
 }
+
+uint8_t
+data_peek(const data_t *data, uint32_t addr)
+{
+	return *data->mmap[addr % (data->ramend + 1)];
+}
+
+data_regs_t
+data_regs(data_t *data)
+{
+	data_regs_t regs = { .file = data->mem, .dirty = data->dirty };
+
+	return regs;
+}
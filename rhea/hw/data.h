@@ -1,15 +1,41 @@
 #ifndef HW_DATA_H
 #define HW_DATA_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #define IO2MEM(addr) ((addr) + 0x20)
 
 #define SPL IO2MEM(0x3D)
 #define SPH IO2MEM(0x3E)
+#define SREG IO2MEM(0x3F)
+
+/* Granularity of the dirty-block tracking used by data_load_dirty() */
+#define DATA_BLOCK_SHIFT 6
+#define DATA_BLOCK_SIZE (1 << DATA_BLOCK_SHIFT)
 
 typedef struct avr_data data_t;
 
+/* Direct view of the register file for the 16-bit pairs (r1:r0, r25:r24, X, Y
+ * and Z). Registers are never hooked and never checked for initialisation,
+ * so pair accesses skip data_read_word()'s and data_write_word()'s bounds
+ * checks, hooks and memtrack; stores only mark the first dirty block, which
+ * holds all of r0-r31.
+ */
+typedef struct data_regs
+{
+	uint8_t *file;
+	uint64_t *dirty;
+} data_regs_t;
+
+/* Peripheral models hook individual I/O addresses. A read hook receives the
+ * stored register value and returns what the CPU sees; a write hook is called
+ * after the value has been stored.
+ */
+typedef uint8_t (*io_read_t)(void *ctx, uint32_t addr, uint8_t val);
+typedef void (*io_write_t)(void *ctx, uint32_t addr, uint8_t val);
+
 data_t *
 data_init(uint32_t start, uint32_t end, uint8_t sp[static 2]);
 
@@ -19,6 +45,35 @@ data_destroy(data_t *data);
 void
 data_dump(data_t *data, uint32_t from, uint32_t to);
 
+/* Size of the buffer needed by data_save()/data_load(). SPL/SPH are mapped
+ * onto hw_t and are not part of the saved state.
+ */
+size_t
+data_state_size(const data_t *data);
+
+void
+data_save(const data_t *data, uint8_t *dst);
+
+void
+data_load(data_t *data, const uint8_t *src);
+
+/* Like data_load() but only copies back the blocks written since the last
+ * data_load()/data_load_dirty()/data_mark_clean(). src must be the image that
+ * was current at that point.
+ */
+void
+data_load_dirty(data_t *data, const uint8_t *src);
+
+void
+data_mark_clean(data_t *data);
+
+/* Fails outside I/O space, on SPL/SPH and on an address another hook
+ * already claims; NULL for both read and write releases addr again.
+ */
+int
+data_hook(data_t *data, uint32_t addr, io_read_t read, io_write_t write,
+		void *ctx);
+
 void
 data_write(data_t *data, uint32_t addr, uint8_t val);
 
@@ -31,4 +86,37 @@ data_read(data_t *data, uint32_t addr);
 uint16_t
 data_read_word(data_t *data, uint32_t addr);
 
+/* Reads the stored value without running hooks or diagnostics */
+uint8_t
+data_peek(const data_t *data, uint32_t addr);
+
+/* Valid for the lifetime of data */
+data_regs_t
+data_regs(data_t *data);
+
+/* r is the low register of the pair, r+1 the high one */
+static inline uint16_t
+data_read_pair(const data_regs_t *regs, uint8_t r)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint16_t val;
+	memcpy(&val, regs->file + r, sizeof val);
+	return val;
+#else
+	return regs->file[r] | (regs->file[r + 1] << 8);
+#endif
+}
+
+static inline void
+data_write_pair(const data_regs_t *regs, uint8_t r, uint16_t val)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	memcpy(regs->file + r, &val, sizeof val);
+#else
+	regs->file[r] = val & 0xFF;
+	regs->file[r + 1] = val >> 8;
+#endif
+	regs->dirty[0] |= 1;
+}
+
 #endif
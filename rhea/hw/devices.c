@@ -1,11 +1,115 @@
 #include "hw/devices.h"
 
-hw_t *atmega328p_init();
+#include "util/bitmanip.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+extern const device_t DEVICE_ATMEGA328P;
+extern const device_t DEVICE_ATMEGA1280;
+extern const device_t DEVICE_ATMEGA2560;
+extern const device_t DEVICE_ATTINY10;
+extern const device_t DEVICE_ATTINY85;
+
+static const device_t *const CATALOG[] =
+{
+	&DEVICE_ATMEGA328P,
+	&DEVICE_ATMEGA1280,
+	&DEVICE_ATMEGA2560,
+	&DEVICE_ATTINY10,
+	&DEVICE_ATTINY85
+};
+
+#define N_DEVICES (sizeof CATALOG / sizeof *CATALOG)
+
+const device_t *
+device_find(const char *name)
+{
+	if (name == NULL)
+		return NULL;
+
+	for (size_t i = 0; i < N_DEVICES; i++)
+	{
+		if (strcasecmp(CATALOG[i]->name, name) == 0)
+			return CATALOG[i];
+	}
+
+	return NULL;
+}
+
+const device_t *
+device_at(size_t i)
+{
+	return (i < N_DEVICES) ? CATALOG[i] : NULL;
+}
+
+static void
+p_destroy(hw_t **hw)
+{
+	hw_t *_hw = *hw;
+
+	if (_hw)
+	{
+		flash_destroy(_hw->flash);
+		usart_destroy(_hw->usart);
+		data_destroy(_hw->data);
+		free(_hw->eeprom);
+		free(_hw);
+		*hw = NULL;
+	}
+}
 
 hw_t *
-device_by_name(const char *mcu)
+device_create(const device_t *dev)
 {
-	hw_t *hw = atmega328p_init();
+	hw_t *hw = malloc(sizeof *hw);
+
+	if (hw)
+	{
+		const uint32_t offset = DEV_DATA_OFFSET(dev->features);
+
+		memset(hw, 0, sizeof *hw);
+
+		hw->name = dev->display;
+		hw->dev = dev;
+
+		memcpy(hw->signature, dev->signature, sizeof hw->signature);
+
+		hw->sp[0] = LOW(dev->ramend);
+		hw->sp[1] = HIGH(dev->ramend);
+
+		hw->flash = flash_init(dev->flashend);
+		hw->flashend = dev->flashend;
+		hw->data = data_init(dev->ramstart + offset, dev->ramend + offset,
+				hw->sp);
+		hw->ramend = dev->ramend + offset;
+
+		if (dev->io.ucsra && dev->io.udr)
+			hw->usart = usart_init(hw->data, dev->io.ucsra, dev->io.udr);
+
+		/* Erased EEPROM reads back as 0xFF */
+		hw->e2size = dev->e2size;
+		if (dev->e2size && (hw->eeprom = malloc(dev->e2size)))
+			memset(hw->eeprom, 0xFF, dev->e2size);
+
+		hw->state = AVR_NORMAL;
+
+		hw->destroy = p_destroy;
+
+		if (hw->flash == NULL || hw->data == NULL
+				|| (dev->e2size && hw->eeprom == NULL)
+				|| ((dev->io.ucsra && dev->io.udr) && hw->usart == NULL))
+			p_destroy(&hw);
+	}
 
 	return hw;
 }
+
+hw_t *
+device_by_name(const char *mcu)
+{
+	const device_t *dev = device_find(mcu);
+
+	return dev ? device_create(dev) : NULL;
+}
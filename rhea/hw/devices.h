@@ -8,6 +8,7 @@ extern "C" {
 #include "rhea_load.h"
 #include "hw/data.h"
 #include "hw/flash.h"
+#include "hw/usart.h"
 
 #include <stdint.h>
 #include <stddef.h>
@@ -48,9 +49,73 @@ typedef struct avr_fuse
 	unsigned int lo: 8;
 } fuse_t;
 
+/* Core features that change instruction semantics */
+#define DEV_HAS_MUL		(1 << 0)
+#define DEV_HAS_MOVW		(1 << 1)
+#define DEV_HAS_JMP_CALL	(1 << 2)	/* 32-bit JMP/CALL */
+#define DEV_HAS_LPMX		(1 << 3)	/* LPM Rd, Z and Z+ */
+#define DEV_HAS_SPM		(1 << 4)
+#define DEV_HAS_ELPM		(1 << 5)	/* RAMPZ */
+#define DEV_HAS_EIJMP		(1 << 6)	/* EIND, EICALL/EIJMP */
+#define DEV_REDUCED_CORE	(1 << 7)	/* AVRrc: r16-r31 only */
+
+/* The reduced core does not map its registers into data space; I/O starts at
+ * address 0 and flash is visible from DEV_RC_FLASH_BASE up. Rhea keeps r0-r31
+ * in front of I/O for every core, so reduced-core data addresses are shifted
+ * up by DEV_DATA_OFFSET() internally.
+ */
+#define DEV_DATA_OFFSET(features) \
+	(((features) & DEV_REDUCED_CORE) ? 0x20 : 0)
+
+#define DEV_RC_FLASH_BASE	0x4000
+
+/* Immutable description of a part. Entries are const data built from the
+ * vendor io headers (see atmega328p.c) and the core parameters in cores.h,
+ * and are collected in the catalog in devices.c.
+ */
+typedef struct avr_device
+{
+	const char *name;	/* matched case-insensitively */
+	const char *display;
+
+	uint8_t signature[3];
+
+	uint32_t flashend;
+	uint32_t ramstart;
+	uint32_t ramend;
+	uint32_t e2size;	/* bytes of EEPROM, 0 if the part has none */
+	uint16_t spm_pagesize;
+
+	uint8_t n_vectors;
+	uint8_t vector_words;
+	uint8_t pc_bytes;	/* bytes pushed by CALL */
+
+	uint32_t features;
+
+	/* Data-space addresses, 0 if absent */
+	struct
+	{
+		uint16_t rampz;
+		uint16_t eind;
+		uint16_t spmcsr;
+		uint16_t ucsra;
+		uint16_t udr;
+	} io;
+
+	/* Extended I/O the part leaves reserved, in data space; size 0 on parts
+	 * without extended I/O.
+	 */
+	struct
+	{
+		uint16_t start;
+		uint16_t size;
+	} reserved;
+} device_t;
+
 typedef struct avr_hardware
 {
 	const char *name;
+	const device_t *dev;
 
 	uint32_t pc;
 	uint8_t sp[2];
@@ -59,12 +124,15 @@ typedef struct avr_hardware
 	fuse_t fuse;
 	uint8_t signature[3];
 
-	uint32_t e2end;
-	uint8_t *eeprom;
+	uint32_t e2size;
+	uint8_t *eeprom;	/* NULL if e2size is 0 */
 
 	flash_t *flash;
 	data_t *data;
 
+	usart_t *usart;
+
+	/* ramend is in rhea's data space, see DEV_DATA_OFFSET() */
 	uint32_t flashend, ramend;
 
 	avr_state_t state;
@@ -72,6 +140,14 @@ typedef struct avr_hardware
 	void (*destroy)(struct avr_hardware **);
 } hw_t;
 
+/* NULL for unknown (or NULL) names */
+const device_t *device_find(const char *name);
+
+/* Walks the catalog; NULL past the last entry */
+const device_t *device_at(size_t i);
+
+hw_t *device_create(const device_t *dev);
+
 hw_t *device_by_name(const char *);
 
 #ifdef __cplusplus
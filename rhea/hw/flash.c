@@ -1,5 +1,7 @@
 #include "hw/flash.h"
 
+#include "rhea_log.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -72,6 +74,58 @@ flash_dump(flash_t *flash, uint32_t from, uint32_t to)
 void
 flash_write(flash_t *flash, uint32_t addr, uint8_t val)
 {
+	if (addr > flash->end)
+	{
+		LOG_ERROR(LOG_FLASH, "write beyond flash 0x%08X", addr);
+		return;
+	}
+
+	flash->data[addr] = val;
+
+	if (addr > flash->progend)
+		flash->progend = addr;
+}
+
+void
+flash_erase_page(flash_t *flash, uint32_t addr, uint32_t page_size)
+{
+	uint32_t base = (addr % (flash->end + 1)) & ~(page_size - 1);
+
+	memset(&flash->data[base], 0xFF, page_size);
+
+	if (base + page_size - 1 > flash->progend)
+		flash->progend = base + page_size - 1;
+}
+
+void
+flash_write_page(flash_t *flash, uint32_t addr, const uint8_t *buf,
+		uint32_t page_size)
+{
+	uint32_t base = (addr % (flash->end + 1)) & ~(page_size - 1);
+
+	for (uint32_t i = 0; i < page_size; i++)
+		flash->data[base + i] &= buf[i];
+
+	if (base + page_size - 1 > flash->progend)
+		flash->progend = base + page_size - 1;
+}
+
+size_t
+flash_state_size(const flash_t *flash)
+{
+	return flash->end + 1;
+}
+
+void
+flash_save(const flash_t *flash, uint8_t *dst)
+{
+	memcpy(dst, flash->data, flash->end + 1);
+}
+
+void
+flash_load(flash_t *flash, const uint8_t *src)
+{
+	memcpy(flash->data, src, flash->end + 1);
 }
 
 uint8_t
@@ -79,13 +133,14 @@ flash_read_byte(flash_t *flash, uint32_t addr)
 {
 	if (addr > flash->end)
 	{
-		fprintf(stderr, "error: attempted to read beyond data memory 0x%08X (%d)\n", addr, addr);
-		addr %= flash->end;
-		fprintf(stderr, " => wrapping to 0x%08X (%d)\n", addr, addr);
+		uint32_t wrapped = addr % flash->end;
+		LOG_ERROR(LOG_FLASH, "read beyond flash 0x%08X, "
+				"wrapping to 0x%08X", addr, wrapped);
+		addr = wrapped;
 	}
 	else if (addr > flash->progend)
 	{
-		printf("warning: reading beyond programmed flash (%X)\n", addr);
+		LOG_WARN(LOG_FLASH, "reading beyond programmed flash (%X)", addr);
 	}
 
 	return flash->data[addr];
@@ -107,3 +162,11 @@ flash_read_word(flash_t *flash, uint32_t addr)
 
 	return result;
 }
+
+uint16_t
+flash_peek_word(const flash_t *flash, uint32_t addr)
+{
+	addr = (addr * 2) % (flash->end + 1);
+
+	return (flash->data[addr + 1] << 8) | flash->data[addr];
+}
@@ -23,10 +23,34 @@ flash_dump(flash_t *flash, uint32_t from, uint32_t to);
 void
 flash_write(flash_t *, uint32_t, uint8_t);
 
+/* Self-programming on the page of page_size bytes containing addr. As on the
+ * real array, an erase sets every bit and a write can only clear bits.
+ */
+void
+flash_erase_page(flash_t *flash, uint32_t addr, uint32_t page_size);
+
+void
+flash_write_page(flash_t *flash, uint32_t addr, const uint8_t *buf,
+		uint32_t page_size);
+
+/* Size of the buffer needed by flash_save()/flash_load() */
+size_t
+flash_state_size(const flash_t *flash);
+
+void
+flash_save(const flash_t *flash, uint8_t *dst);
+
+void
+flash_load(flash_t *flash, const uint8_t *src);
+
 uint8_t
 flash_read_byte(flash_t *, uint32_t);
 
 uint16_t
 flash_read_word(flash_t *, uint32_t);
 
+/* Reads a word without bounds diagnostics, wrapping at the end of flash */
+uint16_t
+flash_peek_word(const flash_t *, uint32_t);
+
 #endif
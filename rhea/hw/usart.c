@@ -0,0 +1,134 @@
+#include "hw/usart.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* UCSRnA */
+#define RXC	(1<<7)
+#define TXC	(1<<6)
+#define UDRE	(1<<5)
+
+struct avr_usart
+{
+	uint32_t ucsra;
+	uint32_t udr;
+
+	uint8_t *rx;
+	size_t rx_len;
+	size_t rx_pos;
+	size_t rx_cap;
+
+	usart_sink_t sink;
+	void *ctx;
+};
+
+static uint8_t
+p_read_ucsra(void *ctx, uint32_t addr, uint8_t val)
+{
+	usart_t *usart = ctx;
+
+	val |= TXC | UDRE;
+
+	if (usart->rx_pos < usart->rx_len)
+		val |= RXC;
+	else
+		val &= ~RXC;
+
+	return val;
+}
+
+static uint8_t
+p_read_udr(void *ctx, uint32_t addr, uint8_t val)
+{
+	usart_t *usart = ctx;
+
+	if (usart->rx_pos < usart->rx_len)
+		return usart->rx[usart->rx_pos++];
+
+	return 0;
+}
+
+static void
+p_write_udr(void *ctx, uint32_t addr, uint8_t val)
+{
+	usart_t *usart = ctx;
+
+	if (usart->sink)
+		usart->sink(usart->ctx, val);
+}
+
+usart_t *
+usart_init(data_t *data, uint32_t ucsra, uint32_t udr)
+{
+	usart_t *usart = calloc(1, sizeof *usart);
+	if (usart)
+	{
+		usart->ucsra = ucsra;
+		usart->udr = udr;
+
+		data_hook(data, ucsra, p_read_ucsra, NULL, usart);
+		data_hook(data, udr, p_read_udr, p_write_udr, usart);
+	}
+
+	return usart;
+}
+
+void
+usart_destroy(usart_t *usart)
+{
+	if (usart)
+	{
+		free(usart->rx);
+		free(usart);
+	}
+}
+
+void
+usart_set_sink(usart_t *usart, usart_sink_t sink, void *ctx)
+{
+	usart->sink = sink;
+	usart->ctx = ctx;
+}
+
+int
+usart_feed(usart_t *usart, const uint8_t *bytes, size_t n)
+{
+	/* Compact consumed bytes before growing the buffer */
+	if (usart->rx_pos == usart->rx_len)
+	{
+		usart->rx_pos = 0;
+		usart->rx_len = 0;
+	}
+
+	if (usart->rx_len + n > usart->rx_cap)
+	{
+		size_t cap = (usart->rx_cap) ? usart->rx_cap : 64;
+		while (cap < usart->rx_len + n)
+			cap *= 2;
+
+		uint8_t *rx = realloc(usart->rx, cap);
+		if (rx == NULL)
+			return -1;
+
+		usart->rx = rx;
+		usart->rx_cap = cap;
+	}
+
+	memcpy(usart->rx + usart->rx_len, bytes, n);
+	usart->rx_len += n;
+
+	return 0;
+}
+
+size_t
+usart_pending(const usart_t *usart)
+{
+	return usart->rx_len - usart->rx_pos;
+}
+
+void
+usart_flush(usart_t *usart)
+{
+	usart->rx_pos = 0;
+	usart->rx_len = 0;
+}
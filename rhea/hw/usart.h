@@ -0,0 +1,34 @@
+#ifndef HW_USART_H
+#define HW_USART_H
+
+#include "hw/data.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Byte-level USART model: no baud timing, a received byte is available as
+ * soon as it is queued and transmitted bytes are handed to the sink at once.
+ */
+typedef struct avr_usart usart_t;
+
+typedef void (*usart_sink_t)(void *ctx, uint8_t byte);
+
+usart_t *
+usart_init(data_t *data, uint32_t ucsra, uint32_t udr);
+
+void
+usart_destroy(usart_t *usart);
+
+void
+usart_set_sink(usart_t *usart, usart_sink_t sink, void *ctx);
+
+int
+usart_feed(usart_t *usart, const uint8_t *bytes, size_t n);
+
+size_t
+usart_pending(const usart_t *usart);
+
+void
+usart_flush(usart_t *usart);
+
+#endif
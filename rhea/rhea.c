@@ -1,16 +1,30 @@
 #include "rhea_args.h"
 
 #include "app.h"
+#include "rhea_elf.h"
 #include "rhea_load.h"
+#include "rhea_log.h"
+#include "runtime/budget.h"
+#include "runtime/callgraph.h"
+#include "runtime/cosim.h"
 #include "runtime/emu.h"
+#include "runtime/fuzz.h"
+#include "runtime/gdb.h"
+#include "runtime/irqstat.h"
+#include "runtime/prof.h"
+#include "runtime/realtime.h"
+#include "runtime/semihost.h"
+#include "runtime/statediff.h"
+#include "runtime/trace.h"
 
 #include <libgen.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define DIE(fmt,...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#define DIE(...) fprintf(stderr, __VA_ARGS__)
 
 app_t g_app = { 0 };
 
@@ -18,16 +32,53 @@ option_t OPTIONS[] =
 {
 	/* FLAGS */
 	{ OPT_PAIR("--help"),    OPT_PAIR("-h"), "prints this menu and exits",         0, &g_app.help },
-	{ OPT_PAIR("--debug"),   OPT_PAIR("-d"), "enables certain debugging features", 0, &g_app.debug },
+	{ OPT_PAIR("--debug"),   OPT_PAIR("-d"), "single-steps and dumps state after every instruction", 0, &g_app.debug },
 	{ OPT_PAIR("--verbose"), OPT_PAIR("-v"), "enables verbose messages",           0, &g_app.verbose },
 
 	/* STRINGS */
 	{ "--mcu=<device>", 5,   OPT_PAIR("-m"), "sets emulation target",              1, &g_app.mcu },
+	{ "--log=<spec>", 5,     OPT_PAIR("-l"), "log levels, e.g. warn or emu=trace,data=error", 1, &g_app.log_levels },
+	{ "--log-file=<file>", 10, OPT_PAIR("-lf"), "writes log messages to a file instead of stderr", 1, &g_app.log.path },
+	{ "--cycles=<n>", 8,     OPT_PAIR("-n"), "stops after n cycles",               1, &g_app.cycles },
+	{ "--f-cpu=<hz>", 7,     OPT_PAIR("-F"), "clock that timed operations and --realtime assume (16 MHz)", 1, &g_app.f_cpu },
+	{ "--symbols=<elf>", 9,  OPT_PAIR("-s"), "loads function symbols from an ELF image", 1, &g_app.symbols },
+	{ "--profile=<file>", 9, OPT_PAIR("-p"), "writes a per-instruction profile at exit", 1, &g_app.profile },
+	{ "--profile-format=<fmt>", 16, OPT_PAIR("-pf"), "profile format, flat or callgrind", 1, &g_app.profile_format },
+	{ "--callgraph=<file>", 11, OPT_PAIR("-g"), "writes folded call stacks for flamegraphs at exit", 1, &g_app.callgraph },
+	{ "--budget=<file>", 8,  OPT_PAIR("-B"), "checks per-function cycle budgets, fails on overruns and uncalled functions", 1, &g_app.budget },
+	{ "--break=<addr,...>", 7, OPT_PAIR("-b"), "stops at flash byte addresses or function names", 1, &g_app.breaks },
+	{ "--watch=<addr[:rwc],...>", 7, OPT_PAIR("-w"), "stops on data reads, writes or changes", 1, &g_app.watches },
+	{ "--irq=<vec:first[:period],...>", 5, OPT_PAIR("-I"), "raises interrupt vectors at a cycle, once or periodically", 1, &g_app.irqs },
+	{ "--irq-stats=<file>", 11, OPT_PAIR("-IS"), "reports interrupt latency and ISR time, histograms to file", 1, &g_app.irq_stats },
+	{ "--gdb=<port|socket>", 5, OPT_PAIR("-G"), "serves the gdb remote protocol on a localhost port or unix socket", 1, &g_app.gdb },
+	{ "--trace=<file>", 7,   OPT_PAIR("-t"), "writes a binary execution trace, decode with rhea-trace", 1, &g_app.trace },
+	{ "--lcov=<file>", 6,    OPT_PAIR("-L"), "writes lcov line and branch coverage at exit, needs --symbols", 1, &g_app.lcov },
+	{ "--fuzz=<source>", 6,  OPT_PAIR("-f"), "fuzzes input from usart, sram:ADDR:LEN or eeprom:ADDR:LEN", 1, &g_app.fuzz },
+	{ "--fuzz-runs=<n>", 11, OPT_PAIR("-fr"), "number of fuzzing executions",      1, &g_app.fuzz_runs },
+	{ "--fuzz-cycles=<n>", 13, OPT_PAIR("-fc"), "cycle budget per fuzzing execution", 1, &g_app.fuzz_cycles },
+	{ "--fuzz-start=<loc|cycles:n>", 12, OPT_PAIR("-fs"), "runs to a function, address or cycle before taking the fuzzing snapshot", 1, &g_app.fuzz_start },
+	{ "--cosim=<board>", 7,  OPT_PAIR("-c"), "co-simulates the MCUs described in a board file", 1, &g_app.cosim },
+	{ "--cosim-cycles=<n>", 14, OPT_PAIR("-cc"), "cycles to co-simulate",      1, &g_app.cosim_cycles },
+	{ "--realtime[=<hz>]", 10, OPT_PAIR("-rt"), "runs no faster than a real part, hz also sets --f-cpu", OPT_RHV_OPTIONAL, &g_app.realtime },
+	{ "--realtime-tolerance=<us>", 20, OPT_PAIR("-rtt"), "drift allowed in real-time mode (1000 us)", 1, &g_app.realtime_tolerance },
+	{ "--semihost[=<addr>]", 10, OPT_PAIR("-H"),  "maps semihosting registers for output, exit and assertions (reserved I/O)", OPT_RHV_OPTIONAL, &g_app.semihost },
+	{ "--snapshot=<file>", 10, OPT_PAIR("-S"), "writes the end state for later comparison", 1, &g_app.snapshot },
+	{ "--compare=<golden>", 9, OPT_PAIR("-C"), "compares the end state against a --snapshot file", 1, &g_app.compare },
+	{ "--compare-areas=<list>", 15, OPT_PAIR("-CA"), "pc,sp,sreg,cycles,regs,io,sram,eeprom (all)", 1, &g_app.compare_areas },
 };
 
 size_t N_OPTIONS = sizeof(OPTIONS) / sizeof(OPTIONS[0]);
 
+/* Free-running mode checks for SIGINT between slices of this many cycles */
+#define RUN_SLICE 1000000
+
+/* --realtime defaults */
+#define REALTIME_TOLERANCE_US	1000
+
 static emu_t *emu;
+static symtab_t *symtab;
+
+static volatile sig_atomic_t interrupted;
 
 static void
 die_gracefully()
@@ -39,8 +90,677 @@ die_gracefully()
 static void
 handle_signal(int no)
 {
-	if (no == SIGINT)
+	if (no != SIGINT)
+		return;
+
+	/* Free-running modes finish the current slice and write their reports */
+	if (g_app.debug || interrupted)
 		die_gracefully();
+
+	interrupted = 1;
+}
+
+/* rt, if set, paces the slices to wall-clock time */
+static emu_stop_t
+run_free(emu_t *emu, uint64_t limit, realtime_t *rt)
+{
+	emu_stop_t stop = EMU_STOP_BUDGET;
+	uint64_t start = emu_cycles(emu);
+	uint64_t slice = (rt) ? realtime_batch(rt) : RUN_SLICE;
+
+	if (rt)
+		realtime_start(rt, start);
+
+	while (!interrupted && stop == EMU_STOP_BUDGET)
+	{
+		uint64_t elapsed = emu_cycles(emu) - start;
+		if (elapsed >= limit)
+			break;
+
+		uint64_t left = limit - elapsed;
+		stop = emu_run_for(emu, (left < slice) ? left : slice);
+
+		if (rt)
+			realtime_pace(rt, emu_cycles(emu));
+	}
+
+	return stop;
+}
+
+static int
+write_profile(emu_t *emu, const prof_t *prof)
+{
+	const char *fmt = (g_app.profile_format) ? g_app.profile_format : "flat";
+
+	FILE *fp = fopen(g_app.profile, "w");
+	if (fp == NULL)
+	{
+		DIE("Could not open %s\n", g_app.profile);
+		return -1;
+	}
+
+	if (strcmp(fmt, "callgrind") == 0)
+		prof_write_callgrind(prof, symtab, g_app.upload.path, fp);
+	else
+		prof_write_flat(prof, emu_hw(emu), symtab, fp);
+
+	fclose(fp);
+
+	return 0;
+}
+
+static int
+write_lcov(emu_t *emu, const lcov_t *lcov)
+{
+	linetab_t *lines = elf_load_lines(g_app.symbols);
+	if (lines == NULL)
+	{
+		DIE("No DWARF line table in %s\n", g_app.symbols);
+		return -1;
+	}
+
+	FILE *fp = fopen(g_app.lcov, "w");
+	if (fp == NULL)
+	{
+		DIE("Could not open %s\n", g_app.lcov);
+		elf_unload_lines(&lines);
+		return -1;
+	}
+
+	lcov_write(lcov, emu_hw(emu), lines, symtab, fp);
+	fclose(fp);
+
+	elf_unload_lines(&lines);
+
+	return 0;
+}
+
+static int
+write_callgraph(const callgraph_t *cg)
+{
+	FILE *fp = fopen(g_app.callgraph, "w");
+	if (fp == NULL)
+	{
+		DIE("Could not open %s\n", g_app.callgraph);
+		return -1;
+	}
+
+	callgraph_write_folded(cg, symtab, fp);
+	fclose(fp);
+
+	callgraph_write_summary(cg, symtab, stdout);
+
+	return 0;
+}
+
+static int
+check_budget(const budget_t *budget)
+{
+	uint64_t over = budget_violations(budget);
+
+	budget_write_report(budget, stdout);
+
+	/* A budget that never ran is usually a typo or a wrong address */
+	uint32_t unused = budget_write_unused(budget, stderr);
+
+	if (over)
+		fprintf(stderr, "%s: %llu invocations over budget\n", g_app.name,
+				(unsigned long long) over);
+
+	return (over || unused) ? -1 : 0;
+}
+
+/* A flash byte address or a function name from --symbols */
+static int
+find_location(const char *tok, uint32_t *addr)
+{
+	char *end;
+	uint32_t val = strtoul(tok, &end, 0);
+
+	if (*end != '\0')
+	{
+		const elf_sym_t *sym = symtab_find(symtab, tok);
+		if (sym == NULL)
+			return -1;
+
+		val = sym->addr;
+	}
+
+	*addr = val;
+
+	return 0;
+}
+
+/* Parses a comma-separated --break list; entries are byte addresses or
+ * function names from --symbols.
+ */
+static int
+set_breakpoints(emu_t *emu, const char *spec)
+{
+	char *list = strdup(spec);
+	int status = 0;
+
+	for (char *tok = strtok(list, ","); tok && status == 0; tok = strtok(NULL, ","))
+	{
+		uint32_t addr;
+
+		if (find_location(tok, &addr) == -1)
+		{
+			DIE("Unknown breakpoint location '%s'\n", tok);
+			status = -1;
+			break;
+		}
+
+		if ((status = emu_break_set(emu, addr / 2)) == -1)
+			DIE("Cannot set breakpoint at 0x%X\n", addr);
+	}
+
+	free(list);
+
+	return status;
+}
+
+/* Parses a comma-separated --watch list of addr[:flags], flags being any of
+ * r (read), w (write) and c (change); the default is w.
+ */
+static int
+set_watchpoints(emu_t *emu, const char *spec)
+{
+	char *list = strdup(spec);
+	int status = 0;
+
+	for (char *tok = strtok(list, ","); tok && status == 0; tok = strtok(NULL, ","))
+	{
+		char *end;
+		uint32_t addr = strtoul(tok, &end, 0);
+		uint8_t flags = (*end == '\0') ? EMU_WATCH_WRITE : 0;
+
+		if (*end == ':')
+		{
+			for (++end; *end; end++)
+			{
+				if (*end == 'r')
+					flags |= EMU_WATCH_READ;
+				else if (*end == 'w')
+					flags |= EMU_WATCH_WRITE;
+				else if (*end == 'c')
+					flags |= EMU_WATCH_CHANGE;
+				else
+					break;
+			}
+		}
+
+		if (end == tok || *end != '\0' || flags == 0
+				|| emu_watch_set(emu, addr, flags) == -1)
+		{
+			DIE("Invalid watchpoint '%s'\n", tok);
+			status = -1;
+		}
+	}
+
+	free(list);
+
+	return status;
+}
+
+/* Writes --snapshot and checks --compare against the state at exit. Returns
+ * -1 on errors and when the state differs from the golden snapshot.
+ */
+static int
+check_end_state(emu_t *emu)
+{
+	uint8_t areas = STATE_ALL;
+
+	if (g_app.compare_areas
+			&& statediff_parse_areas(g_app.compare_areas, &areas) == -1)
+	{
+		DIE("Invalid comparison areas '%s'\n", g_app.compare_areas);
+		return -1;
+	}
+
+	emu_snapshot_t *snap = emu_snapshot(emu);
+	if (snap == NULL)
+		return -1;
+
+	int status = 0;
+
+	if (g_app.snapshot && emu_snapshot_write(snap, g_app.snapshot) == -1)
+	{
+		DIE("Could not write %s\n", g_app.snapshot);
+		status = -1;
+	}
+
+	if (g_app.compare)
+	{
+		emu_snapshot_t *golden = emu_snapshot_read(g_app.compare);
+		statediff_t *diff = (golden) ? statediff(golden, snap, areas) : NULL;
+
+		if (diff == NULL)
+		{
+			DIE("Could not compare against %s\n", g_app.compare);
+			status = -1;
+		}
+		else if (diff->n_ranges)
+		{
+			statediff_write(diff, stdout);
+			status = -1;
+		}
+		else if (g_app.verbose)
+		{
+			fprintf(stderr, "%s: end state matches %s\n", g_app.name,
+					g_app.compare);
+		}
+
+		statediff_destroy(&diff);
+		emu_snapshot_destroy(&golden);
+	}
+
+	emu_snapshot_destroy(&snap);
+
+	return status;
+}
+
+static int
+unknown_device(void)
+{
+	if (g_app.mcu)
+		DIE("Unknown device '%s'. Supported devices:\n", g_app.mcu);
+	else
+		DIE("Must include option --mcu=<device>. Supported devices:\n");
+
+	const device_t *dev;
+	for (size_t i = 0; (dev = device_at(i)) != NULL; i++)
+		DIE("  %s\n", dev->name);
+
+	return EXIT_FAILURE;
+}
+
+static int
+gdb_main(emu_t *emu)
+{
+	fprintf(stderr, "%s: waiting for gdb on %s\n", g_app.name, g_app.gdb);
+
+	if (gdb_serve(emu, g_app.gdb) == -1)
+	{
+		DIE("Could not serve gdb on %s\n", g_app.gdb);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* Parses a comma-separated --irq list of vector:first[:period], all in
+ * cycles
+ */
+static int
+schedule_interrupts(emu_t *emu, const char *spec)
+{
+	char *list = strdup(spec);
+	int status = 0;
+
+	for (char *tok = strtok(list, ","); tok && status == 0; tok = strtok(NULL, ","))
+	{
+		char *end;
+		unsigned long vector = strtoul(tok, &end, 0);
+		uint64_t first = 0;
+		uint64_t period = 0;
+		bool valid = end != tok && *end == ':';
+
+		if (valid)
+		{
+			first = strtoull(end + 1, &end, 0);
+			if (*end == ':')
+				period = strtoull(end + 1, &end, 0);
+
+			valid = *end == '\0' && vector <= UINT8_MAX;
+		}
+
+		if (!valid || emu_irq_schedule(emu, vector, first, period) == -1)
+		{
+			DIE("Invalid interrupt '%s'\n", tok);
+			status = -1;
+		}
+	}
+
+	free(list);
+
+	return status;
+}
+
+/* --f-cpu and --realtime=<hz> */
+static int
+set_clock(emu_t *emu, const char *hz)
+{
+	char *end;
+	uint64_t f_cpu = strtoull(hz, &end, 0);
+
+	if (end == hz || *end != '\0' || emu_set_f_cpu(emu, f_cpu) == -1)
+	{
+		DIE("Invalid clock '%s'\n", hz);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+write_irq_stats(irqstat_t *st)
+{
+	FILE *fp = fopen(g_app.irq_stats, "w");
+	if (fp == NULL)
+	{
+		DIE("Could not open %s\n", g_app.irq_stats);
+		return -1;
+	}
+
+	irqstat_write_hists(st, fp);
+	fclose(fp);
+
+	irqstat_write_summary(st, symtab, stdout);
+
+	return 0;
+}
+
+/* Runs the firmware up to where --fuzz-start says it reads its input, either
+ * "cycles:<n>" or a location as for --break, so that every execution starts
+ * from there instead of from reset.
+ */
+static int
+run_to_input(emu_t *emu, const char *spec)
+{
+	uint64_t limit = (g_app.cycles) ? strtoull(g_app.cycles, NULL, 0) : UINT64_MAX;
+	emu_stop_t stop;
+	emu_stop_t expect;
+
+	if (strncmp(spec, "cycles:", 7) == 0)
+	{
+		stop = run_free(emu, strtoull(spec + 7, NULL, 0), NULL);
+		expect = EMU_STOP_BUDGET;
+	}
+	else
+	{
+		uint32_t addr;
+
+		if (find_location(spec, &addr) == -1 || emu_break_set(emu, addr / 2) == -1)
+		{
+			DIE("Invalid fuzzing start '%s'\n", spec);
+			return -1;
+		}
+
+		stop = run_free(emu, limit, NULL);
+		expect = EMU_STOP_BREAKPOINT;
+
+		emu_break_clear(emu, addr / 2);
+	}
+
+	if (stop != expect)
+	{
+		DIE("Firmware stopped (%s) after %llu cycles, before the fuzzing start\n",
+				emu_stop_str(stop), (unsigned long long) emu_cycles(emu));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+fuzz_main(emu_t *emu)
+{
+	fuzz_config_t cfg = { 0 };
+
+	if (fuzz_parse_source(g_app.fuzz, &cfg) == -1)
+	{
+		DIE("Invalid fuzzing source '%s'\n", g_app.fuzz);
+		return EXIT_FAILURE;
+	}
+
+	uint64_t runs = (g_app.fuzz_runs) ? strtoull(g_app.fuzz_runs, NULL, 0) : 100000;
+	cfg.budget = (g_app.fuzz_cycles) ? strtoull(g_app.fuzz_cycles, NULL, 0) : 1000000;
+
+	if (g_app.fuzz_start && run_to_input(emu, g_app.fuzz_start) == -1)
+		return EXIT_FAILURE;
+
+	uint8_t *map = calloc(FUZZ_MAP_SIZE, 1);
+	fuzz_t *fuzz = (map) ? fuzz_init(emu, &cfg, map) : NULL;
+	if (fuzz == NULL)
+	{
+		DIE("Could not set up fuzzing for '%s'\n", g_app.fuzz);
+		free(map);
+		return EXIT_FAILURE;
+	}
+
+	int crashes = fuzz_loop(fuzz, runs, 0);
+
+	fuzz_destroy(&fuzz);
+	free(map);
+
+	return (crashes == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int
+run_main(emu_t *emu)
+{
+	int status = EXIT_FAILURE;
+	uint64_t limit = (g_app.cycles) ? strtoull(g_app.cycles, NULL, 0) : UINT64_MAX;
+
+	realtime_t *rt = NULL;
+	semihost_t *sh = NULL;
+	prof_t *prof = NULL;
+	budget_t *budget = NULL;
+	callgraph_t *cg = NULL;
+	lcov_t *lcov = NULL;
+	irqstat_t *irqstat = NULL;
+	trace_t *trace = NULL;
+
+	if (g_app.breaks && set_breakpoints(emu, g_app.breaks) == -1)
+		goto out;
+
+	if (g_app.watches && set_watchpoints(emu, g_app.watches) == -1)
+		goto out;
+
+	if (g_app.realtime)
+	{
+		if (*g_app.realtime && set_clock(emu, g_app.realtime) == -1)
+			goto out;
+
+		uint64_t f_cpu = emu_f_cpu(emu);
+		uint64_t tolerance = (g_app.realtime_tolerance) ?
+			strtoull(g_app.realtime_tolerance, NULL, 0) : REALTIME_TOLERANCE_US;
+
+		if ((rt = realtime_init(f_cpu, tolerance * 1000)) == NULL)
+		{
+			DIE("Invalid real-time tolerance\n");
+			goto out;
+		}
+	}
+
+	if (g_app.semihost)
+	{
+		uint32_t base = (*g_app.semihost) ?
+			strtoul(g_app.semihost, NULL, 0) : semihost_base(emu);
+
+		if (base == 0)
+		{
+			DIE("%s has no reserved I/O for semihosting, give an address "
+					"with --semihost=<addr>\n", emu_hw(emu)->name);
+			goto out;
+		}
+
+		if ((sh = semihost_init(emu, base, stdout)) == NULL)
+		{
+			DIE("Cannot map semihosting registers at 0x%X\n", base);
+			goto out;
+		}
+	}
+
+	if (g_app.profile)
+	{
+		prof = prof_init((emu_hw(emu)->flashend + 1) / 2);
+		if (prof == NULL)
+			goto out;
+
+		emu_set_profiler(emu, prof);
+	}
+
+	if (g_app.budget && (budget = budget_load(g_app.budget, symtab)) == NULL)
+	{
+		DIE("Could not load budgets from %s\n", g_app.budget);
+		goto out;
+	}
+
+	if (g_app.callgraph || budget)
+	{
+		cg = callgraph_init(emu_hw(emu)->pc, emu_cycles(emu));
+		if (cg == NULL)
+			goto out;
+
+		if (budget)
+			budget_attach(budget, cg);
+
+		emu_set_callgraph(emu, cg);
+	}
+
+	if (g_app.lcov)
+	{
+		if (g_app.symbols == NULL)
+		{
+			DIE("--lcov needs the ELF image given with --symbols\n");
+			goto out;
+		}
+
+		lcov = lcov_init((emu_hw(emu)->flashend + 1) / 2);
+		if (lcov == NULL)
+			goto out;
+
+		emu_set_lcov(emu, lcov);
+	}
+
+	if (g_app.irq_stats)
+	{
+		irqstat = irqstat_init(emu_hw(emu)->dev->n_vectors, emu_cycles(emu));
+		if (irqstat == NULL)
+			goto out;
+
+		emu_set_irqstat(emu, irqstat);
+	}
+
+	if (g_app.trace)
+	{
+		trace = trace_init(g_app.trace, emu_hw(emu), 0);
+		if (trace == NULL)
+		{
+			DIE("Could not open %s\n", g_app.trace);
+			goto out;
+		}
+
+		emu_set_trace(emu, trace);
+	}
+
+	status = EXIT_SUCCESS;
+
+	emu_stop_t stop = run_free(emu, limit, rt);
+
+	if (rt)
+		realtime_write_summary(rt, stderr);
+
+	if (trace)
+	{
+		emu_set_trace(emu, NULL);
+		trace_destroy(&trace);
+	}
+
+	if (stop == EMU_STOP_BREAKPOINT)
+	{
+		fprintf(stderr, "%s: breakpoint at 0x%04X after %llu cycles\n",
+				g_app.name, emu_hw(emu)->pc * 2,
+				(unsigned long long) emu_cycles(emu));
+	}
+	else if (stop == EMU_STOP_WATCHPOINT)
+	{
+		fprintf(stderr, "%s: watchpoint on 0x%04X, next pc 0x%04X after "
+				"%llu cycles\n", g_app.name, emu_watch_addr(emu),
+				emu_hw(emu)->pc * 2, (unsigned long long) emu_cycles(emu));
+	}
+	else if (g_app.verbose)
+	{
+		fprintf(stderr, "%s: %s after %llu cycles\n", g_app.name,
+				(stop == EMU_STOP_BUDGET) ? "stopped" : emu_stop_str(stop),
+				(unsigned long long) emu_cycles(emu));
+	}
+
+	if (stop == EMU_STOP_CRASH || stop == EMU_STOP_SEGFAULT)
+		status = EXIT_FAILURE;
+
+	int exit_status;
+	if (sh && semihost_exited(sh, &exit_status))
+		status = exit_status;
+	semihost_destroy(&sh);
+
+	if (prof && write_profile(emu, prof) == -1)
+		status = EXIT_FAILURE;
+
+	if (cg)
+	{
+		callgraph_finish(cg, emu_cycles(emu));
+
+		if (g_app.callgraph && write_callgraph(cg) == -1)
+			status = EXIT_FAILURE;
+	}
+
+	if (budget && check_budget(budget) == -1)
+		status = EXIT_FAILURE;
+
+	if (irqstat)
+	{
+		irqstat_finish(irqstat, emu_cycles(emu));
+
+		if (write_irq_stats(irqstat) == -1)
+			status = EXIT_FAILURE;
+	}
+
+	if (lcov && write_lcov(emu, lcov) == -1)
+		status = EXIT_FAILURE;
+
+	if ((g_app.snapshot || g_app.compare) && check_end_state(emu) == -1)
+		status = EXIT_FAILURE;
+
+out:
+	/* Also reached when setting up fails half way */
+	emu_set_trace(emu, NULL);
+	emu_set_irqstat(emu, NULL);
+	emu_set_lcov(emu, NULL);
+	emu_set_callgraph(emu, NULL);
+	emu_set_profiler(emu, NULL);
+
+	trace_destroy(&trace);
+	irqstat_destroy(&irqstat);
+	lcov_destroy(&lcov);
+	callgraph_destroy(&cg);
+	budget_destroy(&budget);
+	prof_destroy(&prof);
+	semihost_destroy(&sh);
+	realtime_destroy(&rt);
+
+	return status;
+}
+
+static int
+cosim_main(void)
+{
+	cosim_t *cosim = cosim_load(g_app.cosim);
+	if (cosim == NULL)
+	{
+		DIE("Could not load board description '%s'\n", g_app.cosim);
+		return EXIT_FAILURE;
+	}
+
+	uint64_t cycles = (g_app.cosim_cycles) ?
+		strtoull(g_app.cosim_cycles, NULL, 0) : UINT64_MAX;
+
+	int status = cosim_run(cosim, cycles);
+	cosim_destroy(&cosim);
+
+	return (status == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int
@@ -63,6 +783,26 @@ main(int argc, char **argv)
 
 	if (g_app.help)
 		usage_exit(0);
+
+	if (g_app.log_levels && log_parse_levels(g_app.log_levels) == -1)
+	{
+		DIE("Invalid log specification '%s'\n", g_app.log_levels);
+		return EXIT_FAILURE;
+	}
+
+	FILE *log_fp = NULL;
+	if (g_app.log.path)
+	{
+		if ((log_fp = fopen(g_app.log.path, "w")) == NULL)
+		{
+			DIE("Could not open %s\n", g_app.log.path);
+			return EXIT_FAILURE;
+		}
+		log_set_sink(log_fp);
+	}
+
+	if (g_app.cosim)
+		return cosim_main();
 	else if (g_app.upload.path == NULL)
 		DIE("Must include option --mcu=<device>");
 	else if (g_app.upload.type == FT_NONE)
@@ -70,6 +810,9 @@ main(int argc, char **argv)
 	else if (g_app.upload.type != FT_IHEX)
 		DIE("Only Intel HEX files can be uploaded at this time");
 
+	if (device_find(g_app.mcu) == NULL)
+		return unknown_device();
+
 	chunk_t *chunks;
 	int n = rhea_load_file(g_app.upload, &chunks);
 	if (n == -1)
@@ -83,8 +826,33 @@ main(int argc, char **argv)
 	emu = emu_init(g_app.mcu, chunks, n);
 	rhea_unload_file(g_app.upload, &chunks, n);
 
-	emu_run(emu);
+	if (emu == NULL)
+		return EXIT_FAILURE;
+
+	if (g_app.symbols && (symtab = elf_load_symbols(g_app.symbols)) == NULL)
+		DIE("Could not read symbols from %s\n", g_app.symbols);
+
+	if (g_app.f_cpu && set_clock(emu, g_app.f_cpu) == -1)
+		status = EXIT_FAILURE;
+	else if (g_app.irqs && schedule_interrupts(emu, g_app.irqs) == -1)
+		status = EXIT_FAILURE;
+	else if (g_app.fuzz)
+		status = fuzz_main(emu);
+	else if (g_app.gdb)
+		status = gdb_main(emu);
+	else if (g_app.debug)
+		emu_run(emu);
+	else
+		status = run_main(emu);
+
 	emu_destroy(&emu);
+	elf_unload_symbols(&symtab);
+
+	if (log_fp)
+	{
+		log_set_sink(NULL);
+		fclose(log_fp);
+	}
 
 	return status;
 }
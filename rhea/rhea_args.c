@@ -75,8 +75,18 @@ parse_args(char **args, size_t count)
 					size_t eq = (is_abbr) ? opt->alen : opt->nlen;
 					size_t rval = eq + 1;
 
+					// --option or --option=RVAL, never the next argument
+					if (opt->has_rhv == OPT_RHV_OPTIONAL)
+					{
+						if (arg[eq] == '\0')
+							* (char **) opt->value = "";
+						else if (arg[eq] == '=')
+							* (char **) opt->value = &arg[rval];
+						else
+							continue;
+					}
 					// --option RVAL
-					if (rval > strlen(arg))
+					else if (rval > strlen(arg))
 					{
 						// Check option bounds
 						if (i + 1 <= count - 1)
@@ -3,9 +3,13 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #define OPT_PAIR(flag) flag, (sizeof(flag)-1)
 
+/* has_rhv for --option[=RVAL], which stores "" when given bare */
+#define OPT_RHV_OPTIONAL 2
+
 typedef struct option
 {
 	const char *name;
@@ -16,7 +20,7 @@ typedef struct option
 
 	const char *desc;
 
-	bool has_rhv;
+	uint8_t has_rhv;
 
 	void *value;
 } option_t;
@@ -0,0 +1,57 @@
+/* rhea-diff: compares two snapshots written by `rhea --snapshot=<file>`.
+ * Exits with 0 if the compared areas match, 1 if they differ and 2 on errors.
+ */
+
+#include "runtime/emu.h"
+#include "runtime/statediff.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 3 || argc > 4)
+	{
+		fprintf(stderr, "usage: %s <expected> <actual> [areas]\n", argv[0]);
+		return 2;
+	}
+
+	uint8_t areas = STATE_ALL;
+
+	if (argc == 4 && statediff_parse_areas(argv[3], &areas) == -1)
+	{
+		fprintf(stderr, "%s: invalid areas '%s'\n", argv[0], argv[3]);
+		return 2;
+	}
+
+	emu_snapshot_t *a = emu_snapshot_read(argv[1]);
+	emu_snapshot_t *b = emu_snapshot_read(argv[2]);
+	int status = 2;
+
+	if (a == NULL || b == NULL)
+	{
+		fprintf(stderr, "%s: %s is not a rhea snapshot\n", argv[0],
+				(a == NULL) ? argv[1] : argv[2]);
+	}
+	else
+	{
+		statediff_t *diff = statediff(a, b, areas);
+
+		if (diff == NULL)
+			fprintf(stderr, "%s: snapshots are of different devices\n", argv[0]);
+		else
+		{
+			if (diff->n_ranges)
+				statediff_write(diff, stdout);
+
+			status = (diff->n_ranges) ? 1 : 0;
+			statediff_destroy(&diff);
+		}
+	}
+
+	emu_snapshot_destroy(&a);
+	emu_snapshot_destroy(&b);
+
+	return status;
+}
@@ -0,0 +1,1001 @@
+#include "rhea_elf.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EI_CLASS	4
+#define EI_DATA		5
+#define ELFCLASS32	1
+#define ELFDATA2LSB	1
+
+#define SHT_SYMTAB	2
+#define STT_FUNC	2
+
+/* Data space symbols are linked at 0x800000 and above */
+#define AVR_DATA_BASE	0x800000
+
+/* DWARF line number program */
+#define DW_LNS_copy		1
+#define DW_LNS_advance_pc	2
+#define DW_LNS_advance_line	3
+#define DW_LNS_set_file		4
+#define DW_LNS_const_add_pc	8
+#define DW_LNS_fixed_advance_pc	9
+
+#define DW_LNE_end_sequence	1
+#define DW_LNE_set_address	2
+
+#define DW_LNCT_path		1
+#define DW_LNCT_directory_index	2
+
+#define DW_FORM_data2		0x05
+#define DW_FORM_data4		0x06
+#define DW_FORM_data8		0x07
+#define DW_FORM_string		0x08
+#define DW_FORM_block		0x09
+#define DW_FORM_data1		0x0B
+#define DW_FORM_sdata		0x0D
+#define DW_FORM_strp		0x0E
+#define DW_FORM_udata		0x0F
+#define DW_FORM_data16		0x1E
+#define DW_FORM_line_strp	0x1F
+
+#define NONE UINT32_MAX
+
+struct symtab
+{
+	char *strings;
+	elf_sym_t *syms;
+	size_t n;
+};
+
+struct linetab
+{
+	char **files;
+	size_t n_files;
+
+	elf_line_t *lines;
+	size_t n;
+	size_t cap;
+};
+
+struct dw_section
+{
+	const uint8_t *data;
+	size_t size;
+};
+
+/* Bounds-checked cursor; reads past end set bad and return zeroes */
+struct dw_reader
+{
+	const uint8_t *p;
+	const uint8_t *end;
+	bool bad;
+};
+
+/* File name table of one line program, indexed by DW_LNS_set_file */
+struct dw_files
+{
+	const char **dirs;
+	uint32_t n_dirs;
+
+	const char **names;
+	uint32_t *dir;
+	uint32_t *global;	/* linetab->files index, NONE until used */
+	uint32_t n;
+};
+
+/* Row waiting for the next address to close its range */
+struct dw_row
+{
+	bool valid;
+	uint32_t addr;
+	uint32_t file;
+	uint32_t line;
+};
+
+static uint16_t
+p_u16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t
+p_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint8_t *
+p_slurp(const char *path, size_t *size)
+{
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL)
+		return NULL;
+
+	uint8_t *buf = NULL;
+
+	if (fseek(fp, 0, SEEK_END) == 0)
+	{
+		long len = ftell(fp);
+		rewind(fp);
+
+		if (len > 0 && (buf = malloc(len)) != NULL)
+		{
+			if (fread(buf, 1, len, fp) != (size_t) len)
+			{
+				free(buf);
+				buf = NULL;
+			}
+
+			*size = len;
+		}
+	}
+
+	fclose(fp);
+
+	return buf;
+}
+
+static int
+p_compare_sym(const void *a, const void *b)
+{
+	const elf_sym_t *sa = a;
+	const elf_sym_t *sb = b;
+
+	return (sa->addr > sb->addr) - (sa->addr < sb->addr);
+}
+
+static symtab_t *
+p_parse_symtab(const uint8_t *img, size_t size)
+{
+	if (size < 52 || memcmp(img, "\x7F" "ELF", 4) != 0 ||
+		img[EI_CLASS] != ELFCLASS32 || img[EI_DATA] != ELFDATA2LSB)
+	{
+		return NULL;
+	}
+
+	uint32_t shoff = p_u32(img + 32);
+	uint16_t shentsize = p_u16(img + 46);
+	uint16_t shnum = p_u16(img + 48);
+
+	if (shentsize < 40 || shoff + (size_t) shnum * shentsize > size)
+		return NULL;
+
+	for (uint16_t i = 0; i < shnum; i++)
+	{
+		const uint8_t *sh = img + shoff + i * shentsize;
+
+		if (p_u32(sh + 4) != SHT_SYMTAB)
+			continue;
+
+		uint32_t off = p_u32(sh + 16);
+		uint32_t len = p_u32(sh + 20);
+		uint32_t link = p_u32(sh + 24);
+		uint32_t entsize = p_u32(sh + 36);
+
+		if (link >= shnum || entsize < 16 || off + (size_t) len > size)
+			return NULL;
+
+		const uint8_t *strsh = img + shoff + link * shentsize;
+		uint32_t stroff = p_u32(strsh + 16);
+		uint32_t strsize = p_u32(strsh + 20);
+
+		if (strsize == 0 || stroff + (size_t) strsize > size)
+			return NULL;
+
+		symtab_t *symtab = calloc(1, sizeof *symtab);
+		if (symtab == NULL)
+			return NULL;
+
+		symtab->strings = malloc(strsize + 1);
+		symtab->syms = malloc((len / entsize) * sizeof *symtab->syms);
+		if (symtab->strings == NULL || symtab->syms == NULL)
+		{
+			elf_unload_symbols(&symtab);
+			return NULL;
+		}
+
+		memcpy(symtab->strings, img + stroff, strsize);
+		symtab->strings[strsize] = '\0';
+
+		for (uint32_t j = 0; j < len / entsize; j++)
+		{
+			const uint8_t *st = img + off + j * entsize;
+
+			uint32_t name = p_u32(st + 0);
+			uint32_t value = p_u32(st + 4);
+			uint32_t symsize = p_u32(st + 8);
+			uint8_t info = st[12];
+			uint16_t shndx = p_u16(st + 14);
+
+			if ((info & 0xF) != STT_FUNC || shndx == 0 ||
+				value >= AVR_DATA_BASE || name >= strsize)
+			{
+				continue;
+			}
+
+			elf_sym_t *sym = &symtab->syms[symtab->n++];
+			sym->name = symtab->strings + name;
+			sym->addr = value;
+			sym->size = symsize;
+		}
+
+		qsort(symtab->syms, symtab->n, sizeof *symtab->syms, p_compare_sym);
+
+		return symtab;
+	}
+
+	return NULL;
+}
+
+symtab_t *
+elf_load_symbols(const char *path)
+{
+	size_t size = 0;
+	uint8_t *img = p_slurp(path, &size);
+	if (img == NULL)
+		return NULL;
+
+	symtab_t *symtab = p_parse_symtab(img, size);
+	free(img);
+
+	return symtab;
+}
+
+void
+elf_unload_symbols(symtab_t **symtab)
+{
+	symtab_t *_symtab = *symtab;
+
+	if (_symtab)
+	{
+		free(_symtab->strings);
+		free(_symtab->syms);
+		free(_symtab);
+		*symtab = NULL;
+	}
+}
+
+size_t
+symtab_count(const symtab_t *symtab)
+{
+	return (symtab) ? symtab->n : 0;
+}
+
+const elf_sym_t *
+symtab_at(const symtab_t *symtab, size_t i)
+{
+	return &symtab->syms[i];
+}
+
+const elf_sym_t *
+symtab_lookup(const symtab_t *symtab, uint32_t addr)
+{
+	if (symtab == NULL || symtab->n == 0)
+		return NULL;
+
+	/* Last symbol starting at or before addr */
+	size_t lo = 0, hi = symtab->n;
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+
+		if (symtab->syms[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == 0)
+		return NULL;
+
+	const elf_sym_t *sym = &symtab->syms[lo - 1];
+
+	/* Symbols without a size cover everything up to the next one */
+	if (sym->size && addr >= sym->addr + sym->size)
+		return NULL;
+
+	return sym;
+}
+
+const elf_sym_t *
+symtab_find(const symtab_t *symtab, const char *name)
+{
+	for (size_t i = 0; i < symtab_count(symtab); i++)
+	{
+		if (strcmp(symtab->syms[i].name, name) == 0)
+			return &symtab->syms[i];
+	}
+
+	return NULL;
+}
+
+static uint64_t
+p_dw_fixed(struct dw_reader *r, size_t n)
+{
+	if ((size_t) (r->end - r->p) < n || n > 8)
+	{
+		r->p = r->end;
+		r->bad = true;
+		return 0;
+	}
+
+	uint64_t val = 0;
+	for (size_t i = 0; i < n; i++)
+		val |= (uint64_t) r->p[i] << (8 * i);
+
+	r->p += n;
+
+	return val;
+}
+
+static uint64_t
+p_dw_uleb(struct dw_reader *r)
+{
+	uint64_t val = 0;
+	unsigned shift = 0;
+
+	while (r->p < r->end)
+	{
+		uint8_t byte = *r->p++;
+
+		if (shift < 64)
+			val |= (uint64_t) (byte & 0x7F) << shift;
+		shift += 7;
+
+		if (!(byte & 0x80))
+			return val;
+	}
+
+	r->bad = true;
+
+	return 0;
+}
+
+static int64_t
+p_dw_sleb(struct dw_reader *r)
+{
+	int64_t val = 0;
+	unsigned shift = 0;
+
+	while (r->p < r->end)
+	{
+		uint8_t byte = *r->p++;
+
+		if (shift < 64)
+			val |= (int64_t) (byte & 0x7F) << shift;
+		shift += 7;
+
+		if (!(byte & 0x80))
+		{
+			if (shift < 64 && (byte & 0x40))
+				val |= -((int64_t) 1 << shift);
+			return val;
+		}
+	}
+
+	r->bad = true;
+
+	return 0;
+}
+
+static void
+p_dw_skip(struct dw_reader *r, uint64_t n)
+{
+	if ((uint64_t) (r->end - r->p) < n)
+	{
+		r->p = r->end;
+		r->bad = true;
+	}
+	else
+		r->p += n;
+}
+
+static const char *
+p_dw_str(struct dw_reader *r)
+{
+	const uint8_t *nul = memchr(r->p, '\0', r->end - r->p);
+	if (nul == NULL)
+	{
+		r->p = r->end;
+		r->bad = true;
+		return NULL;
+	}
+
+	const char *str = (const char *) r->p;
+	r->p = nul + 1;
+
+	return str;
+}
+
+/* String at off in .debug_str or .debug_line_str */
+static const char *
+p_dw_strp(const struct dw_section *sec, uint64_t off)
+{
+	if (sec->data == NULL || off >= sec->size
+			|| memchr(sec->data + off, '\0', sec->size - off) == NULL)
+		return NULL;
+
+	return (const char *) sec->data + off;
+}
+
+static bool
+p_find_section(const uint8_t *img, size_t size, const char *name,
+		struct dw_section *out)
+{
+	uint32_t shoff = p_u32(img + 32);
+	uint16_t shentsize = p_u16(img + 46);
+	uint16_t shnum = p_u16(img + 48);
+	uint16_t shstrndx = p_u16(img + 50);
+
+	if (shentsize < 40 || shstrndx >= shnum
+			|| shoff + (size_t) shnum * shentsize > size)
+		return false;
+
+	const uint8_t *strsh = img + shoff + shstrndx * shentsize;
+	uint32_t stroff = p_u32(strsh + 16);
+	uint32_t strsize = p_u32(strsh + 20);
+
+	if (stroff + (size_t) strsize > size)
+		return false;
+
+	for (uint16_t i = 0; i < shnum; i++)
+	{
+		const uint8_t *sh = img + shoff + i * shentsize;
+		uint32_t sh_name = p_u32(sh + 0);
+		uint32_t off = p_u32(sh + 16);
+		uint32_t len = p_u32(sh + 20);
+
+		if (sh_name >= strsize || off + (size_t) len > size)
+			continue;
+
+		const char *sec = (const char *) img + stroff + sh_name;
+
+		if (strnlen(sec, strsize - sh_name) < strsize - sh_name
+				&& strcmp(sec, name) == 0)
+		{
+			out->data = img + off;
+			out->size = len;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static uint32_t
+p_intern_file(linetab_t *lines, const char *dir, const char *name)
+{
+	size_t dlen = (dir && name[0] != '/') ? strlen(dir) : 0;
+	char *path = malloc(dlen + 1 + strlen(name) + 1);
+	if (path == NULL)
+		return NONE;
+
+	if (dlen)
+		sprintf(path, "%s/%s", dir, name);
+	else
+		strcpy(path, name);
+
+	for (size_t i = 0; i < lines->n_files; i++)
+	{
+		if (strcmp(lines->files[i], path) == 0)
+		{
+			free(path);
+			return i;
+		}
+	}
+
+	char **files = realloc(lines->files, (lines->n_files + 1) * sizeof *files);
+	if (files == NULL)
+	{
+		free(path);
+		return NONE;
+	}
+
+	lines->files = files;
+	lines->files[lines->n_files] = path;
+
+	return lines->n_files++;
+}
+
+static uint32_t
+p_dw_file(linetab_t *lines, struct dw_files *files, uint64_t file)
+{
+	if (file >= files->n || files->names[file] == NULL)
+		return NONE;
+
+	if (files->global[file] == NONE)
+	{
+		uint32_t d = files->dir[file];
+		const char *dir = (d < files->n_dirs) ? files->dirs[d] : NULL;
+		char *joined = NULL;
+
+		/* DWARF 5 directories are relative to the compilation directory */
+		if (dir && d && dir[0] != '/' && files->dirs[0])
+		{
+			joined = malloc(strlen(files->dirs[0]) + 1 + strlen(dir) + 1);
+			if (joined)
+				sprintf(joined, "%s/%s", files->dirs[0], dir);
+			dir = joined;
+		}
+
+		files->global[file] = p_intern_file(lines, dir, files->names[file]);
+		free(joined);
+	}
+
+	return files->global[file];
+}
+
+static int
+p_dw_row(linetab_t *lines, struct dw_files *files, struct dw_row *row,
+		uint64_t addr, uint64_t file, int64_t line, bool end)
+{
+	if (row->valid && addr > row->addr && row->line > 0)
+	{
+		uint32_t global = p_dw_file(lines, files, row->file);
+
+		if (global != NONE)
+		{
+			if (lines->n == lines->cap)
+			{
+				size_t cap = (lines->cap) ? lines->cap * 2 : 1024;
+				elf_line_t *grown = realloc(lines->lines, cap * sizeof *grown);
+				if (grown == NULL)
+					return -1;
+
+				lines->lines = grown;
+				lines->cap = cap;
+			}
+
+			lines->lines[lines->n++] = (elf_line_t)
+			{
+				.addr = row->addr, .end = addr,
+				.file = global, .line = row->line
+			};
+		}
+	}
+
+	row->valid = !end;
+	row->addr = addr;
+	row->file = file;
+	row->line = (line > 0 && line <= UINT32_MAX) ? line : 0;
+
+	return 0;
+}
+
+/* One attribute of a DWARF 5 directory or file name entry */
+static bool
+p_dw_form(struct dw_reader *r, uint64_t form, size_t offset_size,
+		const struct dw_section *str, const struct dw_section *line_str,
+		uint64_t *val, const char **name)
+{
+	switch (form)
+	{
+		case DW_FORM_string: *name = p_dw_str(r); break;
+		case DW_FORM_strp: *name = p_dw_strp(str, p_dw_fixed(r, offset_size)); break;
+		case DW_FORM_line_strp: *name = p_dw_strp(line_str, p_dw_fixed(r, offset_size)); break;
+		case DW_FORM_udata: *val = p_dw_uleb(r); break;
+		case DW_FORM_sdata: *val = p_dw_sleb(r); break;
+		case DW_FORM_data1: *val = p_dw_fixed(r, 1); break;
+		case DW_FORM_data2: *val = p_dw_fixed(r, 2); break;
+		case DW_FORM_data4: *val = p_dw_fixed(r, 4); break;
+		case DW_FORM_data8: *val = p_dw_fixed(r, 8); break;
+		case DW_FORM_data16: p_dw_skip(r, 16); break;
+		case DW_FORM_block: p_dw_skip(r, p_dw_uleb(r)); break;
+		default: return false;
+	}
+
+	return !r->bad;
+}
+
+static bool
+p_dw_alloc_files(struct dw_files *files, uint64_t n)
+{
+	if (n > UINT16_MAX)
+		return false;
+
+	files->n = n;
+	files->names = calloc(n + 1, sizeof *files->names);
+	files->dir = calloc(n + 1, sizeof *files->dir);
+	files->global = malloc((n + 1) * sizeof *files->global);
+
+	if (files->names == NULL || files->dir == NULL || files->global == NULL)
+		return false;
+
+	for (uint64_t i = 0; i < n; i++)
+		files->global[i] = NONE;
+
+	return true;
+}
+
+/* DWARF 2-4: NUL-terminated lists of directories and of file entries, both
+ * indexed from 1. Directory 0 is the compilation directory, which only
+ * .debug_info names, so such paths are left relative.
+ */
+static bool
+p_dw_files_v4(struct dw_reader *r, struct dw_files *files)
+{
+	struct dw_reader scan = *r;
+	uint32_t n_dirs = 1;
+	uint32_t n_files = 1;
+	const char *str;
+
+	while ((str = p_dw_str(&scan)) != NULL && *str)
+		++n_dirs;
+
+	while ((str = p_dw_str(&scan)) != NULL && *str)
+	{
+		p_dw_uleb(&scan);
+		p_dw_uleb(&scan);
+		p_dw_uleb(&scan);
+		++n_files;
+	}
+
+	if (scan.bad || !p_dw_alloc_files(files, n_files))
+		return false;
+
+	if ((files->dirs = calloc(n_dirs, sizeof *files->dirs)) == NULL)
+		return false;
+	files->n_dirs = n_dirs;
+
+	for (uint32_t i = 1; i < n_dirs; i++)
+		files->dirs[i] = p_dw_str(r);
+	p_dw_str(r);
+
+	for (uint32_t i = 1; i < n_files; i++)
+	{
+		files->names[i] = p_dw_str(r);
+		files->dir[i] = p_dw_uleb(r);
+		p_dw_uleb(r);
+		p_dw_uleb(r);
+	}
+	p_dw_str(r);
+
+	return !r->bad;
+}
+
+/* DWARF 5: self-describing entry formats, both tables indexed from 0 */
+static bool
+p_dw_files_v5(struct dw_reader *r, struct dw_files *files, size_t offset_size,
+		const struct dw_section *str, const struct dw_section *line_str)
+{
+	for (int table = 0; table < 2; table++)
+	{
+		uint8_t n_formats = p_dw_fixed(r, 1);
+		uint64_t formats[2 * UINT8_MAX];
+
+		for (uint8_t i = 0; i < n_formats; i++)
+		{
+			formats[2 * i] = p_dw_uleb(r);
+			formats[2 * i + 1] = p_dw_uleb(r);
+		}
+
+		uint64_t n = p_dw_uleb(r);
+
+		if (r->bad)
+			return false;
+
+		if (table == 0)
+		{
+			if (n > UINT16_MAX || (files->dirs = calloc(n + 1, sizeof *files->dirs)) == NULL)
+				return false;
+			files->n_dirs = n;
+		}
+		else if (!p_dw_alloc_files(files, n))
+			return false;
+
+		for (uint64_t e = 0; e < n; e++)
+		{
+			const char *name = NULL;
+			uint64_t dir = 0;
+
+			for (uint8_t i = 0; i < n_formats; i++)
+			{
+				uint64_t val = 0;
+				const char *s = NULL;
+
+				if (!p_dw_form(r, formats[2 * i + 1], offset_size, str,
+						line_str, &val, &s))
+					return false;
+
+				if (formats[2 * i] == DW_LNCT_path)
+					name = s;
+				else if (formats[2 * i] == DW_LNCT_directory_index)
+					dir = val;
+			}
+
+			if (table == 0)
+				files->dirs[e] = name;
+			else
+			{
+				files->names[e] = name;
+				files->dir[e] = dir;
+			}
+		}
+	}
+
+	return true;
+}
+
+static void
+p_dw_free_files(struct dw_files *files)
+{
+	free(files->dirs);
+	free(files->names);
+	free(files->dir);
+	free(files->global);
+}
+
+/* Runs the line number program of one unit. Units of unsupported versions
+ * or with malformed headers are skipped.
+ */
+static int
+p_dw_unit(linetab_t *lines, struct dw_reader *u, size_t offset_size,
+		const struct dw_section *str, const struct dw_section *line_str)
+{
+	uint16_t version = p_dw_fixed(u, 2);
+	if (version < 2 || version > 5)
+		return 0;
+
+	if (version >= 5)
+		p_dw_skip(u, 2);	/* address_size, segment_selector_size */
+
+	uint64_t header_length = p_dw_fixed(u, offset_size);
+	if (u->bad || header_length > (uint64_t) (u->end - u->p))
+		return 0;
+
+	const uint8_t *program = u->p + header_length;
+
+	uint8_t min_len = p_dw_fixed(u, 1);
+	if (version >= 4)
+		p_dw_skip(u, 1);	/* maximum_operations_per_instruction */
+	p_dw_skip(u, 1);		/* default_is_stmt */
+	int8_t line_base = p_dw_fixed(u, 1);
+	uint8_t line_range = p_dw_fixed(u, 1);
+	uint8_t opcode_base = p_dw_fixed(u, 1);
+
+	const uint8_t *std_lens = u->p;
+	p_dw_skip(u, (opcode_base) ? opcode_base - 1 : 0);
+
+	if (u->bad || line_range == 0 || opcode_base == 0)
+		return 0;
+
+	struct dw_files files = { 0 };
+	bool ok = (version >= 5) ?
+		p_dw_files_v5(u, &files, offset_size, str, line_str) :
+		p_dw_files_v4(u, &files);
+
+	if (!ok)
+	{
+		p_dw_free_files(&files);
+		return 0;
+	}
+
+	u->p = program;
+
+	struct dw_row row = { 0 };
+	uint64_t addr = 0;
+	uint64_t file = 1;
+	int64_t line = 1;
+	int status = 0;
+
+	while (u->p < u->end && !u->bad && status == 0)
+	{
+		uint8_t opcode = p_dw_fixed(u, 1);
+
+		if (opcode >= opcode_base)
+		{
+			uint8_t adj = opcode - opcode_base;
+
+			addr += (adj / line_range) * min_len;
+			line += line_base + adj % line_range;
+			status = p_dw_row(lines, &files, &row, addr, file, line, false);
+			continue;
+		}
+
+		switch (opcode)
+		{
+			case 0:
+			{
+				uint64_t len = p_dw_uleb(u);
+				if (len == 0 || len > (uint64_t) (u->end - u->p))
+				{
+					u->bad = true;
+					break;
+				}
+
+				const uint8_t *next = u->p + len;
+				uint8_t sub = p_dw_fixed(u, 1);
+
+				if (sub == DW_LNE_end_sequence)
+				{
+					status = p_dw_row(lines, &files, &row, addr, file, line, true);
+					addr = 0;
+					file = 1;
+					line = 1;
+				}
+				else if (sub == DW_LNE_set_address)
+					addr = p_dw_fixed(u, len - 1);
+
+				u->p = next;
+				break;
+			}
+			case DW_LNS_copy:
+				status = p_dw_row(lines, &files, &row, addr, file, line, false);
+				break;
+			case DW_LNS_advance_pc:
+				addr += p_dw_uleb(u) * min_len;
+				break;
+			case DW_LNS_advance_line:
+				line += p_dw_sleb(u);
+				break;
+			case DW_LNS_set_file:
+				file = p_dw_uleb(u);
+				break;
+			case DW_LNS_const_add_pc:
+				addr += ((255 - opcode_base) / line_range) * min_len;
+				break;
+			case DW_LNS_fixed_advance_pc:
+				addr += p_dw_fixed(u, 2);
+				break;
+			default:
+				for (uint8_t i = 0; i < std_lens[opcode - 1]; i++)
+					p_dw_uleb(u);
+				break;
+		}
+	}
+
+	p_dw_free_files(&files);
+
+	return status;
+}
+
+static int
+p_compare_line(const void *a, const void *b)
+{
+	const elf_line_t *la = a;
+	const elf_line_t *lb = b;
+
+	return (la->addr > lb->addr) - (la->addr < lb->addr);
+}
+
+static linetab_t *
+p_parse_lines(const uint8_t *img, size_t size)
+{
+	if (size < 52 || memcmp(img, "\x7F" "ELF", 4) != 0 ||
+		img[EI_CLASS] != ELFCLASS32 || img[EI_DATA] != ELFDATA2LSB)
+	{
+		return NULL;
+	}
+
+	struct dw_section debug_line = { 0 };
+	struct dw_section str = { 0 };
+	struct dw_section line_str = { 0 };
+
+	if (!p_find_section(img, size, ".debug_line", &debug_line))
+		return NULL;
+
+	p_find_section(img, size, ".debug_str", &str);
+	p_find_section(img, size, ".debug_line_str", &line_str);
+
+	linetab_t *lines = calloc(1, sizeof *lines);
+	if (lines == NULL)
+		return NULL;
+
+	struct dw_reader r = { debug_line.data, debug_line.data + debug_line.size, false };
+
+	while (r.p < r.end && !r.bad)
+	{
+		size_t offset_size = 4;
+		uint64_t length = p_dw_fixed(&r, 4);
+
+		if (length == 0xFFFFFFFF)
+		{
+			offset_size = 8;
+			length = p_dw_fixed(&r, 8);
+		}
+
+		if (r.bad || length > (uint64_t) (r.end - r.p))
+			break;
+
+		struct dw_reader unit = { r.p, r.p + length, false };
+		r.p += length;
+
+		if (p_dw_unit(lines, &unit, offset_size, &str, &line_str) == -1)
+		{
+			elf_unload_lines(&lines);
+			return NULL;
+		}
+	}
+
+	if (lines->n == 0)
+	{
+		elf_unload_lines(&lines);
+		return NULL;
+	}
+
+	qsort(lines->lines, lines->n, sizeof *lines->lines, p_compare_line);
+
+	return lines;
+}
+
+linetab_t *
+elf_load_lines(const char *path)
+{
+	size_t size = 0;
+	uint8_t *img = p_slurp(path, &size);
+	if (img == NULL)
+		return NULL;
+
+	linetab_t *lines = p_parse_lines(img, size);
+	free(img);
+
+	return lines;
+}
+
+void
+elf_unload_lines(linetab_t **lines)
+{
+	linetab_t *_lines = *lines;
+
+	if (_lines)
+	{
+		for (size_t i = 0; i < _lines->n_files; i++)
+			free(_lines->files[i]);
+		free(_lines->files);
+		free(_lines->lines);
+		free(_lines);
+		*lines = NULL;
+	}
+}
+
+size_t
+linetab_count(const linetab_t *lines)
+{
+	return (lines) ? lines->n : 0;
+}
+
+const elf_line_t *
+linetab_at(const linetab_t *lines, size_t i)
+{
+	return &lines->lines[i];
+}
+
+const elf_line_t *
+linetab_lookup(const linetab_t *lines, uint32_t addr)
+{
+	if (lines == NULL || lines->n == 0)
+		return NULL;
+
+	/* Last range starting at or before addr */
+	size_t lo = 0, hi = lines->n;
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+
+		if (lines->lines[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == 0 || addr >= lines->lines[lo - 1].end)
+		return NULL;
+
+	return &lines->lines[lo - 1];
+}
+
+size_t
+linetab_files(const linetab_t *lines)
+{
+	return (lines) ? lines->n_files : 0;
+}
+
+const char *
+linetab_file(const linetab_t *lines, uint32_t file)
+{
+	return lines->files[file];
+}
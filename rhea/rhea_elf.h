@@ -0,0 +1,77 @@
+#ifndef RHEA_ELF_H
+#define RHEA_ELF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct elf_sym
+{
+	const char *name;
+
+	/* Flash byte address and size in bytes */
+	uint32_t addr;
+	uint32_t size;
+} elf_sym_t;
+
+typedef struct symtab symtab_t;
+
+/* Loads the function symbols of an AVR ELF image, sorted by address */
+symtab_t *
+elf_load_symbols(const char *path);
+
+void
+elf_unload_symbols(symtab_t **symtab);
+
+size_t
+symtab_count(const symtab_t *symtab);
+
+const elf_sym_t *
+symtab_at(const symtab_t *symtab, size_t i);
+
+/* Function containing the flash byte address, or NULL */
+const elf_sym_t *
+symtab_lookup(const symtab_t *symtab, uint32_t addr);
+
+const elf_sym_t *
+symtab_find(const symtab_t *symtab, const char *name);
+
+/* Flash byte addresses [addr, end) generated for a source line, from the
+ * DWARF .debug_line table. file indexes linetab_file().
+ */
+typedef struct elf_line
+{
+	uint32_t addr;
+	uint32_t end;
+
+	uint32_t file;
+	uint32_t line;
+} elf_line_t;
+
+typedef struct linetab linetab_t;
+
+/* Loads the line table of every compilation unit (DWARF 2 to 5), sorted by
+ * address. NULL if the image has no usable .debug_line.
+ */
+linetab_t *
+elf_load_lines(const char *path);
+
+void
+elf_unload_lines(linetab_t **lines);
+
+size_t
+linetab_count(const linetab_t *lines);
+
+const elf_line_t *
+linetab_at(const linetab_t *lines, size_t i);
+
+/* Range containing the flash byte address, or NULL */
+const elf_line_t *
+linetab_lookup(const linetab_t *lines, uint32_t addr);
+
+size_t
+linetab_files(const linetab_t *lines);
+
+const char *
+linetab_file(const linetab_t *lines, uint32_t file);
+
+#endif
@@ -12,6 +12,9 @@
 #define IHEX_DATA 0x00
 #define IHEX_EOF  0x01
 #define IHEX_ESA  0x02
+#define IHEX_SSA  0x03
+#define IHEX_ELA  0x04
+#define IHEX_SLA  0x05
 
 int
 p_record_to_array(uint8_t buff[], size_t max, char *recd, size_t len)
@@ -108,8 +111,13 @@ ihex_load(const char *path, chunk_t **chunks)
 				break;
 			case IHEX_ESA:
 				segment = (bytes[4] << 12) | (bytes[5] << 4);
-				break;
+				continue;
+			case IHEX_ELA:
+				segment = ((uint32_t) bytes[4] << 24) | (bytes[5] << 16);
+				continue;
 			case IHEX_EOF:
+			case IHEX_SSA:
+			case IHEX_SLA:
 				continue;
 		}
 
@@ -0,0 +1,87 @@
+/* libFuzzer front end for the in-process fuzzing mode, built with
+ * `make fuzzer`. The firmware and input source are configured through the
+ * environment:
+ *
+ *   RHEA_FUZZ_IMAGE   Intel HEX image to load (required)
+ *   RHEA_FUZZ_MCU     device name, defaults to atmega328p
+ *   RHEA_FUZZ_SOURCE  usart, sram:ADDR:LEN or eeprom:ADDR:LEN (default usart)
+ *   RHEA_FUZZ_CYCLES  cycle budget per input (default 1000000)
+ *
+ * Firmware edge coverage is exported through libFuzzer's extra counters, so
+ * the fuzzer is guided by the emulated program rather than by rhea itself.
+ */
+
+#include "rhea_load.h"
+#include "runtime/emu.h"
+#include "runtime/fuzz.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+uint8_t g_counters[FUZZ_MAP_SIZE]
+	__attribute__((section("__libfuzzer_extra_counters"), aligned(64)));
+
+static emu_t *emu;
+static fuzz_t *fuzz;
+
+static const char *
+p_env(const char *name, const char *fallback)
+{
+	const char *val = getenv(name);
+
+	return (val) ? val : fallback;
+}
+
+int
+LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+	file_t image = { p_env("RHEA_FUZZ_IMAGE", NULL), FT_IHEX };
+	fuzz_config_t cfg = { 0 };
+
+	if (image.path == NULL)
+	{
+		fprintf(stderr, "RHEA_FUZZ_IMAGE is not set\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fuzz_parse_source(p_env("RHEA_FUZZ_SOURCE", "usart"), &cfg) == -1)
+	{
+		fprintf(stderr, "Invalid RHEA_FUZZ_SOURCE\n");
+		exit(EXIT_FAILURE);
+	}
+
+	cfg.budget = strtoull(p_env("RHEA_FUZZ_CYCLES", "1000000"), NULL, 0);
+
+	chunk_t *chunks;
+	int n = rhea_load_file(image, &chunks);
+	if (n == -1)
+	{
+		fprintf(stderr, "Could not load %s\n", image.path);
+		exit(EXIT_FAILURE);
+	}
+
+	emu = emu_init(p_env("RHEA_FUZZ_MCU", "atmega328p"), chunks, n);
+	rhea_unload_file(image, &chunks, n);
+
+	fuzz = (emu) ? fuzz_init(emu, &cfg, g_counters) : NULL;
+	if (fuzz == NULL)
+	{
+		fprintf(stderr, "Could not set up fuzzing\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	emu_stop_t stop = fuzz_one(fuzz, data, size);
+
+	/* Let libFuzzer report the crash and save the input */
+	if (stop == EMU_STOP_CRASH || stop == EMU_STOP_SEGFAULT)
+		abort();
+
+	return 0;
+}
@@ -0,0 +1,173 @@
+#include "rhea_log.h"
+
+#include "attributes.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define LOG_BUF_SIZE	(64 * 1024)
+#define LOG_LINE_MAX	1024
+
+uint8_t g_log_levels[LOG_N_SYS] =
+{
+	[LOG_EMU] = LOG_LVL_WARN,
+	[LOG_DATA] = LOG_LVL_WARN,
+	[LOG_FLASH] = LOG_LVL_WARN,
+	[LOG_IO] = LOG_LVL_WARN
+};
+
+static const char *SYS_STR[LOG_N_SYS] =
+{
+	[LOG_EMU] = "emu",
+	[LOG_DATA] = "data",
+	[LOG_FLASH] = "flash",
+	[LOG_IO] = "io"
+};
+
+static const char *LEVEL_STR[] =
+{
+	[LOG_LVL_NONE] = "none",
+	[LOG_LVL_ERROR] = "error",
+	[LOG_LVL_WARN] = "warning",
+	[LOG_LVL_INFO] = "info",
+	[LOG_LVL_DEBUG] = "debug",
+	[LOG_LVL_TRACE] = "trace"
+};
+
+struct log_buf
+{
+	size_t len;
+	char data[LOG_BUF_SIZE];
+};
+
+static FILE *sink;
+
+/* One buffer per thread so co-simulated MCUs never contend on the sink */
+static __thread struct log_buf buf;
+
+void
+log_flush(void)
+{
+	if (buf.len)
+	{
+		FILE *fp = sink ? sink : stderr;
+
+		fwrite(buf.data, 1, buf.len, fp);
+		fflush(fp);
+		buf.len = 0;
+	}
+}
+
+static void ATTR_DTOR
+p_flush_at_exit(void)
+{
+	log_flush();
+}
+
+void
+log_write(log_sys_t sys, log_level_t lvl, const char *fmt, ...)
+{
+	if (LOG_BUF_SIZE - buf.len < LOG_LINE_MAX)
+		log_flush();
+
+	char *out = buf.data + buf.len;
+	size_t room = LOG_LINE_MAX - 1;
+	int n = 0;
+
+	if (lvl <= LOG_LVL_INFO)
+		n = snprintf(out, room, "%s: %s: ", LEVEL_STR[lvl], SYS_STR[sys]);
+
+	va_list args;
+	va_start(args, fmt);
+	int m = vsnprintf(out + n, room - n, fmt, args);
+	va_end(args);
+
+	if (m < 0)
+		m = 0;
+	else if ((size_t) m >= room - n)
+		m = room - n - 1;
+
+	n += m;
+	out[n++] = '\n';
+	buf.len += n;
+
+	if (lvl == LOG_LVL_ERROR)
+		log_flush();
+}
+
+void
+log_set_sink(FILE *fp)
+{
+	log_flush();
+	sink = fp;
+}
+
+void
+log_set_level(log_sys_t sys, log_level_t lvl)
+{
+	g_log_levels[sys] = lvl;
+}
+
+static int
+p_parse_level(const char *str, size_t len)
+{
+	for (size_t i = 0; i < sizeof LEVEL_STR / sizeof *LEVEL_STR; i++)
+	{
+		if (strlen(LEVEL_STR[i]) == len && strncmp(LEVEL_STR[i], str, len) == 0)
+			return i;
+	}
+
+	/* "warn" is accepted alongside the printed "warning" */
+	if (len == 4 && strncmp(str, "warn", 4) == 0)
+		return LOG_LVL_WARN;
+
+	return -1;
+}
+
+static int
+p_parse_sys(const char *str, size_t len)
+{
+	for (size_t i = 0; i < LOG_N_SYS; i++)
+	{
+		if (strlen(SYS_STR[i]) == len && strncmp(SYS_STR[i], str, len) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+int
+log_parse_levels(const char *spec)
+{
+	while (*spec)
+	{
+		size_t len = strcspn(spec, ",");
+		const char *eq = memchr(spec, '=', len);
+
+		if (eq == NULL)
+		{
+			int lvl = p_parse_level(spec, len);
+			if (lvl == -1)
+				return -1;
+
+			for (size_t i = 0; i < LOG_N_SYS; i++)
+				g_log_levels[i] = lvl;
+		}
+		else
+		{
+			int sys = p_parse_sys(spec, eq - spec);
+			int lvl = p_parse_level(eq + 1, len - (eq - spec) - 1);
+			if (sys == -1 || lvl == -1)
+				return -1;
+
+			g_log_levels[sys] = lvl;
+		}
+
+		spec += len;
+		if (*spec == ',')
+			++spec;
+	}
+
+	return 0;
+}
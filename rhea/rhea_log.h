@@ -0,0 +1,76 @@
+#ifndef RHEA_LOG_H
+#define RHEA_LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum log_level
+{
+	LOG_LVL_NONE = 0,
+	LOG_LVL_ERROR,
+	LOG_LVL_WARN,
+	LOG_LVL_INFO,
+	LOG_LVL_DEBUG,
+	LOG_LVL_TRACE
+} log_level_t;
+
+typedef enum log_sys
+{
+	LOG_EMU = 0,
+	LOG_DATA,
+	LOG_FLASH,
+	LOG_IO,
+	LOG_N_SYS
+} log_sys_t;
+
+/* Levels above RHEA_LOG_LEVEL are removed by the compiler; everything else
+ * costs a single compare against the runtime threshold of its subsystem.
+ */
+#ifndef RHEA_LOG_LEVEL
+	#ifdef DEBUG
+		#define RHEA_LOG_LEVEL LOG_LVL_TRACE
+	#else
+		#define RHEA_LOG_LEVEL LOG_LVL_INFO
+	#endif
+#endif
+
+extern uint8_t g_log_levels[LOG_N_SYS];
+
+#define LOG_ENABLED(sys, lvl) \
+	((lvl) <= RHEA_LOG_LEVEL && (lvl) <= g_log_levels[(sys)])
+
+#define LOG(sys, lvl, ...) \
+	do { \
+		if (LOG_ENABLED(sys, lvl)) \
+			log_write((sys), (lvl), __VA_ARGS__); \
+	} while (0)
+
+#define LOG_ERROR(sys, ...)	LOG(sys, LOG_LVL_ERROR, __VA_ARGS__)
+#define LOG_WARN(sys, ...)		LOG(sys, LOG_LVL_WARN, __VA_ARGS__)
+#define LOG_INFO(sys, ...)		LOG(sys, LOG_LVL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(sys, ...)	LOG(sys, LOG_LVL_DEBUG, __VA_ARGS__)
+#define LOG_TRACE(sys, ...)	LOG(sys, LOG_LVL_TRACE, __VA_ARGS__)
+
+/* Formats into a per-thread buffer that is written to the sink when it
+ * fills, on errors and on log_flush(). Trace and debug messages are
+ * printed bare, other levels get a "level: subsystem: " prefix.
+ */
+void
+log_write(log_sys_t sys, log_level_t lvl, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+void
+log_flush(void);
+
+/* Defaults to stderr; the sink is not closed by the logger */
+void
+log_set_sink(FILE *fp);
+
+void
+log_set_level(log_sys_t sys, log_level_t lvl);
+
+/* Parses "level" or "sys=level,sys=level,..." e.g. "warn,emu=trace" */
+int
+log_parse_levels(const char *spec);
+
+#endif
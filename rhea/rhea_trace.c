@@ -0,0 +1,286 @@
+/* rhea-trace: decodes a binary trace written by `rhea --trace=<file>` into
+ * annotated disassembly.
+ */
+
+#include "runtime/decode.h"
+#include "runtime/trace.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_RECORDS	4096
+#define MAX_EFFECTS	8
+
+/* Pointer operand of the LD/ST forms */
+static const char *
+p_pointer_str(instr_t instr)
+{
+	switch (instr)
+	{
+		case LD_X: case ST_X: return "X";
+		case LD_X_INC: case ST_X_INC: return "X+";
+		case LD_X_DEC: case ST_X_DEC: return "-X";
+		case LD_Y_INC: case ST_Y_INC: return "Y+";
+		case LD_Y_DEC: case ST_Y_DEC: return "-Y";
+		case LD_Z_INC: case ST_Z_INC: return "Z+";
+		case LD_Z_DEC: case ST_Z_DEC: return "-Z";
+		default: return "?";
+	}
+}
+
+static void
+p_format_operands(const op_t *op, uint32_t pc, char *buf, size_t n)
+{
+	uint32_t rel = pc + 1 + (int32_t) op->k;
+	const char *ptr = (op->instr == LDD_Y || op->instr == STD_Y) ? "Y" : "Z";
+
+	buf[0] = '\0';
+
+	switch (op->instr)
+	{
+		case ADD: case ADC: case SUB: case SBC:
+		case AND: case EOR: case OR:
+		case CP: case CPC: case CPSE: case MOV:
+		case MUL: case MULS: case MULSU:
+		case FMUL: case FMULS: case FMULSU:
+			snprintf(buf, n, "r%u, r%u", op->rd, op->rr);
+			break;
+		case MOVW:
+			snprintf(buf, n, "r%u:%u, r%u:%u",
+					op->rd + 1, op->rd, op->rr + 1, op->rr);
+			break;
+		case SUBI: case SBCI: case ANDI: case CBR:
+		case ORI: case SBR: case CPI: case LDI:
+			snprintf(buf, n, "r%u, 0x%02X", op->rd, (uint8_t) op->k);
+			break;
+		case ADIW: case SBIW:
+			snprintf(buf, n, "r%u:%u, %u", op->rd + 1, op->rd, op->k);
+			break;
+		case LSL: case ROL: case TST: case CLR: case SER:
+		case INC: case DEC: case COM: case NEG:
+		case ASR: case LSR: case ROR: case SWAP: case POP:
+			snprintf(buf, n, "r%u", op->rd);
+			break;
+		case PUSH:
+			snprintf(buf, n, "r%u", op->rr);
+			break;
+		case CALL: case JMP:
+			snprintf(buf, n, "0x%04" PRIX32, op->k * 2);
+			break;
+		case RCALL: case RJMP:
+		case BRCS: case BREQ: case BRMI: case BRVS:
+		case BRLT: case BRHS: case BRTS: case BRIE: case BRLO:
+		case BRCC: case BRNE: case BRPL: case BRVC:
+		case BRGE: case BRHC: case BRTC: case BRID: case BRSH:
+			snprintf(buf, n, ".%+d\t; 0x%04" PRIX32,
+					(int) (int32_t) op->k * 2, rel * 2);
+			break;
+		case BRBS: case BRBC:
+			snprintf(buf, n, "%u, .%+d\t; 0x%04" PRIX32,
+					op->s, (int) (int32_t) op->k * 2, rel * 2);
+			break;
+		case IN:
+			snprintf(buf, n, "r%u, 0x%02X", op->rd, op->a);
+			break;
+		case OUT:
+			snprintf(buf, n, "0x%02X, r%u", op->a, op->rr);
+			break;
+		case SBI: case CBI: case SBIC: case SBIS:
+			snprintf(buf, n, "0x%02X, %u", op->a, op->b);
+			break;
+		case SBRC: case SBRS:
+			snprintf(buf, n, "r%u, %u", op->rr, op->b);
+			break;
+		case BLD: case BST:
+			snprintf(buf, n, "r%u, %u", op->rd, op->b);
+			break;
+		case BSET: case BCLR:
+			snprintf(buf, n, "%u", op->s);
+			break;
+		case LD_X: case LD_X_INC: case LD_X_DEC:
+		case LD_Y_INC: case LD_Y_DEC: case LD_Z_INC: case LD_Z_DEC:
+			snprintf(buf, n, "r%u, %s", op->rd, p_pointer_str(op->instr));
+			break;
+		case ST_X: case ST_X_INC: case ST_X_DEC:
+		case ST_Y_INC: case ST_Y_DEC: case ST_Z_INC: case ST_Z_DEC:
+			snprintf(buf, n, "%s, r%u", p_pointer_str(op->instr), op->rr);
+			break;
+		case LPM: case ELPM:
+			if ((op->raw & 0xFE00) == 0x9000)
+				snprintf(buf, n, "r%u, Z%s", op->rd, (op->raw & 1) ? "+" : "");
+			break;
+		case SPM:
+			if (op->raw & 0x0010)
+				snprintf(buf, n, "Z+");
+			break;
+		case LDS:
+			snprintf(buf, n, "r%u, 0x%04" PRIX32, op->rd, op->k);
+			break;
+		case STS:
+			snprintf(buf, n, "0x%04" PRIX32 ", r%u", op->k, op->rr);
+			break;
+		case LDD_Y: case LDD_Z:
+			snprintf(buf, n, "r%u, %s+%u", op->rd, ptr, op->q);
+			break;
+		case STD_Y: case STD_Z:
+			snprintf(buf, n, "%s+%u, r%u", ptr, op->q, op->rr);
+			break;
+		default:
+			break;
+	}
+}
+
+static bool
+p_read_header(FILE *fp, const char *path, struct trace_header *out)
+{
+	struct trace_header header;
+
+	if (fread(&header, sizeof header, 1, fp) != 1
+			|| header.magic != TRACE_MAGIC)
+	{
+		fprintf(stderr, "%s: not a rhea trace\n", path);
+		return false;
+	}
+
+	if (header.version != TRACE_VERSION
+			|| header.rec_size != sizeof(struct trace_rec))
+	{
+		fprintf(stderr, "%s: unsupported trace version %u\n",
+				path, header.version);
+		return false;
+	}
+
+	printf("; device signature %02X %02X %02X, flashend 0x%" PRIX32
+			", ramend 0x%" PRIX32 "\n",
+			header.signature[0], header.signature[1],
+			header.signature[2], header.flashend, header.ramend);
+
+	*out = header;
+
+	return true;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 3)
+	{
+		fprintf(stderr, "usage: %s <trace> [max-instructions]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	uint64_t limit = (argc == 3) ? strtoull(argv[2], NULL, 0) : UINT64_MAX;
+
+	FILE *fp = fopen(argv[1], "rb");
+	if (fp == NULL)
+	{
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	struct trace_header header;
+
+	if (!p_read_header(fp, argv[1], &header))
+	{
+		fclose(fp);
+		return EXIT_FAILURE;
+	}
+
+	static struct trace_rec recs[CHUNK_RECORDS];
+	struct trace_rec effects[MAX_EFFECTS];
+	uint32_t n_effects = 0;
+	uint16_t ext = 0;
+
+	uint64_t cycles = 0;
+	uint64_t idle = 0;
+	uint64_t insns = 0;
+	uint64_t irqs = 0;
+	size_t got;
+
+	while (insns < limit
+			&& (got = fread(recs, sizeof *recs, CHUNK_RECORDS, fp)) > 0)
+	{
+		for (size_t i = 0; i < got && insns < limit; i++)
+		{
+			const struct trace_rec *rec = &recs[i];
+
+			switch (rec->kind)
+			{
+				case TRACE_EXT:
+					ext = rec->raw;
+					break;
+				case TRACE_LOAD:
+				case TRACE_STORE:
+					if (n_effects < MAX_EFFECTS)
+						effects[n_effects++] = *rec;
+					break;
+				case TRACE_INSN:
+				{
+					op_t op = avr_decode_raw(rec->raw, ext, header.features);
+					char operands[48];
+
+					p_format_operands(&op, rec->val, operands,
+							sizeof operands);
+
+					if (OP_IS_32(op))
+						printf("%12" PRIu64 "  %06" PRIX32 ":  %04X %04X  %s",
+								cycles, rec->val * 2, rec->raw, ext,
+								avr_op_str(op.instr));
+					else
+						printf("%12" PRIu64 "  %06" PRIX32 ":  %04X       %s",
+								cycles, rec->val * 2, rec->raw,
+								avr_op_str(op.instr));
+
+					if (operands[0])
+						printf(" %s", operands);
+					putchar('\n');
+
+					for (uint32_t e = 0; e < n_effects; e++)
+						printf("%12s  %s [0x%04" PRIX32 "] = 0x%02X\n", "",
+								(effects[e].kind == TRACE_LOAD) ? "<-" : "->",
+								effects[e].val, effects[e].arg);
+
+					cycles += rec->arg;
+					++insns;
+
+					n_effects = 0;
+					ext = 0;
+					break;
+				}
+				case TRACE_IRQ:
+					printf("%12" PRIu64 "  %06" PRIX32 ":  interrupt %u\n",
+							cycles, rec->val * 2, rec->raw);
+
+					cycles += rec->arg;
+					++irqs;
+					break;
+				case TRACE_IDLE:
+				{
+					uint64_t n = (uint64_t) rec->raw << 32 | rec->val;
+
+					printf("%12" PRIu64 "  %6s   asleep for %" PRIu64
+							" cycles\n", cycles, "", n);
+
+					cycles += n;
+					idle += n;
+					break;
+				}
+				default:
+					fprintf(stderr, "%s: bad record kind %u\n",
+							argv[1], rec->kind);
+					fclose(fp);
+					return EXIT_FAILURE;
+			}
+		}
+	}
+
+	printf("; %" PRIu64 " instructions, %" PRIu64 " interrupts, %" PRIu64
+			" cycles (%" PRIu64 " asleep)\n", insns, irqs, cycles, idle);
+
+	fclose(fp);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,243 @@
+#include "runtime/budget.h"
+
+#include "runtime/hist.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct budget_entry
+{
+	uint32_t func;		/* word address */
+	char name[64];
+	uint64_t limit;
+
+	hist_t cycles;		/* complete invocations */
+	uint64_t over;
+	uint64_t open_max;	/* longest invocation cut off by the end */
+};
+
+struct budget
+{
+	struct budget_entry *entries;
+	uint32_t n;
+};
+
+static int
+p_compare_entry(const void *a, const void *b)
+{
+	const struct budget_entry *ea = a;
+	const struct budget_entry *eb = b;
+
+	return (ea->func > eb->func) - (ea->func < eb->func);
+}
+
+static struct budget_entry *
+p_find(budget_t *budget, uint32_t func)
+{
+	size_t lo = 0, hi = budget->n;
+
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+
+		if (budget->entries[mid].func == func)
+			return &budget->entries[mid];
+		else if (budget->entries[mid].func < func)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+static void
+p_exit(void *ctx, uint32_t func, uint64_t cycles, bool complete)
+{
+	struct budget_entry *entry = p_find(ctx, func);
+	if (entry == NULL)
+		return;
+
+	if (complete)
+		hist_add(&entry->cycles, cycles);
+	else if (cycles > entry->open_max)
+		entry->open_max = cycles;
+
+	if (cycles > entry->limit)
+		++entry->over;
+}
+
+/* Resolves a symbol name or a byte address to a word address */
+static int
+p_resolve(const char *name, const symtab_t *symtab, uint32_t *func)
+{
+	char *end;
+	uint32_t addr = strtoul(name, &end, 0);
+
+	if (*end != '\0')
+	{
+		const elf_sym_t *sym = symtab_find(symtab, name);
+		if (sym == NULL)
+			return -1;
+
+		addr = sym->addr;
+	}
+
+	*func = addr / 2;
+
+	return 0;
+}
+
+static int
+p_add(budget_t *budget, const char *name, uint32_t func, uint64_t limit)
+{
+	struct budget_entry *entries = realloc(budget->entries,
+			(budget->n + 1) * sizeof *entries);
+	if (entries == NULL)
+		return -1;
+
+	budget->entries = entries;
+
+	struct budget_entry *entry = &entries[budget->n++];
+
+	memset(entry, 0, sizeof *entry);
+	entry->func = func;
+	entry->limit = limit;
+	snprintf(entry->name, sizeof entry->name, "%s", name);
+
+	return 0;
+}
+
+budget_t *
+budget_load(const char *path, const symtab_t *symtab)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL)
+		return NULL;
+
+	budget_t *budget = calloc(1, sizeof *budget);
+	int lineno = 0;
+	int status = (budget) ? 0 : -1;
+	char line[512];
+
+	while (status == 0 && fgets(line, sizeof line, fp))
+	{
+		char name[64];
+		uint64_t limit;
+		uint32_t func;
+
+		++lineno;
+
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+		{
+			continue;
+		}
+		else if (sscanf(line, "%63s %" SCNu64, name, &limit) != 2)
+		{
+			fprintf(stderr, "%s:%d: invalid budget\n", path, lineno);
+			status = -1;
+		}
+		else if (p_resolve(name, symtab, &func) == -1)
+		{
+			fprintf(stderr, "%s:%d: unknown function '%s'\n", path, lineno, name);
+			status = -1;
+		}
+		else if (p_find(budget, func) != NULL)
+		{
+			fprintf(stderr, "%s:%d: '%s' has a budget already\n", path, lineno, name);
+			status = -1;
+		}
+		else
+		{
+			status = p_add(budget, name, func, limit);
+			qsort(budget->entries, budget->n, sizeof *budget->entries,
+					p_compare_entry);
+		}
+	}
+
+	fclose(fp);
+
+	if (status == -1)
+		budget_destroy(&budget);
+
+	return budget;
+}
+
+void
+budget_destroy(budget_t **budget)
+{
+	budget_t *_budget = *budget;
+
+	if (_budget)
+	{
+		free(_budget->entries);
+		free(_budget);
+		*budget = NULL;
+	}
+}
+
+void
+budget_attach(budget_t *budget, callgraph_t *cg)
+{
+	callgraph_set_observer(cg, p_exit, budget);
+}
+
+uint64_t
+budget_violations(const budget_t *budget)
+{
+	uint64_t over = 0;
+
+	for (uint32_t i = 0; i < budget->n; i++)
+		over += budget->entries[i].over;
+
+	return over;
+}
+
+uint32_t
+budget_write_unused(const budget_t *budget, FILE *fp)
+{
+	uint32_t unused = 0;
+
+	for (uint32_t i = 0; i < budget->n; i++)
+	{
+		const struct budget_entry *entry = &budget->entries[i];
+
+		if (entry->cycles.count || entry->open_max)
+			continue;
+
+		fprintf(fp, "budget: %s was never called, its budget is unchecked\n",
+				entry->name);
+		++unused;
+	}
+
+	return unused;
+}
+
+void
+budget_write_report(const budget_t *budget, FILE *fp)
+{
+	fprintf(fp, "# %10s %10s %10s %10s %10s %10s %10s %10s %6s  function\n",
+			"calls", "min", "avg", "max", "p50", "p90", "p99", "budget",
+			"over");
+
+	for (uint32_t i = 0; i < budget->n; i++)
+	{
+		const struct budget_entry *entry = &budget->entries[i];
+		const hist_t *cycles = &entry->cycles;
+
+		fprintf(fp, "  %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+				" %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+				" %6" PRIu64 "  %s\n",
+				cycles->count, cycles->min,
+				(cycles->count) ? cycles->sum / cycles->count : 0,
+				cycles->max, hist_percentile(cycles, 50),
+				hist_percentile(cycles, 90), hist_percentile(cycles, 99),
+				entry->limit, entry->over, entry->name);
+
+		if (entry->open_max)
+			fprintf(fp, "  %10s %10s %10s %10" PRIu64 " %10s %10s %10s %10s %6s"
+					"  %s (still running at exit)\n", "", "", "",
+					entry->open_max, "", "", "", "", "", entry->name);
+	}
+}
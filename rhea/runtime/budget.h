@@ -0,0 +1,45 @@
+#ifndef RHEA_BUDGET_H
+#define RHEA_BUDGET_H
+
+#include "rhea_elf.h"
+#include "runtime/callgraph.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Per-function cycle budgets checked against every invocation seen by a
+ * callgraph. An invocation lasts from the CALL to the matching RET, so
+ * callees and anything nesting inside it are included.
+ *
+ * The file has one "<function> <max-cycles>" per line, function being a
+ * symbol from symtab or a flash byte address; '#' starts a comment line.
+ */
+typedef struct budget budget_t;
+
+budget_t *
+budget_load(const char *path, const symtab_t *symtab);
+
+void
+budget_destroy(budget_t **budget);
+
+/* Feeds the budget from cg's closed frames */
+void
+budget_attach(budget_t *budget, callgraph_t *cg);
+
+/* Invocations that ran over their budget so far, including ones cut off by
+ * the end of the run
+ */
+uint64_t
+budget_violations(const budget_t *budget);
+
+/* Lists the functions that were never entered, whose budgets therefore went
+ * unchecked, and returns how many there were
+ */
+uint32_t
+budget_write_unused(const budget_t *budget, FILE *fp);
+
+/* Calls, min/avg/max and percentiles per function against its budget */
+void
+budget_write_report(const budget_t *budget, FILE *fp);
+
+#endif
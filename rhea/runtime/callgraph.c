@@ -0,0 +1,341 @@
+#include "runtime/callgraph.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NONE UINT32_MAX
+
+struct cg_node
+{
+	uint32_t func;
+
+	uint32_t parent;
+	uint32_t child;
+	uint32_t sibling;
+
+	uint64_t calls;
+	uint64_t incl;
+	uint64_t excl;
+};
+
+struct cg_frame
+{
+	uint32_t node;
+	uint32_t ret;
+	uint64_t enter;
+};
+
+struct callgraph
+{
+	struct cg_node *nodes;
+	uint32_t n_nodes;
+	uint32_t cap_nodes;
+
+	/* stack[0] is the root frame and is never popped */
+	struct cg_frame *stack;
+	uint32_t depth;
+	uint32_t cap_stack;
+
+	unsigned max_depth;
+	uint64_t last;
+
+	callgraph_exit_t observer;
+	void *observer_ctx;
+};
+
+struct cg_total
+{
+	uint32_t func;
+	uint64_t calls;
+	uint64_t incl;
+	uint64_t excl;
+};
+
+static uint32_t
+p_node_new(callgraph_t *cg, uint32_t parent, uint32_t func)
+{
+	if (cg->n_nodes == cg->cap_nodes)
+	{
+		uint32_t cap = (cg->cap_nodes) ? cg->cap_nodes * 2 : 256;
+		struct cg_node *nodes = realloc(cg->nodes, cap * sizeof *nodes);
+		if (nodes == NULL)
+			return NONE;
+
+		cg->nodes = nodes;
+		cg->cap_nodes = cap;
+	}
+
+	uint32_t index = cg->n_nodes++;
+	struct cg_node *node = &cg->nodes[index];
+
+	memset(node, 0, sizeof *node);
+	node->func = func;
+	node->parent = parent;
+	node->child = NONE;
+	node->sibling = NONE;
+
+	if (parent != NONE)
+	{
+		node->sibling = cg->nodes[parent].child;
+		cg->nodes[parent].child = index;
+	}
+
+	return index;
+}
+
+static uint32_t
+p_node_child(callgraph_t *cg, uint32_t parent, uint32_t func)
+{
+	for (uint32_t i = cg->nodes[parent].child; i != NONE; i = cg->nodes[i].sibling)
+	{
+		if (cg->nodes[i].func == func)
+			return i;
+	}
+
+	return p_node_new(cg, parent, func);
+}
+
+/* Charges the time since the last event to the function on top */
+static void
+p_account(callgraph_t *cg, uint64_t now)
+{
+	cg->nodes[cg->stack[cg->depth - 1].node].excl += now - cg->last;
+	cg->last = now;
+}
+
+static void
+p_pop(callgraph_t *cg, uint64_t now, bool complete)
+{
+	struct cg_frame *frame = &cg->stack[--cg->depth];
+	struct cg_node *node = &cg->nodes[frame->node];
+
+	node->incl += now - frame->enter;
+
+	if (cg->observer)
+		cg->observer(cg->observer_ctx, node->func, now - frame->enter, complete);
+}
+
+callgraph_t *
+callgraph_init(uint32_t entry, uint64_t now)
+{
+	callgraph_t *cg = calloc(1, sizeof *cg);
+	if (cg)
+	{
+		cg->cap_stack = 64;
+		cg->stack = malloc(cg->cap_stack * sizeof *cg->stack);
+
+		uint32_t root = p_node_new(cg, NONE, entry);
+
+		if (cg->stack == NULL || root == NONE)
+		{
+			callgraph_destroy(&cg);
+			return NULL;
+		}
+
+		cg->nodes[root].calls = 1;
+		cg->stack[0].node = root;
+		cg->stack[0].ret = NONE;
+		cg->stack[0].enter = now;
+		cg->depth = 1;
+		cg->last = now;
+	}
+
+	return cg;
+}
+
+void
+callgraph_destroy(callgraph_t **cg)
+{
+	callgraph_t *_cg = *cg;
+
+	if (_cg)
+	{
+		free(_cg->nodes);
+		free(_cg->stack);
+		free(_cg);
+		*cg = NULL;
+	}
+}
+
+void
+callgraph_call(callgraph_t *cg, uint32_t target, uint32_t ret, uint64_t now)
+{
+	p_account(cg, now);
+
+	if (cg->depth == cg->cap_stack)
+	{
+		struct cg_frame *stack = realloc(cg->stack,
+				2 * cg->cap_stack * sizeof *stack);
+		if (stack == NULL)
+			return;
+
+		cg->stack = stack;
+		cg->cap_stack *= 2;
+	}
+
+	uint32_t node = p_node_child(cg, cg->stack[cg->depth - 1].node, target);
+	if (node == NONE)
+		return;
+
+	++cg->nodes[node].calls;
+
+	struct cg_frame *frame = &cg->stack[cg->depth++];
+	frame->node = node;
+	frame->ret = ret;
+	frame->enter = now;
+
+	if (cg->depth - 1 > cg->max_depth)
+		cg->max_depth = cg->depth - 1;
+}
+
+void
+callgraph_ret(callgraph_t *cg, uint32_t ret, uint64_t now)
+{
+	p_account(cg, now);
+
+	/* Returns that skip frames (longjmp, hand-rolled stack switching) unwind
+	 * everything above the matching frame; unmatched returns are ignored.
+	 */
+	for (uint32_t i = cg->depth - 1; i > 0; i--)
+	{
+		if (cg->stack[i].ret == ret)
+		{
+			while (cg->depth > i)
+				p_pop(cg, now, true);
+			break;
+		}
+	}
+}
+
+void
+callgraph_finish(callgraph_t *cg, uint64_t now)
+{
+	p_account(cg, now);
+
+	while (cg->depth > 1)
+		p_pop(cg, now, false);
+
+	/* The root frame stays open; recompute rather than accumulate */
+	cg->nodes[cg->stack[0].node].incl = now - cg->stack[0].enter;
+}
+
+void
+callgraph_set_observer(callgraph_t *cg, callgraph_exit_t observer, void *ctx)
+{
+	cg->observer = observer;
+	cg->observer_ctx = ctx;
+}
+
+unsigned
+callgraph_max_depth(const callgraph_t *cg)
+{
+	return cg->max_depth;
+}
+
+static void
+p_write_name(const symtab_t *symtab, uint32_t func, FILE *fp)
+{
+	const elf_sym_t *sym = symtab_lookup(symtab, func * 2);
+
+	if (sym && sym->addr == func * 2)
+		fputs(sym->name, fp);
+	else if (sym)
+		fprintf(fp, "%s+0x%X", sym->name, func * 2 - sym->addr);
+	else
+		fprintf(fp, "0x%04X", func * 2);
+}
+
+static void
+p_write_path(const callgraph_t *cg, uint32_t node, const symtab_t *symtab,
+		FILE *fp)
+{
+	if (cg->nodes[node].parent != NONE)
+	{
+		p_write_path(cg, cg->nodes[node].parent, symtab, fp);
+		fputc(';', fp);
+	}
+
+	p_write_name(symtab, cg->nodes[node].func, fp);
+}
+
+void
+callgraph_write_folded(const callgraph_t *cg, const symtab_t *symtab, FILE *fp)
+{
+	for (uint32_t i = 0; i < cg->n_nodes; i++)
+	{
+		if (cg->nodes[i].excl == 0)
+			continue;
+
+		p_write_path(cg, i, symtab, fp);
+		fprintf(fp, " %" PRIu64 "\n", cg->nodes[i].excl);
+	}
+}
+
+static int
+p_compare_total(const void *a, const void *b)
+{
+	const struct cg_total *ta = a;
+	const struct cg_total *tb = b;
+
+	return (ta->incl < tb->incl) - (ta->incl > tb->incl);
+}
+
+/* Recursive activations would otherwise count their time more than once */
+static bool
+p_is_outermost(const callgraph_t *cg, uint32_t node)
+{
+	uint32_t func = cg->nodes[node].func;
+
+	for (uint32_t p = cg->nodes[node].parent; p != NONE; p = cg->nodes[p].parent)
+	{
+		if (cg->nodes[p].func == func)
+			return false;
+	}
+
+	return true;
+}
+
+void
+callgraph_write_summary(const callgraph_t *cg, const symtab_t *symtab,
+		FILE *fp)
+{
+	struct cg_total *totals = calloc(cg->n_nodes, sizeof *totals);
+	uint32_t n = 0;
+
+	if (totals == NULL)
+		return;
+
+	for (uint32_t i = 0; i < cg->n_nodes; i++)
+	{
+		const struct cg_node *node = &cg->nodes[i];
+		uint32_t t;
+
+		for (t = 0; t < n && totals[t].func != node->func; t++);
+
+		if (t == n)
+			totals[n++].func = node->func;
+
+		totals[t].calls += node->calls;
+		totals[t].excl += node->excl;
+
+		if (p_is_outermost(cg, i))
+			totals[t].incl += node->incl;
+	}
+
+	qsort(totals, n, sizeof *totals, p_compare_total);
+
+	fprintf(fp, "# max call depth %u\n", cg->max_depth);
+	fprintf(fp, "# %12s %14s %14s  function\n", "calls", "inclusive", "exclusive");
+
+	for (uint32_t t = 0; t < n; t++)
+	{
+		fprintf(fp, "  %12" PRIu64 " %14" PRIu64 " %14" PRIu64 "  ",
+				totals[t].calls, totals[t].incl, totals[t].excl);
+		p_write_name(symtab, totals[t].func, fp);
+		fputc('\n', fp);
+	}
+
+	free(totals);
+}
@@ -0,0 +1,58 @@
+#ifndef RHEA_CALLGRAPH_H
+#define RHEA_CALLGRAPH_H
+
+#include "rhea_elf.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Shadow call stack fed by the executor's CALL/RCALL/ICALL/RET handling.
+ * Cycles are accumulated on a call tree, so both per-path (flamegraph) and
+ * per-function totals can be produced from it.
+ */
+typedef struct callgraph callgraph_t;
+
+/* Called for every frame that is closed, with the function's word address
+ * and the cycles of that invocation including its callees. complete is false
+ * for frames still open at callgraph_finish().
+ */
+typedef void (*callgraph_exit_t)(void *ctx, uint32_t func, uint64_t cycles,
+		bool complete);
+
+/* entry is the word address execution starts at, usually the reset vector */
+callgraph_t *
+callgraph_init(uint32_t entry, uint64_t now);
+
+void
+callgraph_destroy(callgraph_t **cg);
+
+/* target and ret are word addresses; now is the cycle count after the
+ * instruction, so the caller pays for CALL and the callee for RET.
+ */
+void
+callgraph_call(callgraph_t *cg, uint32_t target, uint32_t ret, uint64_t now);
+
+void
+callgraph_ret(callgraph_t *cg, uint32_t ret, uint64_t now);
+
+/* Closes the open frames at the current time before reporting */
+void
+callgraph_finish(callgraph_t *cg, uint64_t now);
+
+void
+callgraph_set_observer(callgraph_t *cg, callgraph_exit_t observer, void *ctx);
+
+unsigned
+callgraph_max_depth(const callgraph_t *cg);
+
+/* Folded stacks ("main;foo;bar <cycles>"), as read by flamegraph.pl */
+void
+callgraph_write_folded(const callgraph_t *cg, const symtab_t *symtab, FILE *fp);
+
+/* Calls, inclusive and exclusive cycles per function */
+void
+callgraph_write_summary(const callgraph_t *cg, const symtab_t *symtab,
+		FILE *fp);
+
+#endif
@@ -0,0 +1,476 @@
+#include "runtime/cosim.h"
+
+#include "rhea_load.h"
+#include "rhea_log.h"
+#include "hw/devices.h"
+#include "hw/usart.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COSIM_MAX_NODES 16
+#define COSIM_MAX_LINKS 32
+
+struct timed_byte
+{
+	uint64_t time;
+	uint8_t byte;
+};
+
+struct queue
+{
+	struct timed_byte *items;
+	size_t len;
+	size_t pos;
+	size_t cap;
+};
+
+struct cosim_link
+{
+	int from;
+	int to;
+	uint64_t latency;
+
+	/* Written by the sender's thread during a quantum */
+	struct queue outbox;
+};
+
+struct cosim_node
+{
+	cosim_t *cosim;
+	int index;
+	char name[32];
+
+	emu_t *emu;
+
+	/* Sorted by delivery time, filled in between quanta */
+	struct queue inbox;
+
+	uint64_t until;
+	emu_stop_t stop;
+};
+
+struct cosim
+{
+	struct cosim_node nodes[COSIM_MAX_NODES];
+	int n_nodes;
+
+	struct cosim_link links[COSIM_MAX_LINKS];
+	int n_links;
+
+	uint64_t quantum;
+
+	/* Kept out of the (packed) structs in naturally aligned storage of
+	 * their own, allocated by cosim_run()
+	 */
+	pthread_barrier_t *start;
+	pthread_barrier_t *end;
+	bool done;
+};
+
+static int
+p_queue_push(struct queue *q, uint64_t time, uint8_t byte)
+{
+	if (q->len == q->cap)
+	{
+		size_t cap = (q->cap) ? q->cap * 2 : 64;
+		struct timed_byte *items = realloc(q->items, cap * sizeof *items);
+		if (items == NULL)
+			return -1;
+
+		q->items = items;
+		q->cap = cap;
+	}
+
+	q->items[q->len].time = time;
+	q->items[q->len].byte = byte;
+	++q->len;
+
+	return 0;
+}
+
+static void
+p_queue_compact(struct queue *q)
+{
+	memmove(q->items, q->items + q->pos, (q->len - q->pos) * sizeof *q->items);
+	q->len -= q->pos;
+	q->pos = 0;
+}
+
+/* USART sink: fans a transmitted byte out to every link leaving the node */
+static void
+p_node_tx(void *ctx, uint8_t byte)
+{
+	struct cosim_node *node = ctx;
+	cosim_t *cosim = node->cosim;
+	uint64_t now = emu_cycles(node->emu);
+
+	for (int i = 0; i < cosim->n_links; i++)
+	{
+		struct cosim_link *link = &cosim->links[i];
+
+		if (link->from == node->index)
+			p_queue_push(&link->outbox, now + link->latency, byte);
+	}
+}
+
+static void
+p_node_quantum(struct cosim_node *node)
+{
+	emu_t *emu = node->emu;
+	hw_t *hw = emu_hw(emu);
+	struct queue *in = &node->inbox;
+
+	while (node->stop == EMU_STOP_NONE && emu_cycles(emu) < node->until)
+	{
+		uint64_t now = emu_cycles(emu);
+		uint64_t stop_at = node->until;
+
+		while (in->pos < in->len && in->items[in->pos].time <= now)
+		{
+			usart_feed(hw->usart, &in->items[in->pos].byte, 1);
+			++in->pos;
+		}
+
+		/* Run up to the next delivery so bytes arrive on the exact cycle */
+		if (in->pos < in->len && in->items[in->pos].time < stop_at)
+			stop_at = in->items[in->pos].time;
+
+		emu_stop_t stop = emu_run_for(emu, stop_at - now);
+		if (stop != EMU_STOP_BUDGET)
+			node->stop = stop;
+
+		/* Nothing will ever wake it, which usually is a firmware bug */
+		if (stop == EMU_STOP_SLEEP && !hw->sreg.i)
+			LOG_WARN(LOG_EMU, "%s: sleeping with interrupts disabled at 0x%04X, "
+					"it cannot wake up", node->name, hw->pc * 2);
+	}
+}
+
+static void *
+p_node_main(void *arg)
+{
+	struct cosim_node *node = arg;
+	cosim_t *cosim = node->cosim;
+
+	for (;;)
+	{
+		pthread_barrier_wait(cosim->start);
+		if (cosim->done)
+			break;
+
+		p_node_quantum(node);
+
+		pthread_barrier_wait(cosim->end);
+	}
+
+	log_flush();
+
+	return NULL;
+}
+
+/* Moves everything sent during the last quantum to the receivers. Links are
+ * visited in a fixed order and inserts are stable, so ties are broken the
+ * same way on every run.
+ */
+static void
+p_exchange(cosim_t *cosim)
+{
+	for (int i = 0; i < cosim->n_nodes; i++)
+		p_queue_compact(&cosim->nodes[i].inbox);
+
+	for (int i = 0; i < cosim->n_links; i++)
+	{
+		struct cosim_link *link = &cosim->links[i];
+		struct queue *in = &cosim->nodes[link->to].inbox;
+
+		for (size_t j = 0; j < link->outbox.len; j++)
+		{
+			struct timed_byte tb = link->outbox.items[j];
+
+			if (p_queue_push(in, tb.time, tb.byte) == -1)
+				break;
+
+			size_t k = in->len - 1;
+			while (k > in->pos && in->items[k - 1].time > tb.time)
+			{
+				in->items[k] = in->items[k - 1];
+				--k;
+			}
+			in->items[k] = tb;
+		}
+
+		link->outbox.len = 0;
+	}
+}
+
+cosim_t *
+cosim_init(void)
+{
+	return calloc(1, sizeof(cosim_t));
+}
+
+void
+cosim_destroy(cosim_t **cosim)
+{
+	cosim_t *_cosim = *cosim;
+
+	if (_cosim)
+	{
+		for (int i = 0; i < _cosim->n_nodes; i++)
+		{
+			emu_t *emu = _cosim->nodes[i].emu;
+
+			emu_destroy(&emu);
+			free(_cosim->nodes[i].inbox.items);
+		}
+
+		for (int i = 0; i < _cosim->n_links; i++)
+			free(_cosim->links[i].outbox.items);
+
+		free(_cosim);
+		*cosim = NULL;
+	}
+}
+
+int
+cosim_add(cosim_t *cosim, const char *name, emu_t *emu)
+{
+	hw_t *hw = emu_hw(emu);
+
+	if (cosim->n_nodes == COSIM_MAX_NODES || hw->usart == NULL)
+		return -1;
+
+	int index = cosim->n_nodes++;
+	struct cosim_node *node = &cosim->nodes[index];
+
+	memset(node, 0, sizeof *node);
+	node->cosim = cosim;
+	node->index = index;
+	node->emu = emu;
+	snprintf(node->name, sizeof node->name, "%s", name);
+
+	usart_set_sink(hw->usart, p_node_tx, node);
+
+	return index;
+}
+
+int
+cosim_link(cosim_t *cosim, int from, int to, uint64_t latency)
+{
+	if (cosim->n_links == COSIM_MAX_LINKS || latency == 0 ||
+		from < 0 || from >= cosim->n_nodes ||
+		to < 0 || to >= cosim->n_nodes)
+	{
+		return -1;
+	}
+
+	struct cosim_link *link = &cosim->links[cosim->n_links++];
+
+	memset(link, 0, sizeof *link);
+	link->from = from;
+	link->to = to;
+	link->latency = latency;
+
+	return 0;
+}
+
+int
+cosim_set_quantum(cosim_t *cosim, uint64_t quantum)
+{
+	/* A quantum longer than a link's latency would let a byte arrive in the
+	 * quantum it was sent in, which breaks determinism.
+	 */
+	for (int i = 0; i < cosim->n_links; i++)
+	{
+		if (quantum > cosim->links[i].latency)
+			return -1;
+	}
+
+	cosim->quantum = quantum;
+
+	return 0;
+}
+
+static int
+p_find_node(cosim_t *cosim, const char *name)
+{
+	for (int i = 0; i < cosim->n_nodes; i++)
+	{
+		if (strcmp(cosim->nodes[i].name, name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+cosim_t *
+cosim_load(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL)
+		return NULL;
+
+	cosim_t *cosim = cosim_init();
+	uint64_t quantum = 0;
+	int lineno = 0;
+	int status = 0;
+	char line[512];
+
+	while (cosim && status == 0 && fgets(line, sizeof line, fp))
+	{
+		char name[32], mcu[32], image[256], from[32], to[32];
+		uint64_t cycles;
+
+		++lineno;
+
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+		{
+			continue;
+		}
+		else if (sscanf(line, "node %31s %31s %255s", name, mcu, image) == 3)
+		{
+			file_t file = { image, FT_IHEX };
+			chunk_t *chunks;
+
+			int n = rhea_load_file(file, &chunks);
+			emu_t *emu = (n == -1) ? NULL : emu_init(mcu, chunks, n);
+
+			if (n != -1)
+				rhea_unload_file(file, &chunks, n);
+
+			if (emu == NULL)
+				status = -1;
+			else if (cosim_add(cosim, name, emu) == -1)
+			{
+				emu_destroy(&emu);
+				status = -1;
+			}
+		}
+		else if (sscanf(line, "link %31s %31s %" SCNu64, from, to, &cycles) == 3)
+		{
+			status = cosim_link(cosim, p_find_node(cosim, from),
+					p_find_node(cosim, to), cycles);
+		}
+		else if (sscanf(line, "quantum %" SCNu64, &cycles) == 1)
+		{
+			quantum = cycles;
+		}
+		else
+		{
+			status = -1;
+		}
+
+		if (status == -1)
+			fprintf(stderr, "%s:%d: invalid board description\n", path, lineno);
+	}
+
+	fclose(fp);
+
+	if (cosim && status == 0)
+	{
+		/* Conservative lookahead: the shortest link latency */
+		if (quantum == 0)
+		{
+			quantum = UINT64_MAX;
+			for (int i = 0; i < cosim->n_links; i++)
+			{
+				if (cosim->links[i].latency < quantum)
+					quantum = cosim->links[i].latency;
+			}
+		}
+
+		status = cosim_set_quantum(cosim, quantum);
+		if (status == -1)
+			fprintf(stderr, "%s: quantum exceeds a link latency\n", path);
+	}
+
+	if (status == -1)
+		cosim_destroy(&cosim);
+
+	return cosim;
+}
+
+int
+cosim_run(cosim_t *cosim, uint64_t cycles)
+{
+	int status = 0;
+	int n = cosim->n_nodes;
+	uint64_t now = 0;
+
+	if (n == 0 || cosim->quantum == 0)
+		return -1;
+
+	pthread_t *threads = malloc(n * sizeof *threads);
+	pthread_barrier_t *barriers = malloc(2 * sizeof *barriers);
+	if (threads == NULL || barriers == NULL)
+	{
+		free(threads);
+		free(barriers);
+		return -1;
+	}
+
+	cosim->start = &barriers[0];
+	cosim->end = &barriers[1];
+	pthread_barrier_init(cosim->start, NULL, n + 1);
+	pthread_barrier_init(cosim->end, NULL, n + 1);
+	cosim->done = false;
+
+	for (int i = 0; i < n; i++)
+		pthread_create(&threads[i], NULL, p_node_main, &cosim->nodes[i]);
+
+	while (!cosim->done)
+	{
+		uint64_t next = now + cosim->quantum;
+		if (next > cycles)
+			next = cycles;
+
+		p_exchange(cosim);
+
+		for (int i = 0; i < n; i++)
+			cosim->nodes[i].until = next;
+
+		pthread_barrier_wait(cosim->start);
+		pthread_barrier_wait(cosim->end);
+
+		now = next;
+
+		bool running = false;
+		for (int i = 0; i < n; i++)
+			running |= (cosim->nodes[i].stop == EMU_STOP_NONE);
+
+		cosim->done = !running || now >= cycles;
+	}
+
+	/* Release the workers one last time so they can see done */
+	pthread_barrier_wait(cosim->start);
+
+	for (int i = 0; i < n; i++)
+	{
+		struct cosim_node *node = &cosim->nodes[i];
+		bool stuck = node->stop == EMU_STOP_SLEEP && !emu_hw(node->emu)->sreg.i;
+
+		pthread_join(threads[i], NULL);
+
+		printf("%s: %" PRIu64 " cycles, %s%s\n", node->name,
+				emu_cycles(node->emu),
+				(node->stop == EMU_STOP_NONE) ? "running" : emu_stop_str(node->stop),
+				(stuck) ? " with interrupts disabled" : "");
+
+		if (node->stop == EMU_STOP_CRASH || node->stop == EMU_STOP_SEGFAULT)
+			status = -1;
+	}
+
+	pthread_barrier_destroy(cosim->start);
+	pthread_barrier_destroy(cosim->end);
+	cosim->start = cosim->end = NULL;
+
+	free(barriers);
+	free(threads);
+
+	return status;
+}
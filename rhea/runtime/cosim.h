@@ -0,0 +1,49 @@
+#ifndef RHEA_COSIM_H
+#define RHEA_COSIM_H
+
+#include "runtime/emu.h"
+
+#include <stdint.h>
+
+/* Runs several emulators in lock-step quanta, one host thread per MCU. Byte
+ * streams are exchanged only at quantum boundaries, and a byte sent at cycle
+ * t arrives at t + latency, so as long as every link's latency is at least one
+ * quantum the result does not depend on thread scheduling.
+ *
+ * All MCUs share one cycle time base.
+ */
+typedef struct cosim cosim_t;
+
+cosim_t *
+cosim_init(void);
+
+/* Reads a board description:
+ *
+ *   node <name> <mcu> <image.hex>
+ *   link <from> <to> <latency>	   USART TX of <from> -> RX of <to>
+ *   quantum <cycles>		   optional, defaults to the smallest latency
+ */
+cosim_t *
+cosim_load(const char *path);
+
+void
+cosim_destroy(cosim_t **cosim);
+
+/* The emulator is owned by cosim from here on. Returns the node index. */
+int
+cosim_add(cosim_t *cosim, const char *name, emu_t *emu);
+
+int
+cosim_link(cosim_t *cosim, int from, int to, uint64_t latency);
+
+int
+cosim_set_quantum(cosim_t *cosim, uint64_t quantum);
+
+/* Runs until every MCU has stopped or cycles have elapsed. Returns -1 if any
+ * MCU crashed. An MCU that sleeps with nothing scheduled to wake it stays
+ * stopped; with interrupts disabled that is reported as a warning.
+ */
+int
+cosim_run(cosim_t *cosim, uint64_t cycles);
+
+#endif
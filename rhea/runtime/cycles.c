@@ -0,0 +1,190 @@
+#include "runtime/cycles.h"
+
+/* Cycle counts as listed in the AVR instruction set manual. AVRe covers the
+ * classic megaAVR and tinyAVR cores (AVR25 has the same timing); parts with
+ * a 22-bit PC take one cycle more for every call and return. 0 marks
+ * instructions the core does not have, they crash before being counted.
+ *
+ *	instr		AVRe	PC22	AVRrc	taken
+ */
+#define CYCLES(X) \
+	X(UNDEF,	1,	1,	1,	0) \
+	X(ADD,		1,	1,	1,	0) \
+	X(ADC,		1,	1,	1,	0) \
+	X(ADIW,		2,	2,	0,	0) \
+	X(LSL,		1,	1,	1,	0) \
+	X(ROL,		1,	1,	1,	0) \
+	X(SUB,		1,	1,	1,	0) \
+	X(SUBI,		1,	1,	1,	0) \
+	X(SBC,		1,	1,	1,	0) \
+	X(SBCI,		1,	1,	1,	0) \
+	X(SBIW,		2,	2,	0,	0) \
+	X(DEC,		1,	1,	1,	0) \
+	X(INC,		1,	1,	1,	0) \
+	X(MUL,		2,	2,	0,	0) \
+	X(MULS,		2,	2,	0,	0) \
+	X(MULSU,	2,	2,	0,	0) \
+	X(FMUL,		2,	2,	0,	0) \
+	X(FMULS,	2,	2,	0,	0) \
+	X(FMULSU,	2,	2,	0,	0) \
+	X(AND,		1,	1,	1,	0) \
+	X(ANDI,		1,	1,	1,	0) \
+	X(CBR,		1,	1,	1,	0) \
+	X(TST,		1,	1,	1,	0) \
+	X(EOR,		1,	1,	1,	0) \
+	X(CLR,		1,	1,	1,	0) \
+	X(COM,		1,	1,	1,	0) \
+	X(NEG,		1,	1,	1,	0) \
+	X(OR,		1,	1,	1,	0) \
+	X(ORI,		1,	1,	1,	0) \
+	X(SBR,		1,	1,	1,	0) \
+	X(SER,		1,	1,	1,	0) \
+	X(CALL,		4,	5,	0,	0) \
+	X(ICALL,	3,	4,	3,	0) \
+	X(RCALL,	3,	4,	4,	0) \
+	X(EICALL,	4,	4,	0,	0) \
+	X(JMP,		3,	3,	0,	0) \
+	X(IJMP,		2,	2,	2,	0) \
+	X(RJMP,		2,	2,	2,	0) \
+	X(EIJMP,	2,	2,	0,	0) \
+	X(RET,		4,	5,	6,	0) \
+	X(RETI,		4,	5,	6,	0) \
+	X(CP,		1,	1,	1,	0) \
+	X(CPI,		1,	1,	1,	0) \
+	X(CPC,		1,	1,	1,	0) \
+	X(CPSE,		1,	1,	1,	1) \
+	X(SBRC,		1,	1,	1,	1) \
+	X(SBRS,		1,	1,	1,	1) \
+	X(SBIC,		1,	1,	1,	1) \
+	X(SBIS,		1,	1,	1,	1) \
+	X(BRBS,		1,	1,	1,	1) \
+	X(BRCS,		1,	1,	1,	1) \
+	X(BREQ,		1,	1,	1,	1) \
+	X(BRMI,		1,	1,	1,	1) \
+	X(BRVS,		1,	1,	1,	1) \
+	X(BRLT,		1,	1,	1,	1) \
+	X(BRHS,		1,	1,	1,	1) \
+	X(BRTS,		1,	1,	1,	1) \
+	X(BRIE,		1,	1,	1,	1) \
+	X(BRLO,		1,	1,	1,	1) \
+	X(BRBC,		1,	1,	1,	1) \
+	X(BRCC,		1,	1,	1,	1) \
+	X(BRNE,		1,	1,	1,	1) \
+	X(BRPL,		1,	1,	1,	1) \
+	X(BRVC,		1,	1,	1,	1) \
+	X(BRGE,		1,	1,	1,	1) \
+	X(BRHC,		1,	1,	1,	1) \
+	X(BRTC,		1,	1,	1,	1) \
+	X(BRID,		1,	1,	1,	1) \
+	X(BRSH,		1,	1,	1,	1) \
+	X(ASR,		1,	1,	1,	0) \
+	X(LSR,		1,	1,	1,	0) \
+	X(ROR,		1,	1,	1,	0) \
+	X(SWAP,		1,	1,	1,	0) \
+	X(SBI,		2,	2,	1,	0) \
+	X(CBI,		2,	2,	1,	0) \
+	X(BSET,		1,	1,	1,	0) \
+	X(SEC,		1,	1,	1,	0) \
+	X(SEZ,		1,	1,	1,	0) \
+	X(SEN,		1,	1,	1,	0) \
+	X(SEV,		1,	1,	1,	0) \
+	X(SES,		1,	1,	1,	0) \
+	X(SEH,		1,	1,	1,	0) \
+	X(SET,		1,	1,	1,	0) \
+	X(SEI,		1,	1,	1,	0) \
+	X(BCLR,		1,	1,	1,	0) \
+	X(CLC,		1,	1,	1,	0) \
+	X(CLZ,		1,	1,	1,	0) \
+	X(CLN,		1,	1,	1,	0) \
+	X(CLV,		1,	1,	1,	0) \
+	X(CLS,		1,	1,	1,	0) \
+	X(CLH,		1,	1,	1,	0) \
+	X(CLT,		1,	1,	1,	0) \
+	X(CLI,		1,	1,	1,	0) \
+	X(BLD,		1,	1,	1,	0) \
+	X(BST,		1,	1,	1,	0) \
+	X(IN,		1,	1,	1,	0) \
+	X(OUT,		1,	1,	1,	0) \
+	X(LD_X,		2,	2,	1,	0) \
+	X(LD_X_INC,	2,	2,	2,	0) \
+	X(LD_X_DEC,	2,	2,	2,	0) \
+	X(LD_Y_INC,	2,	2,	2,	0) \
+	X(LD_Y_DEC,	2,	2,	2,	0) \
+	X(LD_Z_INC,	2,	2,	2,	0) \
+	X(LD_Z_DEC,	2,	2,	2,	0) \
+	X(LDD_Y,	2,	2,	1,	0) \
+	X(LDD_Z,	2,	2,	1,	0) \
+	X(LDI,		1,	1,	1,	0) \
+	X(LDS,		2,	2,	1,	0) \
+	X(ST_X,		2,	2,	1,	0) \
+	X(ST_X_INC,	2,	2,	1,	0) \
+	X(ST_X_DEC,	2,	2,	2,	0) \
+	X(ST_Y_INC,	2,	2,	1,	0) \
+	X(ST_Y_DEC,	2,	2,	2,	0) \
+	X(ST_Z_INC,	2,	2,	1,	0) \
+	X(ST_Z_DEC,	2,	2,	2,	0) \
+	X(STD_Y,	2,	2,	1,	0) \
+	X(STD_Z,	2,	2,	1,	0) \
+	X(STS,		2,	2,	1,	0) \
+	X(LPM,		3,	3,	0,	0) \
+	X(SPM,		1,	1,	0,	0) \
+	X(ELPM,		3,	3,	0,	0) \
+	X(MOV,		1,	1,	1,	0) \
+	X(MOVW,		1,	1,	0,	0) \
+	X(PUSH,		2,	2,	1,	0) \
+	X(POP,		2,	2,	3,	0) \
+	X(BREAK,	1,	1,	1,	0) \
+	X(NOP,		1,	1,	1,	0) \
+	X(SLEEP,	1,	1,	1,	0) \
+	X(WDR,		1,	1,	1,	0) \
+	X(DES,		1,	1,	0,	0) \
+	X(XCH,		2,	2,	0,	0) \
+	X(TRAP,		0,	0,	0,	0)
+
+#define AVRE(instr, e, pc22, rc, taken)		[instr] = (e),
+#define AVRE_PC22(instr, e, pc22, rc, taken)	[instr] = (pc22),
+#define AVRRC(instr, e, pc22, rc, taken)	[instr] = (rc),
+#define TAKEN(instr, e, pc22, rc, taken)	[instr] = (taken),
+
+static const cycle_table_t CYCLES_AVRE =
+{
+	.name = "AVRe",
+	.base = { CYCLES(AVRE) },
+	.taken = { CYCLES(TAKEN) },
+	.flash_load = 0
+};
+
+static const cycle_table_t CYCLES_AVRE_PC22 =
+{
+	.name = "AVRe, 22-bit PC",
+	.base = { CYCLES(AVRE_PC22) },
+	.taken = { CYCLES(TAKEN) },
+	.flash_load = 0
+};
+
+static const cycle_table_t CYCLES_AVRRC =
+{
+	.name = "AVRrc",
+	.base = { CYCLES(AVRRC) },
+	.taken = { CYCLES(TAKEN) },
+	.flash_load = 1
+};
+
+const cycle_table_t *
+cycle_table(const device_t *dev)
+{
+	if (dev->features & DEV_REDUCED_CORE)
+		return &CYCLES_AVRRC;
+
+	if (dev->pc_bytes == 3)
+		return &CYCLES_AVRE_PC22;
+
+	return &CYCLES_AVRE;
+}
+
+void
+cycle_annotate(const cycle_table_t *table, op_t *op)
+{
+	op->cycles = table->base[op->instr];
+	op->taken = table->taken[op->instr];
+}
@@ -0,0 +1,33 @@
+#ifndef RHEA_CYCLES_H
+#define RHEA_CYCLES_H
+
+#include "runtime/decode.h"
+#include "hw/devices.h"
+
+#include <stdint.h>
+
+/* Instruction timing of one core variant, indexed by instr_t.
+ *
+ * base is the count with a branch not taken or a skip not skipping. taken
+ * is added when a branch is taken or a skip skips a one-word instruction;
+ * skipping a two-word instruction costs one more on top.
+ */
+typedef struct cycle_table
+{
+	const char *name;
+
+	uint8_t base[AVR_N_INSTR];
+	uint8_t taken[AVR_N_INSTR];
+
+	uint8_t flash_load;		/* extra for loads from mapped flash */
+} cycle_table_t;
+
+/* Picks the table matching the device's core and PC width */
+const cycle_table_t *
+cycle_table(const device_t *dev);
+
+/* Fills op->cycles and op->taken for the decoded op */
+void
+cycle_annotate(const cycle_table_t *table, op_t *op);
+
+#endif
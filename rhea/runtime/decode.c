@@ -4,6 +4,9 @@
 
 #include "hw/flash.h"
 
+#include "runtime/cycles.h"
+
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -85,8 +88,16 @@ avr_op_str(instr_t instr)
 
 		/* Data Transfer */
 		"in", "out",
-		"ld", "ldd", "ldi", "lds",
-		"st", "std", "sts",
+		"ld", "ld", "ld",
+		"ld", "ld",
+		"ld", "ld",
+		"ldd", "ldd",
+		"ldi", "lds",
+		"st", "st", "st",
+		"st", "st",
+		"st", "st",
+		"std", "std",
+		"sts",
 		"lpm", "spm", "elpm",
 		"mov", "movw",
 		"push", "pop",
@@ -95,10 +106,12 @@ avr_op_str(instr_t instr)
 		"break", "nop", "sleep", "wdr",
 
 		/* MISC. */
-		"des", "xch"
+		"des", "xch",
+
+		"trap"
 	};
 
-	if (instr > XCH)
+	if (instr > TRAP)
 	{
 		instr = UNDEF;
 	}
@@ -201,10 +214,11 @@ p_decode_load_store(uint16_t raw)
 {
 	instr_t instr = UNDEF;
 
+	/* 10q0 qqIr rrrr Rqqq, I: LDD=0, STD=1, R: Z=0, Y=1 */
 	if (raw & 0x0200)
-		instr = STD;
+		instr = (raw & 0x0008) ? STD_Y : STD_Z;
 	else
-		instr = LDD;
+		instr = (raw & 0x0008) ? LDD_Y : LDD_Z;
 
 	return instr;
 }
@@ -226,11 +240,13 @@ p_decode_row09(uint16_t oraw)
 				case 0:
 					instr = LDS;
 					break;
-				case 1: case 2:
-				case 9: case 10:
-				case 12: case 13: case 14:
-					instr = LD;
-					break;
+				case 1: instr = LD_Z_INC; break;
+				case 2: instr = LD_Z_DEC; break;
+				case 9: instr = LD_Y_INC; break;
+				case 10: instr = LD_Y_DEC; break;
+				case 12: instr = LD_X; break;
+				case 13: instr = LD_X_INC; break;
+				case 14: instr = LD_X_DEC; break;
 				case 4: case 5:
 					instr = LPM;
 					break;
@@ -248,11 +264,13 @@ p_decode_row09(uint16_t oraw)
 				case 0:
 					instr = STS;
 					break;
-				case 1: case 2:
-				case 9: case 10:
-				case 12: case 13: case 14:
-					instr = ST;
-					break;
+				case 1: instr = ST_Z_INC; break;
+				case 2: instr = ST_Z_DEC; break;
+				case 9: instr = ST_Y_INC; break;
+				case 10: instr = ST_Y_DEC; break;
+				case 12: instr = ST_X; break;
+				case 13: instr = ST_X_INC; break;
+				case 14: instr = ST_X_DEC; break;
 				case 15:
 					instr = PUSH;
 					break;
@@ -439,17 +457,63 @@ p_decode_branch(uint16_t raw)
 	return instr;
 }
 
-#ifdef DECODE_OP_INLINE
-inline op_t ATTR_INLINE
-#else
-op_t
-#endif
-avr_decode(const hw_t *hw, uint32_t addr)
+/* AVRrc drops everything that needs r0-r15, a register pair or a second
+ * opcode word. The top bit of every 5-bit register field must be set.
+ */
+static inline instr_t ATTR_INLINE
+p_decode_reduced(instr_t instr, const op_t *op, uint16_t raw)
 {
-	op_t op;
-	instr_t instr = UNDEF;
+	switch (instr)
+	{
+		case ADIW: case SBIW:
+		case MUL: case MULS: case MULSU:
+		case FMUL: case FMULS: case FMULSU:
+		case MOVW:
+		case LPM: case ELPM: case SPM:
+		case CALL: case JMP:
+		case EICALL: case EIJMP:
+		case DES:
+			return UNDEF;
+		case LDS: case STS:
+			return ((raw & 0xF000) == 0x9000) ? UNDEF : instr;
+		case ADC: case ROL:
+		case ADD: case LSL:
+		case AND: case TST:
+		case CPC: case CP:
+		case CPSE:
+		case EOR: case CLR:
+		case MOV:
+		case OR:
+		case SUB:
+		case SBC:
+			return ((raw & 0x0300) == 0x0300) ? instr : UNDEF;
+		case LDD_Y: case LDD_Z: case STD_Y: case STD_Z:
+			if (op->q)
+				return UNDEF;
+			/* fallthrough */
+		case ASR: case COM: case DEC: case INC:
+		case LSR: case NEG: case ROR: case SWAP:
+		case LD_X: case LD_X_INC: case LD_X_DEC:
+		case LD_Y_INC: case LD_Y_DEC: case LD_Z_INC: case LD_Z_DEC:
+		case ST_X: case ST_X_INC: case ST_X_DEC:
+		case ST_Y_INC: case ST_Y_DEC: case ST_Z_INC: case ST_Z_DEC:
+		case PUSH: case POP:
+		case BLD: case BST:
+		case SBRC: case SBRS:
+		case IN: case OUT:
+			return (raw & 0x0100) ? instr : UNDEF;
+		default:
+			return instr;
+	}
+}
 
-	uint16_t raw = flash_read_word(hw->flash, addr);
+static inline op_t ATTR_INLINE
+p_decode(uint16_t raw, uint16_t raw_lo32, uint32_t variant)
+{
+	const bool reduced = variant & DEV_REDUCED_CORE;
+
+	op_t op = { 0 };
+	instr_t instr = UNDEF;
 
 	switch (raw & 0xF000)
 	{
@@ -478,9 +542,15 @@ avr_decode(const hw_t *hw, uint32_t addr)
 			instr = ANDI;
 			break;
 		case 0x8000:
-		case 0xA000:
 			instr = p_decode_load_store(raw);
 			break;
+		case 0xA000:
+			/* LDD/STD with q >= 32 on the full core, LDS/STS on AVRrc */
+			if (reduced)
+				instr = (raw & 0x0800) ? STS : LDS;
+			else
+				instr = p_decode_load_store(raw);
+			break;
 		case 0x9000:
 			instr = p_decode_row09(raw);
 			break;
@@ -506,7 +576,7 @@ avr_decode(const hw_t *hw, uint32_t addr)
 		case ADC: case ROL:
 		case ADD: case LSL:
 		case AND: case TST:
-		case CPC:
+		case CP: case CPC:
 		case CPSE:
 		case EOR: case CLR:
 		case LSR:
@@ -547,6 +617,7 @@ avr_decode(const hw_t *hw, uint32_t addr)
 			break;
 		case CBI:
 		case SBI:
+		case SBIC:
 		case SBIS:
 			op.b = (raw & 0x0007);
 			op.a = (raw & 0x00F8)>>3;
@@ -559,8 +630,8 @@ avr_decode(const hw_t *hw, uint32_t addr)
 		case COM:
 		case DEC:
 		case INC:
-		case LD:
-		case LPM:
+		case LD_X: case LD_X_INC: case LD_X_DEC:
+		case LD_Y_INC: case LD_Y_DEC: case LD_Z_INC: case LD_Z_DEC:
 		case NEG:
 		case POP:
 		case ROR:
@@ -568,8 +639,16 @@ avr_decode(const hw_t *hw, uint32_t addr)
 			GET_R5(op.rd, raw);
 			break;
 		case PUSH:
+		case ST_X: case ST_X_INC: case ST_X_DEC:
+		case ST_Y_INC: case ST_Y_DEC: case ST_Z_INC: case ST_Z_DEC:
 			GET_R5(op.rr, raw);
 			break;
+		case LPM:
+		case ELPM:
+			/* The implied forms (95C8/95D8) load into r0 */
+			if ((raw & 0xFE00) == 0x9000)
+				GET_R5(op.rd, raw);
+			break;
 		case BLD:
 		case BST:
 			GET_R5(op.rd, raw);
@@ -590,12 +669,9 @@ avr_decode(const hw_t *hw, uint32_t addr)
 			op.k = ((int16_t)(raw<<6))>>9;
 			op.s = (raw & 7);
 			break;
-		case LDD:
-		case STD:
+		case LDD_Y: case LDD_Z:
+		case STD_Y: case STD_Z:
 		{
-			// 10q0 qqIr rrrr Rqqq
-			// I: LDD=0, STD=1
-			// R: Z=0, Y=1
 
 			uint8_t reg = (raw & 0x01F0) >> 4;
 			if (raw & 0x0200)
@@ -625,8 +701,34 @@ avr_decode(const hw_t *hw, uint32_t addr)
 		{
 			// TODO: Intentionally crash the emulator when the last opcode
 			// in memory decodes to a 32-bit instruction.
-			uint16_t raw_lo32 = flash_read_word(hw->flash, addr+1);
-			op.k = ((raw & 0x01F0)>>3) | (raw & 0x0001) | (raw_lo32);
+			op.k = ((uint32_t) (((raw & 0x01F0)>>3) | (raw & 0x0001)) << 16)
+				| raw_lo32;
+
+			break;
+		}
+		case LDS:
+		case STS:
+		{
+			uint8_t reg;
+
+			if ((raw & 0xF000) == 0x9000)
+			{
+				// 1001 00Id dddd 0000 kkkk kkkk kkkk kkkk
+				GET_R5(reg, raw);
+				op.k = raw_lo32;
+			}
+			else
+			{
+				// 1010 Ikkk dddd kkkk, AVRrc only: r16-r31, 0x40-0xBF
+				reg = 16 + ((raw & 0x00F0)>>4);
+				op.k = ((~raw & 0x0100)>>1) | ((raw & 0x0100)>>2) |
+					((raw & 0x0600)>>5) | (raw & 0x000F);
+			}
+
+			if (instr == STS)
+				op.rr = reg;
+			else
+				op.rd = reg;
 
 			break;
 		}
@@ -638,8 +740,139 @@ avr_decode(const hw_t *hw, uint32_t addr)
 			break;
 	}
 
+	if (reduced)
+		instr = p_decode_reduced(instr, &op, raw);
+
 	op.instr = instr;
 	op.raw = raw;
 
 	return op;
 }
+
+#ifdef DECODE_OP_INLINE
+inline op_t ATTR_INLINE
+#else
+op_t
+#endif
+avr_decode(const hw_t *hw, uint32_t addr)
+{
+	uint16_t raw = flash_read_word(hw->flash, addr);
+	uint16_t raw_lo32 = 0;
+
+	// 1001 010k kkkk 11xk ==> JMP/CALL
+	// 1001 00xd dddd 0000 ==> LDS/STS
+	if ((raw & 0xFE0C) == 0x940C || (raw & 0xFC0F) == 0x9000)
+		raw_lo32 = flash_read_word(hw->flash, addr+1);
+
+	op_t op = avr_decode_raw(raw, raw_lo32, hw->dev->features);
+
+	cycle_annotate(cycle_table(hw->dev), &op);
+
+	return op;
+}
+
+op_t
+avr_decode_raw(uint16_t raw, uint16_t raw_lo32, uint32_t features)
+{
+	if (features & DEV_REDUCED_CORE)
+		return p_decode(raw, raw_lo32, DEV_REDUCED_CORE);
+
+	return p_decode(raw, raw_lo32, 0);
+}
+
+/* One loop per variant, so that the per-word decode does not test for the
+ * reduced core.
+ */
+static inline void ATTR_INLINE
+p_predecode(const hw_t *hw, op_t *ops, uint32_t from, uint32_t to,
+		uint32_t variant)
+{
+	uint32_t n = (hw->flashend + 1) / 2;
+	const cycle_table_t *timing = cycle_table(hw->dev);
+
+	for (uint32_t addr = from; addr <= to; addr++)
+	{
+		uint16_t raw = flash_peek_word(hw->flash, addr);
+		uint16_t raw_lo32 = flash_peek_word(hw->flash, (addr + 1) % n);
+
+		ops[addr] = p_decode(raw, raw_lo32, variant);
+		cycle_annotate(timing, &ops[addr]);
+	}
+}
+
+op_t *
+avr_predecode(const hw_t *hw)
+{
+	uint32_t n = (hw->flashend + 1) / 2;
+
+	op_t *ops = malloc(n * sizeof *ops);
+	if (ops)
+		avr_predecode_range(hw, ops, 0, n - 1);
+
+	return ops;
+}
+
+void
+avr_predecode_range(const hw_t *hw, op_t *ops, uint32_t from, uint32_t to)
+{
+	if (hw->dev->features & DEV_REDUCED_CORE)
+		p_predecode(hw, ops, from, to, DEV_REDUCED_CORE);
+	else
+		p_predecode(hw, ops, from, to, 0);
+}
+
+static uint8_t
+p_fusion(const op_t *ops, uint32_t features)
+{
+	const op_t *a = &ops[0];
+	const op_t *b = &ops[1];
+
+	switch (a->instr)
+	{
+		case LDI:
+			if (b->instr == LDI && !(a->rd & 1) && b->rd == a->rd + 1)
+				return FUSE_LDI_LDI;
+			break;
+		case CP:
+		case CPI:
+			if (b->instr == CPC
+					&& (ops[2].instr == BRNE || ops[2].instr == BREQ))
+				return FUSE_CP_CPC_BRNE;
+			break;
+		case SUBI:
+			if (b->instr == SBCI && b->rd == a->rd + 1)
+				return FUSE_SUBI_SBCI;
+			break;
+		case MOVW:
+			if ((features & DEV_HAS_MOVW)
+					&& (b->instr == ADIW || b->instr == SBIW)
+					&& b->rd == a->rd)
+				return FUSE_MOVW_ADIW;
+			break;
+		case IN:
+			if (a->a == 0x3F && b->instr == CLI)
+				return FUSE_IN_CLI;
+			break;
+		default:
+			break;
+	}
+
+	return FUSE_NONE;
+}
+
+void
+avr_fuse_range(const hw_t *hw, op_t *ops, uint32_t from, uint32_t to)
+{
+	uint32_t n = (hw->flashend + 1) / 2;
+
+	for (uint32_t addr = from; addr <= to && addr < n; addr++)
+	{
+		ops[addr].fuse = FUSE_NONE;
+
+		/* Groups never wrap around the end of flash; the last two words
+		 * are left alone so that p_fusion() can always look three ahead.
+		 */
+		if (addr + 2 < n)
+			ops[addr].fuse = p_fusion(&ops[addr], hw->dev->features);
+	}
+}
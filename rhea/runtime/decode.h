@@ -5,8 +5,11 @@
 
 #include <stdint.h>
 
-#define INSTR_IS_32(op) \
-	(((op) == CALL) || ((op) == JMP))
+/* The reduced core's LDS/STS are single words (1010 xkkk dddd kkkk) */
+#define OP_IS_32(op) \
+	(((op).instr == CALL) || ((op).instr == JMP) \
+		|| ((((op).instr == LDS) || ((op).instr == STS)) \
+			&& ((op).raw & 0xF000) == 0x9000))
 
 enum avr_instr
 {
@@ -63,8 +66,16 @@ enum avr_instr
 
 	/* Data Transfer */
 	IN, OUT,
-	LD, LDD, LDI, LDS,
-	ST, STD, STS,
+	LD_X, LD_X_INC, LD_X_DEC,	/* LD Rd, X / X+ / -X */
+	LD_Y_INC, LD_Y_DEC,		/* LD Rd, Y is LDD Rd, Y+0 */
+	LD_Z_INC, LD_Z_DEC,
+	LDD_Y, LDD_Z,			/* LDD Rd, Y+q / Z+q */
+	LDI, LDS,
+	ST_X, ST_X_INC, ST_X_DEC,
+	ST_Y_INC, ST_Y_DEC,
+	ST_Z_INC, ST_Z_DEC,
+	STD_Y, STD_Z,
+	STS,
 	LPM, SPM, ELPM,
 	MOV, MOVW,
 	PUSH, POP,
@@ -73,9 +84,31 @@ enum avr_instr
 	BREAK, NOP, SLEEP, WDR,
 
 	/* MISC. */
-	DES, XCH
+	DES, XCH,
+
+	/* Emulator pseudo-ops, never produced by the decoder */
+	TRAP			/* breakpoint patched over a predecoded op */
+};
+
+#define AVR_N_INSTR	(TRAP + 1)
+
+/* Superinstructions: common avr-gcc sequences that the executor can run with
+ * a single handler. Only the first op of a group is marked, the others keep
+ * their plain decoding so that a jump into the middle of a group still runs
+ * them one by one.
+ */
+enum avr_fusion
+{
+	FUSE_NONE = 0,
+	FUSE_LDI_LDI,		/* ldi rN, lo; ldi rN+1, hi */
+	FUSE_CP_CPC_BRNE,	/* cp/cpi; cpc; brne/breq */
+	FUSE_SUBI_SBCI,		/* subi rN, lo; sbci rN+1, hi */
+	FUSE_MOVW_ADIW,		/* movw rN, rM; adiw/sbiw rN, k */
+	FUSE_IN_CLI		/* in rN, SREG; cli */
 };
 
+#define AVR_FUSE_LEN(fuse)	(((fuse) == FUSE_CP_CPC_BRNE) ? 3 : 2)
+
 struct avr_opcode
 {
 	enum avr_instr instr;
@@ -84,24 +117,61 @@ struct avr_opcode
 	uint8_t rd;
 	uint8_t rr;
 
-	union
+	/* Anonymous unions are C11; __extension__ keeps -Wpedantic quiet
+	 * for every translation unit that includes this header.
+	 */
+	__extension__ union
 	{
 		uint32_t k;
 		uint8_t a;
 		uint8_t q;
 	};
 
-	union
+	__extension__ union
 	{
 		uint8_t b;
 		uint8_t s;
 	};
+
+	/* From the device's cycle table, see runtime/cycles.h; left 0 by
+	 * avr_decode_raw().
+	 */
+	uint8_t cycles;
+	uint8_t taken;
+
+	/* enum avr_fusion, set by avr_fuse_range() */
+	uint8_t fuse;
 };
 
 typedef struct avr_opcode op_t;
 typedef enum avr_instr instr_t;
 
 op_t avr_decode(const hw_t *hw, uint32_t addr);
+
+/* Decodes an opcode outside of any device; raw_lo32 is only used by 32-bit
+ * instructions. features selects the instruction-set variant, only
+ * DEV_REDUCED_CORE changes the decoding.
+ */
+op_t avr_decode_raw(uint16_t raw, uint16_t raw_lo32, uint32_t features);
+
+/* Decodes every flash word up front with the decoder variant of the device;
+ * encodings the core does not have decode to UNDEF. Ops carry the device's
+ * cycle counts. The result is indexed by word address.
+ */
+op_t *avr_predecode(const hw_t *hw);
+
+/* Re-decodes words from..to (inclusive) of a table from avr_predecode()
+ * after the flash underneath has been rewritten.
+ */
+void avr_predecode_range(const hw_t *hw, op_t *ops, uint32_t from,
+		uint32_t to);
+
+/* Marks the superinstruction groups starting at from..to (inclusive) of a
+ * predecoded table. Groups never span a TRAP, so this has to be rerun over
+ * the words before a breakpoint when it is set or cleared.
+ */
+void avr_fuse_range(const hw_t *hw, op_t *ops, uint32_t from, uint32_t to);
+
 const char *avr_op_str(enum avr_instr instr);
 
 #endif
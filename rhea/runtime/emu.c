@@ -1,30 +1,71 @@
 #include "runtime/emu.h"
 
 #include "attributes.h"
+#include "rhea_log.h"
+#include "hw/cores.h"
 #include "hw/devices.h"
 #include "hw/data.h"
 #include "hw/flash.h"
+#include "runtime/callgraph.h"
+#include "runtime/cycles.h"
 #include "runtime/decode.h"
+#include "runtime/irqstat.h"
+#include "runtime/lcov.h"
+#include "runtime/prof.h"
+#include "runtime/trace.h"
 #include "util/bitmanip.h"
 
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define ASM(fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
+#define ASM(...) LOG_TRACE(LOG_EMU, __VA_ARGS__)
+
+#define TRACE_MEM(kind, addr, val) \
+	do { if (emu->trace) trace_put(emu->trace, (kind), (val), 0, (addr)); } while (0)
+
+/* Stores must be checked before the write so that EMU_WATCH_CHANGE can
+ * compare against the old value.
+ */
+#define WATCH(kind, addr, val) \
+	do { if (emu->watch[(addr)]) p_watch_hit(emu, (addr), (kind), (val)); } while (0)
+
+/* Watch flags cover the whole 16-bit data address space */
+#define WATCH_SPACE (1 << 16)
 
 enum emu_exception
 {
 	EMU_EXC_NONE = 0,
 	EMU_EXC_CRASH,
-	EMU_EXC_SEGFAULT
+	EMU_EXC_SEGFAULT,
+	EMU_EXC_BREAKPOINT,
+	EMU_EXC_WATCHPOINT
 };
 
 typedef enum emu_exception exception_t;
 
-typedef uint32_t cycle_t;
+typedef uint64_t cycle_t;
+
+/* Device parameters the executor depends on. Specialized cores pass these
+ * as constants so that masks, stack wrap-around and feature tests fold at
+ * build time; the generic core passes a copy of emu->core.
+ */
+struct core
+{
+	uint32_t pcmask;
+	uint32_t flashend;
+	uint32_t ramend;
+	uint32_t features;
+	uint16_t rampz;
+	uint16_t eind;
+
+	/* Parts with more than 64K words of flash push 3-byte return addresses */
+	bool pc22;
+};
+
+typedef emu_stop_t (*run_t)(emu_t *emu, cycle_t end);
 
-// TODO: Add proper logging utility
 #ifdef COLOR_CONSOLE
 	#define INVERT(str)	"\e[7m" str "\e[0m"
 	#define BOLD(str)	"\e[1m" str "\e[0m"
@@ -36,26 +77,165 @@ typedef uint32_t cycle_t;
 #endif
 
 #define EMU_THROW_EXCEPTION( rsn, ...) \
-	fprintf(stderr, \
+	LOG_ERROR(LOG_EMU, \
 		BAD("[" __FILE__ "]") " " \
 			"Caught runtime exception while executing instruction\n" \
 			"  --> Reason: " rsn "\n" \
 			"  --> File: " __FILE__ "\n" \
-			"  --> Line: %d\n", \
+			"  --> Line: %d", \
 		##__VA_ARGS__, \
 		__LINE__)
 
-#define PREEMPT_SEGFAULT(hw, addr, e) \
-	if (p_validate_data_address((hw), (addr), (e)) != EMU_EXC_NONE) \
+/* Register pairs, see data_regs_t */
+#define PAIR(r)			data_read_pair(&emu->regs, (r))
+#define SET_PAIR(r, val)	data_write_pair(&emu->regs, (r), (val))
+
+/* Program-visible data address to rhea's data space */
+#define DATA_ADDR(core, addr) ((addr) + DEV_DATA_OFFSET((core).features))
+
+#define PREEMPT_SEGFAULT(ramend, addr, e) \
+	if (p_validate_data_address((ramend), (addr), (e)) != EMU_EXC_NONE) \
 	{ \
 		return; \
 	}
 
+#define EMU_SNAPSHOT_MAGIC	0x41454852 /* "RHEA" */
+#define EMU_SNAPSHOT_VERSION	7
+
+/* SPMCSR */
+#define SPM_SPMEN	(1 << 0)
+#define SPM_PGERS	(1 << 1)
+#define SPM_PGWRT	(1 << 2)
+#define SPM_BLBSET	(1 << 3)
+#define SPM_RWWSRE	(1 << 4)	/* CTPB on parts without an RWW section */
+#define SPM_SIGRD	(1 << 5)
+#define SPM_RWWSB	(1 << 6)
+
+#define SPM_CMD_MASK \
+	(SPM_SPMEN | SPM_PGERS | SPM_PGWRT | SPM_BLBSET | SPM_RWWSRE | SPM_SIGRD)
+
+/* Page erase and page write halt the CPU for tWD_FLASH, 4.5 ms at most on
+ * every catalog part; emu_set_f_cpu() turns it into cycles.
+ */
+#define SPM_PROG_US	4500
+
 struct emulator
 {
 	hw_t *hw;
 	exception_t exc;
 	cycle_t cycles;
+
+	/* ID of the snapshot last taken/restored, i.e. what the dirty bitmap
+	 * refers to; 0 for none
+	 */
+	uint64_t base_id;
+
+	/* Predecoded flash, indexed by word address */
+	op_t *ops;
+
+	struct core core;
+	run_t run;
+	const cycle_table_t *timing;
+
+	/* hw->data's register file */
+	data_regs_t regs;
+
+	/* SPM temporary page buffer, erased (0xFF) after every page write */
+	uint8_t *spm_buf;
+	cycle_t spm_prog_cycles;
+
+	uint64_t f_cpu;
+
+	/* Identifies the flash contents: a fresh p_flash_gen() on every SPM
+	 * erase/write so that restoring a snapshot only reloads flash when it
+	 * actually differs.
+	 */
+	uint64_t flash_gen;
+
+	/* Edge coverage, see emu_set_coverage() */
+	uint8_t *cov;
+	uint32_t cov_mask;
+	uint32_t cov_prev;
+	uint32_t cov_shift;
+	uint64_t cov_touched;
+
+	prof_t *prof;
+	callgraph_t *cg;
+	trace_t *trace;
+	lcov_t *lcov;
+
+	/* Breakpoints replace their op in ops[] with TRAP; the original is kept
+	 * here and executed when the run is resumed from that address.
+	 */
+	struct breakpoint
+	{
+		uint32_t addr;
+		op_t op;
+	} *bps;
+	uint32_t n_bps;
+	bool bp_resume;
+
+	uint8_t *watch;
+	uint32_t watch_addr;
+
+	/* Interrupt flags, a bit per vector, and when each was raised */
+	uint64_t irq_pending;
+	cycle_t irq_raised[EMU_MAX_VECTORS];
+
+	/* p_irq_poll() has nothing to do before irq_check; 0 while a vector
+	 * is pending and UINT64_MAX with nothing scheduled either.
+	 */
+	cycle_t irq_check;
+	cycle_t irq_until;	/* see p_run_until() */
+
+	/* The instruction starting at this cycle follows SEI or RETI and runs
+	 * before any interrupt is taken
+	 */
+	cycle_t irq_hold;
+
+	struct irq_source
+	{
+		uint8_t vector;
+		cycle_t first;
+		cycle_t period;
+		cycle_t next;
+	} *irq_srcs;
+	uint32_t n_irq_srcs;
+
+	irqstat_t *irqstat;
+};
+
+struct emu_snapshot
+{
+	/* Header, checked against the target before restoring */
+	uint32_t magic;
+	uint16_t version;
+	uint32_t size;
+	uint8_t signature[3];
+	uint32_t flashend;
+	uint32_t ramstart;
+	uint32_t ramend;
+	uint32_t e2size;
+	uint16_t spm_pagesize;
+
+	/* Unique within the process, see p_snapshot_id() */
+	uint64_t id;
+
+	/* CPU */
+	uint32_t pc;
+	uint8_t sp[2];
+	sreg_t sreg;
+	avr_state_t state;
+	exception_t exc;
+	cycle_t cycles;
+	uint64_t flash_gen;
+	uint64_t irq_pending;
+	cycle_t irq_raised[EMU_MAX_VECTORS];
+
+	/* data_save() image immediately followed by EEPROM, flash and the SPM
+	 * page buffer
+	 */
+	uint8_t mem[];
 };
 
 static void
@@ -67,23 +247,76 @@ p_set_zns(hw_t *hw, uint8_t res)
 }
 
 static void
-p_set_zns16(hw_t *hw, uint8_t res)
+p_set_zns16(hw_t *hw, uint16_t res)
 {
 	hw->sreg.z = res == 0;
 	hw->sreg.n = res >> 15;
 	hw->sreg.s = hw->sreg.n ^ hw->sreg.v;
 }
 
-static uint32_t
-p_stack_push(hw_t *hw, uint8_t byte)
+/* Flags of SUB/SUBI/CP/CPI and, with carry set, of the carrying forms
+ * SBC/SBCI/CPC, which leave Z alone when the result is zero so that it
+ * covers the whole multi-byte value.
+ */
+static inline void ATTR_INLINE
+p_sub_flags(hw_t *hw, uint8_t rd, uint8_t rr, uint8_t res, bool carry)
+{
+	uint8_t chk_c = (~rd & rr) | (rr & res) | (res & ~rd);
+
+	hw->sreg.c = chk_c >> 7;
+	hw->sreg.v = ((rd & ~rr & ~res) | (~rd & rr & res)) >> 7;
+	hw->sreg.h = chk_c >> 3;
+	hw->sreg.n = res >> 7;
+	hw->sreg.s = hw->sreg.n ^ hw->sreg.v;
+
+	if (!carry)
+		hw->sreg.z = res == 0;
+	else if (res)
+		hw->sreg.z = 0;
+}
+
+/* ADIW/SBIW on the pair at op.rd, returns the result */
+static inline uint16_t ATTR_INLINE
+p_adiw(emu_t *emu, op_t op)
+{
+	hw_t *hw = emu->hw;
+	uint16_t cur = PAIR(op.rd);
+	uint16_t res = cur;
+
+	if (op.instr == ADIW)
+		res += op.k;
+	else
+		res -= op.k;
+
+	SET_PAIR(op.rd, res);
+
+	if (op.instr == ADIW)
+	{
+		hw->sreg.c = (~res & cur) >> 15;
+		hw->sreg.v = (res & ~cur) >> 15;
+	}
+	else
+	{
+		hw->sreg.c = (res & ~cur) >> 15;
+		hw->sreg.v = (cur & ~res) >> 15;
+	}
+
+	p_set_zns16(hw, res);
+
+	return res;
+}
+
+/* Returns the data-space address written */
+static inline uint32_t ATTR_INLINE
+p_stack_push(hw_t *hw, const struct core core, uint8_t byte)
 {
 	uint16_t next;
 	uint16_t prev = (hw->sp[1] << 8) | hw->sp[0];
 
 	if (prev == 0)
 	{
-		next = hw->ramend;
-		printf("warning: push() wrapping stack pointer\n");
+		next = core.ramend;
+		LOG_WARN(LOG_EMU, "push() wrapping stack pointer");
 	}
 	else
 	{
@@ -93,21 +326,21 @@ p_stack_push(hw_t *hw, uint8_t byte)
 	hw->sp[0] = LOW(next);
 	hw->sp[1] = HIGH(next);
 
-	data_write(hw->data, prev, byte);
+	data_write(hw->data, DATA_ADDR(core, prev), byte);
 
-	return prev;
+	return DATA_ADDR(core, prev);
 }
 
-static uint8_t
-p_stack_pop(hw_t *hw)
+static inline uint8_t ATTR_INLINE
+p_stack_pop(hw_t *hw, const struct core core)
 {
 	uint16_t next;
 	uint16_t prev = (hw->sp[1] << 8) | hw->sp[0];
 
-	if (prev == hw->ramend)
+	if (prev == core.ramend)
 	{
 		next = 0;
-		printf("warning: pop() wrapping stack pointer\n");
+		LOG_WARN(LOG_EMU, "pop() wrapping stack pointer");
 	}
 	else
 	{
@@ -117,7 +350,7 @@ p_stack_pop(hw_t *hw)
 	hw->sp[0] = LOW(next);
 	hw->sp[1] = HIGH(next);
 
-	return data_read(hw->data, next);
+	return data_read(hw->data, DATA_ADDR(core, next));
 }
 
 /* Instead of adding a segfault passback to data.c/flash.c, all read/writes will
@@ -126,9 +359,9 @@ p_stack_pop(hw_t *hw)
  */
 
 static inline exception_t ATTR_INLINE
-p_validate_data_address(hw_t *hw, uint32_t addr, exception_t *throw)
+p_validate_data_address(uint32_t ramend, uint32_t addr, exception_t *throw)
 {
-	if (addr > hw->ramend)
+	if (addr > ramend)
 	{
 		*throw = EMU_EXC_SEGFAULT;
 		EMU_THROW_EXCEPTION("Cannot read from address 0x%08X "
@@ -138,17 +371,401 @@ p_validate_data_address(hw_t *hw, uint32_t addr, exception_t *throw)
 	return *throw;
 }
 
+static inline bool ATTR_INLINE
+p_is_mapped_flash(const struct core core, uint32_t addr)
+{
+	return (core.features & DEV_REDUCED_CORE) && addr >= DEV_RC_FLASH_BASE
+		&& addr - DEV_RC_FLASH_BASE <= core.flashend;
+}
+
+/* Loads through a pointer, which on the reduced core can also reach flash */
+static inline uint8_t ATTR_INLINE
+p_load(hw_t *hw, const struct core core, uint32_t addr)
+{
+	if (p_is_mapped_flash(core, addr))
+		return flash_read_byte(hw->flash, addr - DEV_RC_FLASH_BASE);
+
+	return data_read(hw->data, DATA_ADDR(core, addr));
+}
+
+static const op_t *
+p_breakpoint_op(const emu_t *emu, uint32_t addr)
+{
+	for (uint32_t i = 0; i < emu->n_bps; i++)
+	{
+		if (emu->bps[i].addr == addr)
+			return &emu->bps[i].op;
+	}
+
+	return NULL;
+}
+
+/* The op that will really execute at addr, looking through breakpoints */
+static inline op_t ATTR_INLINE
+p_op_at(const emu_t *emu, uint32_t addr)
+{
+	op_t op = emu->ops[addr & emu->core.pcmask];
+
+	if (op.instr == TRAP)
+		op = *p_breakpoint_op(emu, addr & emu->core.pcmask);
+
+	return op;
+}
+
+static void
+p_watch_hit(emu_t *emu, uint32_t addr, uint8_t kind, uint8_t val)
+{
+	uint8_t flags = emu->watch[addr];
+
+	bool changed = (kind == EMU_WATCH_WRITE) && (flags & EMU_WATCH_CHANGE)
+		&& data_peek(emu->hw->data, addr) != val;
+
+	if ((flags & kind) || changed)
+	{
+		emu->exc = EMU_EXC_WATCHPOINT;
+		emu->watch_addr = addr;
+	}
+}
+
+static void
+p_run_trapped(emu_t *emu);
+
+static inline void ATTR_INLINE
+p_push_pc(emu_t *emu, const struct core core, uint32_t pc)
+{
+	p_stack_push(emu->hw, core, LOW(pc));
+	p_stack_push(emu->hw, core, HIGH(pc));
+
+	if (core.pc22)
+		p_stack_push(emu->hw, core, (pc >> 16) & 0xFF);
+}
+
+static inline uint32_t ATTR_INLINE
+p_pop_pc(emu_t *emu, const struct core core)
+{
+	uint32_t pc = 0;
+
+	if (core.pc22)
+		pc = (uint32_t) p_stack_pop(emu->hw, core) << 16;
+
+	pc |= p_stack_pop(emu->hw, core) << 8;
+	pc |= p_stack_pop(emu->hw, core);
+
+	return pc;
+}
+
+static inline void ATTR_INLINE
+p_on_call(emu_t *emu, uint32_t target, uint32_t ret, cycle_t cycles)
+{
+	if (emu->cg)
+		callgraph_call(emu->cg, target & emu->core.pcmask, ret, emu->cycles + cycles);
+}
+
+/* Every change of SREG.I goes through here; at is the cycle count after the
+ * instruction, which is where a disabled window starts or ends.
+ */
+static inline void ATTR_INLINE
+p_set_i(emu_t *emu, bool i, cycle_t at)
+{
+	hw_t *hw = emu->hw;
+
+	if (emu->irqstat && i != hw->sreg.i)
+	{
+		if (i)
+			irqstat_enable(emu->irqstat, at);
+		else
+			irqstat_disable(emu->irqstat, hw->pc, at);
+	}
+
+	if (i)
+		emu->irq_hold = at;
+
+	hw->sreg.i = i;
+}
+
+/* SREG lives in hw->sreg rather than in data space; IN/OUT, LD/ST and
+ * LDS/STS reach it through these hooks. The hook cannot tell when the
+ * storing instruction ends, so an I set this way counts from its start and,
+ * unlike SEI, does not hold off a pending interrupt for one instruction.
+ */
+static uint8_t
+p_sreg_read(void *ctx, uint32_t addr, uint8_t val)
+{
+	const sreg_t *sreg = &((emu_t *) ctx)->hw->sreg;
+
+	(void) addr;
+	(void) val;
+
+	return (sreg->i << 7) | (sreg->t << 6) | (sreg->h << 5) | (sreg->s << 4)
+		| (sreg->v << 3) | (sreg->n << 2) | (sreg->z << 1) | sreg->c;
+}
+
+static void
+p_sreg_write(void *ctx, uint32_t addr, uint8_t val)
+{
+	emu_t *emu = ctx;
+	sreg_t *sreg = &emu->hw->sreg;
+
+	(void) addr;
+
+	sreg->t = val >> 6;
+	sreg->h = val >> 5;
+	sreg->s = val >> 4;
+	sreg->v = val >> 3;
+	sreg->n = val >> 2;
+	sreg->z = val >> 1;
+	sreg->c = val;
+
+	p_set_i(emu, val >> 7, emu->cycles);
+}
+
+/* Flash generations are drawn from one counter for the whole process, so
+ * that images loaded into different emulators or read from a file never
+ * share one by accident
+ */
+static uint64_t
+p_flash_gen(void)
+{
+	static uint64_t last;
+
+	return __atomic_add_fetch(&last, 1, __ATOMIC_RELAXED);
+}
+
+/* Re-decodes the words of a rewritten flash range, starting one early in
+ * case the preceding op is the first half of a 32-bit instruction, and
+ * patches the breakpoints in it back in.
+ */
+static void
+p_flash_changed(emu_t *emu, uint32_t addr, uint32_t size)
+{
+	uint32_t from = addr >> 1;
+	uint32_t to = from + (size >> 1) - 1;
+
+	if (from > 0)
+		--from;
+
+	avr_predecode_range(emu->hw, emu->ops, from, to);
+
+	for (uint32_t i = 0; i < emu->n_bps; i++)
+	{
+		uint32_t bp = emu->bps[i].addr;
+
+		if (bp >= from && bp <= to)
+		{
+			emu->bps[i].op = emu->ops[bp];
+			emu->ops[bp].instr = TRAP;
+		}
+	}
+
+	avr_fuse_range(emu->hw, emu->ops, (from > 2) ? from - 2 : 0, to);
+
+	emu->flash_gen = p_flash_gen();
+}
+
+/* LPM right after SPM with SIGRD or BLBSET reads the signature row or the
+ * fuse and lock bits instead of flash.
+ */
+static bool
+p_lpm_special(emu_t *emu, uint16_t z, uint8_t *val)
+{
+	hw_t *hw = emu->hw;
+	uint16_t spmcsr = hw->dev->io.spmcsr;
+
+	if (spmcsr == 0)
+		return false;
+
+	uint8_t ctl = data_peek(hw->data, spmcsr);
+
+	if ((ctl & (SPM_SIGRD | SPM_SPMEN)) == (SPM_SIGRD | SPM_SPMEN))
+		*val = (z < 6 && !(z & 1)) ? hw->signature[z >> 1] : 0xFF;
+	else if ((ctl & (SPM_BLBSET | SPM_SPMEN)) == (SPM_BLBSET | SPM_SPMEN))
+	{
+		switch (z)
+		{
+			case 0: *val = hw->fuse.lo; break;
+			case 2: *val = hw->fuse.ex; break;
+			case 3: *val = hw->fuse.hi; break;
+			default: *val = 0xFF; break;	/* lock bits: unlocked */
+		}
+	}
+	else
+		return false;
+
+	data_write(hw->data, spmcsr, ctl & ~SPM_CMD_MASK);
+
+	return true;
+}
+
+/* Executes SPM according to SPMCSR and returns the cycles the CPU is halted
+ * for on top of the instruction itself. SPMCSR's command bits clear once the
+ * operation completes.
+ */
+static cycle_t
+p_spm(emu_t *emu, const struct core core, uint16_t raw)
+{
+	hw_t *hw = emu->hw;
+	uint16_t spmcsr = hw->dev->io.spmcsr;
+	uint32_t page = hw->dev->spm_pagesize;
+	cycle_t cycles = 0;
+
+	uint8_t ctl = data_read(hw->data, spmcsr);
+	uint32_t z = PAIR(Z);
+
+	if (core.rampz)
+		z |= (uint32_t) data_read(hw->data, core.rampz) << 16;
+
+	if (!(ctl & SPM_SPMEN))
+	{
+		LOG_WARN(LOG_FLASH, "spm without SPMEN set is ignored");
+		return cycles;
+	}
+
+	switch (ctl & SPM_CMD_MASK & ~SPM_SPMEN)
+	{
+		case 0:
+		{
+			/* Fill the temporary buffer with R1:R0 */
+			uint32_t offs = z & (page - 1) & ~1;
+
+			emu->spm_buf[offs] = data_read(hw->data, R0);
+			emu->spm_buf[offs + 1] = data_read(hw->data, R1);
+			break;
+		}
+		case SPM_PGERS:
+			flash_erase_page(hw->flash, z, page);
+			p_flash_changed(emu, (z & core.flashend) & ~(page - 1), page);
+			ctl |= SPM_RWWSB;
+			cycles = emu->spm_prog_cycles;
+			break;
+		case SPM_PGWRT:
+			flash_write_page(hw->flash, z, emu->spm_buf, page);
+			p_flash_changed(emu, (z & core.flashend) & ~(page - 1), page);
+			memset(emu->spm_buf, 0xFF, page);
+			ctl |= SPM_RWWSB;
+			cycles = emu->spm_prog_cycles;
+			break;
+		case SPM_RWWSRE:
+			memset(emu->spm_buf, 0xFF, page);
+			ctl &= ~SPM_RWWSB;
+			break;
+		default:
+			/* Lock bits are not modelled; SIGRD is a no-op for SPM */
+			break;
+	}
+
+	data_write(hw->data, spmcsr, ctl & ~SPM_CMD_MASK);
+
+	ASM("spm\t\t; 0x%06X, spmcsr=0x%02X", z, ctl);
+
+	/* SPM Z+ */
+	if (raw == 0x95F8)
+		SET_PAIR(Z, z + 2);
+
+	return cycles;
+}
+
+/* LD/LDD/ST/STD through the pointer pair ptr, displaced by op.q (0 for the
+ * LD/ST forms). adj is -1 for pre-decrement and 1 for post-increment, which
+ * write the pointer back. Returns false if the address faults, in which case
+ * the instruction does not retire.
+ */
+static inline bool ATTR_INLINE
+p_access(emu_t *emu, op_t op, const struct core core, uint8_t ptr, int adj,
+		bool store, cycle_t *cycles)
+{
+	hw_t *hw = emu->hw;
+	uint16_t pointer = PAIR(ptr);
+
+	if (adj < 0)
+		--pointer;
+
+	uint16_t addr = pointer + op.q;
+
+	if (store || !p_is_mapped_flash(core, addr))
+	{
+		if (p_validate_data_address(core.ramend, addr, &emu->exc)
+				!= EMU_EXC_NONE)
+			return false;
+	}
+
+	if (store)
+	{
+		uint8_t val = data_read(hw->data, op.rr);
+		WATCH(EMU_WATCH_WRITE, DATA_ADDR(core, addr), val);
+		data_write(hw->data, DATA_ADDR(core, addr), val);
+		TRACE_MEM(TRACE_STORE, DATA_ADDR(core, addr), val);
+		ASM("%s 0x%04X, r%u\t; =%X", avr_op_str(op.instr), addr, op.rr, val);
+	}
+	else
+	{
+		if (p_is_mapped_flash(core, addr))
+			*cycles += emu->timing->flash_load;
+
+		uint8_t val = p_load(hw, core, addr);
+		WATCH(EMU_WATCH_READ, DATA_ADDR(core, addr), val);
+		data_write(hw->data, op.rd, val);
+		TRACE_MEM(TRACE_LOAD, DATA_ADDR(core, addr), val);
+		ASM("%s r%u, 0x%04X\t; =%X", avr_op_str(op.instr), op.rd, addr, val);
+	}
+
+	if (adj > 0)
+		++pointer;
+
+	if (adj)
+		SET_PAIR(ptr, pointer);
+
+	return true;
+}
+
+#define ACCESS(ptr, adj, store) \
+	if (!p_access(emu, op, core, (ptr), (adj), (store), &cycles)) \
+		return
+
+/* Instructions missing from a core crash like UNDEF does on hardware. With
+ * constant features the check folds to nothing for the instructions a
+ * specialized core does have.
+ */
+static inline bool ATTR_INLINE
+p_supported(op_t op, uint32_t features)
+{
+	switch (op.instr)
+	{
+		case MUL: case MULS: case MULSU:
+		case FMUL: case FMULS: case FMULSU:
+			return features & DEV_HAS_MUL;
+		case MOVW:
+			return features & DEV_HAS_MOVW;
+		case CALL: case JMP:
+			return features & DEV_HAS_JMP_CALL;
+		case LPM:
+			/* LPM Rd, Z and LPM Rd, Z+; the implied form is universal */
+			return ((op.raw & 0xFE00) != 0x9000) || (features & DEV_HAS_LPMX);
+		case SPM:
+			return features & DEV_HAS_SPM;
+		case ELPM:
+			return features & DEV_HAS_ELPM;
+		case EICALL: case EIJMP:
+			return features & DEV_HAS_EIJMP;
+		default:
+			return true;
+	}
+}
+
 static inline void ATTR_INLINE
-p_run_once(emu_t *emu, op_t op)
+p_run_once(emu_t *emu, op_t op, const struct core core)
 {
 	hw_t *hw = emu->hw;
 
 	uint32_t next_pc = hw->pc + 1;
-	cycle_t cycles = 1;
+	cycle_t cycles = op.cycles;
 
-	// FIXME: Is this true?
-	if (hw->pc > hw->flashend)
-		next_pc = 0;
+	if (!p_supported(op, core.features))
+	{
+		EMU_THROW_EXCEPTION("%s is not available on %s",
+				avr_op_str(op.instr), hw->name);
+		emu->exc = EMU_EXC_CRASH;
+		return;
+	}
 
 	switch (op.instr)
 	{
@@ -195,23 +812,7 @@ p_run_once(emu_t *emu, op_t op)
 		case ADIW:
 		case SBIW:
 		{
-			uint16_t cur = data_read_word(hw->data, op.rd);
-			uint16_t res = cur;
-			
-			if (op.instr == ADIW)
-				res += op.k;
-			else
-				res -= op.k;
-
-			data_write_word(hw->data, op.rd, res);
-
-			{
-				hw->sreg.c = (~res & cur)>>15;
-				hw->sreg.v = (cur & ~res)>>15;
-				p_set_zns16(hw, res);
-			}
-
-			cycles = 2;
+			uint16_t res = p_adiw(emu, op);
 
 			ASM("%s r%u:%u, %u\t; =%u", (op.instr == ADIW) ? "adiw" : "sbiw",
 					op.rd + 1, op.rd, op.k, res);
@@ -228,20 +829,13 @@ p_run_once(emu_t *emu, op_t op)
 
 			uint8_t res = rd - rr;
 
-			if (op.instr == SBC || op.instr == SBCI)
+			bool carry = (op.instr == SBC || op.instr == SBCI);
+
+			if (carry)
 				res -= hw->sreg.c;
 
 			data_write(hw->data, op.rd, res);
-
-			{
-				uint8_t chk_c = (~rd & rr) | (rr & res) | (res & ~rd);
-
-				hw->sreg.c = chk_c >> 7;
-				hw->sreg.v = ((rd & ~rr & ~res) | (~rd & rr & res)) >> 7;
-				hw->sreg.h = chk_c >> 3;
-
-				p_set_zns(hw, res);
-			}
+			p_sub_flags(hw, rd, rr, res, carry);
 
 			break;
 		}
@@ -276,13 +870,11 @@ p_run_once(emu_t *emu, op_t op)
 
 			uint16_t res = rd * rr;
 
-			data_write_word(hw->data, 0, res);
+			SET_PAIR(R0, res);
 
 			hw->sreg.c = res >> 15;
 			hw->sreg.z = res == 0;
 
-			cycles = 2;
-
 			ASM("mul r%u, r%u\t; =%u", op.rd, op.rr, res);
 			break;
 		}
@@ -293,13 +885,11 @@ p_run_once(emu_t *emu, op_t op)
 
 			int16_t res = rd * rr;
 
-			data_write_word(hw->data, 0, res);
+			SET_PAIR(R0, res);
 
 			hw->sreg.c = res >> 15;
 			hw->sreg.z = res == 0;
 
-			cycles = 2;
-
 			ASM("muls r%u, r%u\t; =%d", op.rd, op.rr, res);
 			break;
 		}
@@ -310,13 +900,11 @@ p_run_once(emu_t *emu, op_t op)
 
 			int16_t res = rd * rr;
 
-			data_write_word(hw->data, 0, res);
+			SET_PAIR(R0, res);
 
 			hw->sreg.c = res >> 15;
 			hw->sreg.z = res == 0;
 
-			cycles = 2;
-
 			ASM("mulsu r%u, r%u\t; =%d", op.rd, op.rr, res);
 			break;
 		}
@@ -327,8 +915,7 @@ p_run_once(emu_t *emu, op_t op)
 
 			uint16_t res = (rd * rr) << 1;
 
-			// TODO: 0 => R0
-			data_write_word(hw->data, 0, res);
+			SET_PAIR(R0, res);
 
 			hw->sreg.c = res >> 15;
 			hw->sreg.z = res == 0;
@@ -343,7 +930,7 @@ p_run_once(emu_t *emu, op_t op)
 
 			int16_t res = (rd * rr) << 1;
 
-			data_write_word(hw->data, 0, res);
+			SET_PAIR(R0, res);
 
 			hw->sreg.c = res >> 15;
 			hw->sreg.z = res == 0;
@@ -358,7 +945,7 @@ p_run_once(emu_t *emu, op_t op)
 
 			int16_t res = (rd * rr) << 1;
 
-			data_write_word(hw->data, 0, res);
+			SET_PAIR(R0, res);
 
 			hw->sreg.c = res >> 15;
 			hw->sreg.z = res == 0;
@@ -450,65 +1037,82 @@ p_run_once(emu_t *emu, op_t op)
 		case CALL: // TODO: Write asm unit test for relocatable call
 		{
 			// CALL is 32-bit so increment pc again
-			p_stack_push(hw, LOW(next_pc + 1));
-			p_stack_push(hw, HIGH(next_pc + 1));
+			p_push_pc(emu, core, next_pc + 1);
 
 			next_pc = op.k;
 
-			cycles = 4;
+			p_on_call(emu, next_pc, hw->pc + 2, cycles);
 
 			ASM("call 0x%08x", next_pc);
 			break;
 		}
 		case ICALL:
 		{
-			uint16_t addr = data_read_word(hw->data, 30); // TODO
+			uint16_t addr = PAIR(Z);
 
-			p_stack_push(hw, LOW(next_pc + 1));
-			p_stack_push(hw, HIGH(next_pc + 1));
+			p_push_pc(emu, core, next_pc);
 
-			next_pc = addr;
+			p_on_call(emu, addr, next_pc, cycles);
 
-			cycles = 3;
+			next_pc = addr;
 
 			ASM("icall 0x%08X", addr);
 			break;
 		}
+		case EICALL:
+		{
+			uint32_t addr = ((uint32_t) data_read(hw->data, core.eind) << 16)
+				| PAIR(Z);
+
+			p_push_pc(emu, core, next_pc);
+
+			p_on_call(emu, addr, next_pc, cycles);
+
+			next_pc = addr;
+
+			ASM("eicall 0x%08X", addr);
+			break;
+		}
 		case RCALL:
 		{
-			p_stack_push(hw, LOW(next_pc + 1));
-			p_stack_push(hw, HIGH(next_pc + 1));
+			p_push_pc(emu, core, next_pc);
 
-			next_pc += op.k;
+			p_on_call(emu, next_pc + op.k, next_pc, cycles);
 
-			cycles = 3;
+			next_pc += op.k;
 
 			ASM("rcall %X %X", op.k, op.raw);
 			break;
 		}
-		/* TODO: EICALL (not on 328) */
 		case JMP:
 		{
 			next_pc = op.k;
-			cycles = 3;
 
 			ASM("jmp .+0x%04X", op.k);
 			break;
 		}
 		case IJMP:
 		{
-			uint16_t addr = data_read_word(hw->data, Z);
+			uint16_t addr = PAIR(Z);
 
 			next_pc = addr;
-			cycles = 2;
 
 			ASM("ijmp .+0x%04X", addr);
 			break;
 		}
+		case EIJMP:
+		{
+			uint32_t addr = ((uint32_t) data_read(hw->data, core.eind) << 16)
+				| PAIR(Z);
+
+			next_pc = addr;
+
+			ASM("eijmp 0x%08X", addr);
+			break;
+		}
 		case RJMP:
 		{
 			next_pc += op.k;
-			cycles = 2;
 
 			ASM("rjmp 0x%04X", next_pc);
 			break;
@@ -516,20 +1120,22 @@ p_run_once(emu_t *emu, op_t op)
 		case RET:
 		case RETI:
 		{
-			uint8_t pch = p_stack_pop(hw);
-			uint8_t pcl = p_stack_pop(hw);
+			next_pc = p_pop_pc(emu, core);
 
-			printf("HIGH = %X\n", pch);
+			if (op.instr == RETI)
+			{
+				p_set_i(emu, true, emu->cycles + cycles);
 
-			next_pc = pcl | (pch<<8);
-			cycles = 4;
+				if (emu->irqstat)
+					irqstat_reti(emu->irqstat, emu->cycles + cycles);
+			}
 
-			if (op.instr == RETI)
-				hw->sreg.i = 1;
+			if (emu->cg)
+				callgraph_ret(emu->cg, next_pc, emu->cycles + cycles);
 
 			ASM("%s\t\t; 0x%04X", avr_op_str(op.instr), next_pc);
+			break;
 		}
-		/* TODO: EIJMP */
 		case CP:
 		case CPI:
 		{
@@ -537,13 +1143,7 @@ p_run_once(emu_t *emu, op_t op)
 			uint8_t rr = (op.instr == CP) ? data_read(hw->data, op.rr) : op.k;
 			uint8_t res = rd - rr;
 
-			{
-				uint8_t chk = (~rd & rr) | (rr & res) | (res & ~rd);
-				hw->sreg.c = chk>>7;
-				hw->sreg.v = ((rd & ~rr & ~res) | (~rd & rr & res)) >> 7;
-				hw->sreg.h = chk>>3;
-				p_set_zns(hw, res);
-			}
+			p_sub_flags(hw, rd, rr, res, false);
 
 			ASM("cp%s r%u, r%u\t; %u", (op.instr == CP) ? "" : "i",
 					op.rd, op.rr, res);
@@ -555,16 +1155,7 @@ p_run_once(emu_t *emu, op_t op)
 			uint8_t rr = data_read(hw->data, op.rr);
 			uint8_t res = rd - rr - hw->sreg.c;
 
-			{
-				uint8_t chk = (~rd & rr) | (rr & res) | (res & ~rd);
-				hw->sreg.c = chk >> 7;
-				if (res)
-					hw->sreg.z = 0;
-				hw->sreg.n = res>>7;
-				hw->sreg.v = ((rd & ~rr & ~res) | (~rd & rr & res)) >> 7;
-				hw->sreg.s = hw->sreg.n ^ hw->sreg.v;
-				hw->sreg.h = chk >> 3;
-			}
+			p_sub_flags(hw, rd, rr, res, true);
 
 			ASM("cpc r%u, r%u\t =%u", op.rd, op.rr, res);
 			break;
@@ -576,18 +1167,10 @@ p_run_once(emu_t *emu, op_t op)
 
 			if (rd == rr)
 			{
-				op_t next = avr_decode(hw, next_pc);
-
-				if (INSTR_IS_32(next.instr))
-				{
-					cycles = 3;
-					next_pc += 2;
-				}
-				else
-				{
-					cycles = 2;
-					next_pc += 1;
-				}
+				op_t next = p_op_at(emu, next_pc);
+
+				cycles += op.taken + OP_IS_32(next);
+				next_pc += 1 + OP_IS_32(next);
 			}
 
 			ASM("cpse r%u, r%u\t; %u == %u", op.rd, op.rr, rd, rr);
@@ -601,18 +1184,10 @@ p_run_once(emu_t *emu, op_t op)
 
 			if ((rr & (1<<op.b)) == 0)
 			{
-				op_t next = avr_decode(hw, next_pc);
-
-				if (INSTR_IS_32(next.instr))
-				{
-					cycles = 3;
-					next_pc += 2;
-				}
-				else
-				{
-					cycles = 2;
-					next_pc += 1;
-				}
+				op_t next = p_op_at(emu, next_pc);
+
+				cycles += op.taken + OP_IS_32(next);
+				next_pc += 1 + OP_IS_32(next);
 			}
 
 			ASM("sbrc r%u, r%u", op.rr, op.b);
@@ -624,20 +1199,12 @@ p_run_once(emu_t *emu, op_t op)
 			uint8_t rr = (op.instr == SBRS) ?
 				data_read(hw->data, op.rr) : data_read(hw->data, IO2MEM(op.a));
 
-			if ((rr & (1<<op.b)) == 1)
+			if (rr & (1<<op.b))
 			{
-				op_t next = avr_decode(hw, next_pc);
-
-				if (INSTR_IS_32(next.instr))
-				{
-					cycles = 3;
-					next_pc += 2;
-				}
-				else
-				{
-					cycles = 2;
-					next_pc += 1;
-				}
+				op_t next = p_op_at(emu, next_pc);
+
+				cycles += op.taken + OP_IS_32(next);
+				next_pc += 1 + OP_IS_32(next);
 			}
 
 			ASM("sbrs r%u, r%u", op.rr, op.b);
@@ -668,7 +1235,10 @@ p_run_once(emu_t *emu, op_t op)
 			}
 
 			if (sbit != is_brbc)
+			{
 				next_pc += op.k;
+				cycles += op.taken;
+			}
 
 			ASM("brbs sreg[%u], . + 0x%04X\t =0x%04X", op.s, op.k, next_pc);
 			break;
@@ -765,7 +1335,7 @@ p_run_once(emu_t *emu, op_t op)
 				case 4: hw->sreg.s = sbit; break;
 				case 5: hw->sreg.h = sbit; break;
 				case 6: hw->sreg.t = sbit; break;
-				case 7: hw->sreg.i = sbit; break;
+				case 7: p_set_i(emu, sbit & 1, emu->cycles + cycles); break;
 			}
 
 			ASM("%s sreg[%u]", (op.raw & 0x0080) ? "bclr" : "bset", op.s);
@@ -795,8 +1365,10 @@ p_run_once(emu_t *emu, op_t op)
 		case IN:
 		{
 			uint8_t val = data_read(hw->data, IO2MEM(op.a));
+			WATCH(EMU_WATCH_READ, IO2MEM(op.a), val);
 
 			data_write(hw->data, op.rd, val);
+			TRACE_MEM(TRACE_LOAD, IO2MEM(op.a), val);
 
 			ASM("in r%u, 0x%02X\t; =%X", op.rd, IO2MEM(op.a), val);
 			break;
@@ -805,97 +1377,112 @@ p_run_once(emu_t *emu, op_t op)
 		{
 			uint8_t val = data_read(hw->data, op.rr);
 
+			WATCH(EMU_WATCH_WRITE, IO2MEM(op.a), val);
 			data_write(hw->data, IO2MEM(op.a), val);
+			TRACE_MEM(TRACE_STORE, IO2MEM(op.a), val);
 
 			ASM("out 0x%02X, r%u\t; =%X", IO2MEM(op.a), op.rr, val);
 			break;
 		}
-		case LD:
-		case ST:
+		/* Pointer forms, the cases differ only in constants */
+		case LD_X:	ACCESS(X, 0, false); break;
+		case LD_X_INC:	ACCESS(X, 1, false); break;
+		case LD_X_DEC:	ACCESS(X, -1, false); break;
+		case LD_Y_INC:	ACCESS(Y, 1, false); break;
+		case LD_Y_DEC:	ACCESS(Y, -1, false); break;
+		case LD_Z_INC:	ACCESS(Z, 1, false); break;
+		case LD_Z_DEC:	ACCESS(Z, -1, false); break;
+		case LDD_Y:	ACCESS(Y, 0, false); break;
+		case LDD_Z:	ACCESS(Z, 0, false); break;
+		case ST_X:	ACCESS(X, 0, true); break;
+		case ST_X_INC:	ACCESS(X, 1, true); break;
+		case ST_X_DEC:	ACCESS(X, -1, true); break;
+		case ST_Y_INC:	ACCESS(Y, 1, true); break;
+		case ST_Y_DEC:	ACCESS(Y, -1, true); break;
+		case ST_Z_INC:	ACCESS(Z, 1, true); break;
+		case ST_Z_DEC:	ACCESS(Z, -1, true); break;
+		case STD_Y:	ACCESS(Y, 0, true); break;
+		case STD_Z:	ACCESS(Z, 0, true); break;
+		case LDI:
 		{
-			uint16_t addr = data_read_word(hw->data, X);
+			data_write(hw->data, op.rd, op.k);
 
-			PREEMPT_SEGFAULT(hw, addr, &emu->exc);
+			ASM("ldi r%u, 0x%02X\t; %d", op.rd, op.k, op.k);
+			break;
+		}
+		case LDS:
+		case STS:
+		{
+			uint16_t addr = DATA_ADDR(core, op.k);
 
-			uint8_t adj = op.raw & 3;
-			if (adj == 2)
-				--addr;
+			PREEMPT_SEGFAULT(core.ramend, op.k, &emu->exc);
 
-			if (op.instr == LD)
+			if (op.instr == LDS)
 			{
 				uint8_t val = data_read(hw->data, addr);
+				WATCH(EMU_WATCH_READ, addr, val);
 				data_write(hw->data, op.rd, val);
-				ASM("ld r%u, %X\t =%X", op.rd, addr, val);
+				TRACE_MEM(TRACE_LOAD, addr, val);
+				ASM("lds r%u, 0x%04X\t; =%X", op.rd, op.k, val);
 			}
-			else
+			else /* STS */
 			{
 				uint8_t val = data_read(hw->data, op.rr);
+				WATCH(EMU_WATCH_WRITE, addr, val);
 				data_write(hw->data, addr, val);
-				ASM("st %X, r%u\t =%X", addr, op.rr, val);
+				TRACE_MEM(TRACE_STORE, addr, val);
+				ASM("sts 0x%04X, r%u\t; =%X", op.k, op.rr, val);
 			}
 
-			if (adj == 1)
-				++addr;
-
-			data_write_word(hw->data, X, addr);
-			
-			cycles = 2;
+			/* The full core's LDS/STS carry the address in a second word */
+			if (!(core.features & DEV_REDUCED_CORE))
+				++next_pc;
 
 			break;
 		}
-		case LDD:
-		case STD:
+		case ELPM:
 		{
-			uint8_t reg = (op.raw & 0x0008) ? Y : Z;
-			uint16_t addr = op.q + data_read_word(hw->data, reg);
+			uint32_t addr = ((uint32_t) data_read(hw->data, core.rampz) << 16)
+				| PAIR(Z);
+			uint8_t val = flash_read_byte(hw->flash, addr % (core.flashend + 1));
 
-			PREEMPT_SEGFAULT(hw, addr, &emu->exc);
+			data_write(hw->data, op.rd, val);
 
-			if (op.instr == LDD)
-			{
-				uint8_t val = data_read(hw->data, addr);
-				data_write(hw->data, op.rd, val);
-				ASM("ldd r%u, %X\t; =%X", op.rd, addr, val);
-			}
-			else /* STD */
+			ASM("elpm r%u, 0x%06X\t; =0x%02X", op.rd, addr, val);
+
+			/* ELPM Rd, Z+ increments the whole RAMPZ:Z pointer */
+			if ((op.raw & 0xFE0F) == 0x9007)
 			{
-				uint8_t val = data_read(hw->data, op.rr);
-				data_write(hw->data, addr, val);
-				ASM("std %X, r%u\t; =%X", addr, op.rr, val);
+				++addr;
+				SET_PAIR(Z, addr);
+				data_write(hw->data, core.rampz, (addr >> 16) & 0xFF);
 			}
 
 			break;
 		}
-		case LDI:
+		case LPM:
 		{
-			data_write(hw->data, op.rd, op.k);
+			uint16_t addr = PAIR(Z);
+			uint8_t val;
+
+			if (!p_lpm_special(emu, addr, &val))
+				val = flash_read_byte(hw->flash, addr & core.flashend);
+
+			data_write(hw->data, op.rd, val);
+
+			ASM("lpm r%u, 0x%04X\t; =0x%02X", op.rd, addr, val);
+
+			/* LPM Rd, Z+ */
+			if ((op.raw & 0xFE0F) == 0x9005)
+				SET_PAIR(Z, addr + 1);
 
-			ASM("ldi r%u, 0x%02X\t; %d", op.rd, op.k, op.k);
 			break;
 		}
-		/* ATtiny and few others only/
-		case LDS:
-		case STS:
+		case SPM:
 		{
-			PREEMPT_SEGFAULT(hw, op.k, &emu->exc);
-
-			if (op.instr == LDS)
-			{
-				uint8_t val = data_read(hw->data, op.k);
-				data_write(hw->data, op.rd, val);
-				ASM("ldd r%u, %X\t; =%X", op.rd, op.k, val);
-			}
-			else STS
-			{
-				uint8_t val = data_read(hw->data, op.rr);
-				data_write(hw->data, op.k, op.rr);
-				ASM("sts %X, r%u\t; =%X", op.k, op.rr, val);
-			}
-
+			cycles += p_spm(emu, core, op.raw);
 			break;
-		} */
-		/* case LPM: */
-		/* case SPM: */
+		}
 		case MOV:
 		{
 			uint8_t rr = data_read(hw->data, op.rr);
@@ -906,29 +1493,32 @@ p_run_once(emu_t *emu, op_t op)
 		}
 		case MOVW:
 		{
-			uint16_t res16 = data_read(hw->data, op.rr);
-			data_write_word(hw->data, op.rd, res16);
+			uint16_t res16 = PAIR(op.rr);
+			SET_PAIR(op.rd, res16);
 
-			ASM("movw r%u:%u, r%u:%u\t; =0x%02X",
+			ASM("movw r%u:%u, r%u:%u\t; =0x%04X",
 					op.rd, op.rd+1, op.rr, op.rr+1, res16);
 			break;
 		}
 		case PUSH:
 		{
 			uint8_t rr = data_read(hw->data, op.rr);
-			p_stack_push(hw, rr);
+			WATCH(EMU_WATCH_WRITE, DATA_ADDR(core, (hw->sp[1] << 8) | hw->sp[0]), rr);
 
-			cycles = 2;
+			uint16_t addr = p_stack_push(hw, core, rr);
+			TRACE_MEM(TRACE_STORE, addr, rr);
 
 			ASM("push r%u\t; =%X", op.rr, rr);
 			break;
 		}
 		case POP:
 		{
-			uint8_t val = p_stack_pop(hw);
-			data_write(hw->data, op.rd, val);
+			uint8_t val = p_stack_pop(hw, core);
+			uint16_t addr = DATA_ADDR(core, (hw->sp[1] << 8) | hw->sp[0]);
+			WATCH(EMU_WATCH_READ, addr, val);
 
-			cycles = 2;
+			data_write(hw->data, op.rd, val);
+			TRACE_MEM(TRACE_LOAD, addr, val);
 
 			ASM("pop r%u\t; =%X", op.rd, val);
 			break;
@@ -961,44 +1551,826 @@ p_run_once(emu_t *emu, op_t op)
 			break;
 		}
 
+		case TRAP:
+		{
+			/* Stop before the instruction; it runs once the caller resumes */
+			if (!emu->bp_resume)
+			{
+				emu->exc = EMU_EXC_BREAKPOINT;
+				return;
+			}
+
+			emu->bp_resume = false;
+			p_run_trapped(emu);
+			return;
+		}
+
 		default:
 			break;
 	}
 
-	hw->pc = next_pc;
+	/* The PC wraps around at the end of flash */
+	hw->pc = next_pc & core.pcmask;
 	emu->cycles += cycles;
 
 	return;
 }
 
+static void
+p_run_trapped(emu_t *emu)
+{
+	p_run_once(emu, *p_breakpoint_op(emu, emu->hw->pc), emu->core);
+}
+
+static inline void ATTR_INLINE
+p_cover(emu_t *emu, uint32_t pc)
+{
+	uint32_t loc = (pc >> 4) ^ (pc << 8);
+	uint32_t idx = (loc ^ emu->cov_prev) & emu->cov_mask;
+
+	++emu->cov[idx];
+	emu->cov_touched |= 1ULL << (idx >> emu->cov_shift);
+	emu->cov_prev = loc >> 1;
+}
+
+static emu_stop_t
+p_stop_reason(const emu_t *emu)
+{
+	emu_stop_t stop = EMU_STOP_NONE;
+
+	if (emu->exc == EMU_EXC_CRASH)
+		stop = EMU_STOP_CRASH;
+	else if (emu->exc == EMU_EXC_SEGFAULT)
+		stop = EMU_STOP_SEGFAULT;
+	else if (emu->exc == EMU_EXC_BREAKPOINT)
+		stop = EMU_STOP_BREAKPOINT;
+	else if (emu->exc == EMU_EXC_WATCHPOINT)
+		stop = EMU_STOP_WATCHPOINT;
+	else if (emu->hw->state == AVR_BREAK)
+		stop = EMU_STOP_BREAK;
+	else if (emu->hw->state == AVR_SLEEP)
+		stop = EMU_STOP_SLEEP;
+
+	return stop;
+}
+
+/* Runs the superinstruction group starting at the PC. Every op of the group
+ * has the same effect, cycle count and watchpoint behaviour as when run on
+ * its own; a watchpoint hit ends the group early.
+ */
+static void
+p_run_fused(emu_t *emu, op_t op, const struct core core)
+{
+	hw_t *hw = emu->hw;
+	const op_t *ops = &emu->ops[hw->pc];
+
+	uint32_t next_pc = hw->pc + AVR_FUSE_LEN(op.fuse);
+	cycle_t cycles = ops[0].cycles + ops[1].cycles;
+
+	switch (op.fuse)
+	{
+		case FUSE_LDI_LDI:
+			data_write(hw->data, ops[0].rd, ops[0].k);
+			data_write(hw->data, ops[1].rd, ops[1].k);
+			break;
+		case FUSE_CP_CPC_BRNE:
+		{
+			uint8_t rd = data_read(hw->data, ops[0].rd);
+			uint8_t rr = (ops[0].instr == CP) ?
+				data_read(hw->data, ops[0].rr) : ops[0].k;
+
+			p_sub_flags(hw, rd, rr, rd - rr, false);
+
+			rd = data_read(hw->data, ops[1].rd);
+			rr = data_read(hw->data, ops[1].rr);
+
+			p_sub_flags(hw, rd, rr, rd - rr - hw->sreg.c, true);
+
+			cycles += ops[2].cycles;
+
+			if (hw->sreg.z == (ops[2].instr == BREQ))
+			{
+				next_pc += ops[2].k;
+				cycles += ops[2].taken;
+			}
+			break;
+		}
+		case FUSE_SUBI_SBCI:
+		{
+			uint8_t lo = data_read(hw->data, ops[0].rd);
+			uint8_t res = lo - (uint8_t) ops[0].k;
+
+			data_write(hw->data, ops[0].rd, res);
+			p_sub_flags(hw, lo, ops[0].k, res, false);
+
+			uint8_t hi = data_read(hw->data, ops[1].rd);
+			res = hi - (uint8_t) ops[1].k - hw->sreg.c;
+
+			data_write(hw->data, ops[1].rd, res);
+			p_sub_flags(hw, hi, ops[1].k, res, true);
+			break;
+		}
+		case FUSE_MOVW_ADIW:
+			SET_PAIR(ops[0].rd, PAIR(ops[0].rr));
+			p_adiw(emu, ops[1]);
+			break;
+		case FUSE_IN_CLI:
+		{
+			uint8_t val = data_read(hw->data, IO2MEM(ops[0].a));
+			WATCH(EMU_WATCH_READ, IO2MEM(ops[0].a), val);
+
+			data_write(hw->data, ops[0].rd, val);
+
+			if (emu->exc != EMU_EXC_NONE)
+			{
+				next_pc = hw->pc + 1;
+				cycles = ops[0].cycles;
+				break;
+			}
+
+			p_set_i(emu, false, emu->cycles + cycles);
+			break;
+		}
+	}
+
+	hw->pc = next_pc & core.pcmask;
+	emu->cycles += cycles;
+}
+
+/* Superinstructions bypass the per-instruction instrumentation and the
+ * instruction trace log, so they are only used when none of it is on.
+ */
+static inline bool ATTR_INLINE
+p_can_fuse(const emu_t *emu)
+{
+	return !emu->cov && !emu->prof && !emu->trace && !emu->lcov
+		&& !emu->irqstat && !LOG_ENABLED(LOG_EMU, LOG_LVL_TRACE);
+}
+
+/* Executes one instruction and feeds the enabled instrumentation */
+static inline void ATTR_INLINE
+p_step(emu_t *emu, const struct core core)
+{
+	hw_t *hw = emu->hw;
+	uint32_t pc = hw->pc;
+	cycle_t before = emu->cycles;
+
+	p_run_once(emu, emu->ops[pc], core);
+
+	/* A breakpoint stops before its instruction, so there is nothing to
+	 * account for. Only checked when some instrumentation is enabled.
+	 */
+	if (emu->cov && hw->pc != pc + 1 && emu->exc != EMU_EXC_BREAKPOINT)
+		p_cover(emu, hw->pc);
+
+	if (emu->prof && emu->exc != EMU_EXC_BREAKPOINT)
+	{
+		++emu->prof->insns[pc];
+		emu->prof->cycles[pc] += emu->cycles - before;
+	}
+
+	if (emu->lcov && emu->exc != EMU_EXC_BREAKPOINT)
+		emu->lcov->map[pc] |= (hw->pc == pc + 1) ? LCOV_FALL : LCOV_JUMP;
+
+	if (emu->trace && emu->exc != EMU_EXC_BREAKPOINT)
+	{
+		op_t op = p_op_at(emu, pc);
+
+		if (OP_IS_32(op))
+			trace_put(emu->trace, TRACE_EXT, 0, p_op_at(emu, pc + 1).raw, 0);
+		trace_put(emu->trace, TRACE_INSN, emu->cycles - before, op.raw, pc);
+	}
+}
+
+static void
+p_irq_flag(emu_t *emu, uint8_t vector, cycle_t at)
+{
+	uint64_t bit = 1ULL << vector;
+
+	/* Raising a pending flag again is lost, as on the hardware */
+	if (!(emu->irq_pending & bit))
+	{
+		emu->irq_pending |= bit;
+		emu->irq_raised[vector] = at;
+	}
+}
+
+/* Sets irq_check from the pending flags and the sources' next raise */
+static void
+p_irq_update_check(emu_t *emu)
+{
+	cycle_t check = UINT64_MAX;
+
+	for (uint32_t i = 0; i < emu->n_irq_srcs; i++)
+	{
+		if (emu->irq_srcs[i].next < check)
+			check = emu->irq_srcs[i].next;
+	}
+
+	emu->irq_check = (emu->irq_pending) ? 0 : check;
+}
+
+/* Points every source at its first raise not before the current cycle */
+static void
+p_irq_rearm(emu_t *emu)
+{
+	for (uint32_t i = 0; i < emu->n_irq_srcs; i++)
+	{
+		struct irq_source *src = &emu->irq_srcs[i];
+
+		if (emu->cycles <= src->first)
+			src->next = src->first;
+		else if (src->period == 0)
+			src->next = UINT64_MAX;
+		else
+			src->next = src->first + (emu->cycles - src->first
+					+ src->period - 1) / src->period * src->period;
+	}
+
+	p_irq_update_check(emu);
+}
+
+/* Vector slots hold a JMP or RJMP to the handler, which is where the call
+ * graph and --budget expect the frame of an interrupt to start; anything
+ * else is taken to be the handler itself.
+ */
+static uint32_t
+p_irq_handler(const emu_t *emu, uint32_t slot)
+{
+	op_t op = avr_decode(emu->hw, slot);
+
+	if (op.instr == JMP)
+		return op.k;
+	else if (op.instr == RJMP)
+		return slot + 1 + op.k;
+
+	return slot;
+}
+
+static void
+p_irq_enter(emu_t *emu, const struct core core, uint8_t vector)
+{
+	hw_t *hw = emu->hw;
+	uint32_t target = vector * hw->dev->vector_words;
+	cycle_t start = emu->cycles;
+	cycle_t cycles = (core.pc22) ? 5 : 4;
+
+	if (hw->state == AVR_SLEEP)
+	{
+		hw->state = AVR_NORMAL;
+		cycles += 4;
+	}
+
+	emu->irq_pending &= ~(1ULL << vector);
+
+	p_push_pc(emu, core, hw->pc);
+	if (emu->cg)
+		p_on_call(emu, p_irq_handler(emu, target), hw->pc, cycles);
+
+	hw->pc = target & core.pcmask;
+	p_set_i(emu, false, start);
+
+	emu->cycles += cycles;
+
+	if (emu->irqstat)
+		irqstat_enter(emu->irqstat, vector, emu->irq_raised[vector], start,
+				emu->cycles);
+
+	if (emu->trace)
+		trace_put(emu->trace, TRACE_IRQ, cycles, vector, hw->pc);
+
+	ASM("interrupt %u\t; 0x%04X", vector, hw->pc);
+}
+
+/* Raises the sources that are due and takes the highest priority vector if
+ * interrupts are enabled
+ */
+static void
+p_irq_poll(emu_t *emu, const struct core core)
+{
+	for (uint32_t i = 0; i < emu->n_irq_srcs; i++)
+	{
+		struct irq_source *src = &emu->irq_srcs[i];
+
+		if (src->next > emu->cycles)
+			continue;
+
+		p_irq_flag(emu, src->vector, src->next);
+
+		/* Periods missed during a long instruction or sleep fold into
+		 * the flag that is already pending
+		 */
+		if (src->period == 0)
+			src->next = UINT64_MAX;
+		else
+			src->next += ((emu->cycles - src->next) / src->period + 1)
+				* src->period;
+	}
+
+	if (emu->irq_pending && emu->hw->sreg.i && emu->cycles != emu->irq_hold)
+		p_irq_enter(emu, core, __builtin_ctzll(emu->irq_pending));
+
+	p_irq_update_check(emu);
+}
+
+/* Lets a sleeping core idle up to the given cycle */
+static inline void ATTR_INLINE
+p_idle(emu_t *emu, cycle_t until)
+{
+	cycle_t idle = until - emu->cycles;
+
+	if (emu->trace)
+		trace_put(emu->trace, TRACE_IDLE, 0, idle >> 32, (uint32_t) idle);
+
+	emu->cycles = until;
+}
+
+/* A sleeping core only stays in the run if an interrupt can wake it */
+static inline bool ATTR_INLINE
+p_irq_can_wake(const emu_t *emu)
+{
+	return emu->hw->state == AVR_SLEEP && emu->hw->sreg.i
+		&& emu->irq_check != UINT64_MAX;
+}
+
+static inline emu_stop_t ATTR_INLINE
+p_run_until(emu_t *emu, cycle_t end, const struct core core)
+{
+	hw_t *hw = emu->hw;
+	const bool fuse = p_can_fuse(emu);
+
+	while (emu->cycles < end)
+	{
+		if (emu->cycles >= emu->irq_check)
+			p_irq_poll(emu, core);
+
+		/* Nothing can interrupt the instructions before irq_until, and
+		 * emu_irq_raise() pulls it in
+		 */
+		emu->irq_until = (emu->irq_check < end) ? emu->irq_check : end;
+
+		if (hw->state == AVR_SLEEP)
+		{
+			/* Idles until the next source is due */
+			if (emu->irq_until > emu->cycles)
+				p_idle(emu, emu->irq_until);
+			continue;
+		}
+
+		do
+		{
+			op_t op = emu->ops[hw->pc];
+
+			/* Fused only if every op of the group would have started
+			 * before irq_until
+			 */
+			if (fuse && op.fuse
+					&& emu->cycles + AVR_FUSE_LEN(op.fuse) - 1 < emu->irq_until)
+				p_run_fused(emu, op, core);
+			else
+				p_step(emu, core);
+
+			if (emu->exc != EMU_EXC_NONE || hw->state != AVR_NORMAL)
+			{
+				if (emu->exc != EMU_EXC_NONE || !p_irq_can_wake(emu))
+					return p_stop_reason(emu);
+
+				break;
+			}
+		}
+		while (emu->cycles < emu->irq_until);
+	}
+
+	return EMU_STOP_BUDGET;
+}
+
+static emu_stop_t
+p_run_generic(emu_t *emu, cycle_t end)
+{
+	return p_run_until(emu, end, emu->core);
+}
+
+/* Catalog devices that get their own copy of the executor, built from the
+ * same constants as the catalog entries (see hw/cores.h).
+ */
+#define CORE_CONST(dev) \
+	{ \
+		.pcmask = dev##_FLASHEND >> 1, \
+		.flashend = dev##_FLASHEND, \
+		.ramend = dev##_RAMEND, \
+		.features = dev##_FEATURES, \
+		.rampz = dev##_RAMPZ, \
+		.eind = dev##_EIND, \
+		.pc22 = (dev##_PC_BYTES == 3) \
+	}
+
+#define CORE_RUN(name, dev) \
+	static emu_stop_t \
+	p_run_##name(emu_t *emu, cycle_t end) \
+	{ \
+		return p_run_until(emu, end, (struct core) CORE_CONST(dev)); \
+	}
+
+DEVICE_CORES(CORE_RUN)
+
+#define CORE_ENTRY(name, dev) \
+	{ #name, p_run_##name },
+
+static const struct
+{
+	const char *name;
+	run_t run;
+} CORES[] =
+{
+	DEVICE_CORES(CORE_ENTRY)
+};
+
+static struct core
+p_core_of(const device_t *dev)
+{
+	struct core core =
+	{
+		.pcmask = dev->flashend >> 1,
+		.flashend = dev->flashend,
+		.ramend = dev->ramend,
+		.features = dev->features,
+		.rampz = dev->io.rampz,
+		.eind = dev->io.eind,
+		.pc22 = (dev->pc_bytes == 3)
+	};
+
+	return core;
+}
+
+static run_t
+p_select_run(const device_t *dev)
+{
+	for (size_t i = 0; i < sizeof CORES / sizeof *CORES; i++)
+	{
+		if (strcmp(CORES[i].name, dev->name) == 0)
+			return CORES[i].run;
+	}
+
+	return p_run_generic;
+}
+
 emu_t *
 emu_init(const char *mcu, chunk_t *chunks, uint32_t n)
 {
-	emu_t *emu = malloc(sizeof *emu);
-	hw_t *hw = device_by_name(mcu);
+	const device_t *dev = device_find(mcu);
+	if (dev == NULL)
+	{
+		LOG_ERROR(LOG_EMU, "unknown device '%s'", mcu ? mcu : "(none)");
+		return NULL;
+	}
 
+	hw_t *hw = device_create(dev);
 	if (hw == NULL)
+		return NULL;
+
+	if (flash_upload(hw->flash, chunks, n) == -1)
 	{
-		// TODO: Couldn't match
-		free(emu);
+		hw->destroy(&hw);
+		return NULL;
 	}
 
+	emu_t *emu = malloc(sizeof *emu);
 	if (emu)
 	{
 		emu->hw = hw;
 		emu->exc = EMU_EXC_NONE;
 		emu->cycles = 0;
-
-		int status = flash_upload(hw->flash, chunks, n);
-		if (status == -1)
+		emu->base_id = 0;
+
+		emu->ops = avr_predecode(hw);
+		if (emu->ops)
+			avr_fuse_range(hw, emu->ops, 0, (hw->flashend + 1) / 2 - 1);
+		emu->core = p_core_of(dev);
+		emu->run = p_select_run(dev);
+		emu->timing = cycle_table(dev);
+		emu->regs = data_regs(hw->data);
+
+		emu->trace = NULL;
+
+		emu->cov = NULL;
+		emu->cov_mask = 0;
+		emu->cov_prev = 0;
+		emu->cov_shift = 0;
+		emu->cov_touched = 0;
+
+		emu->prof = NULL;
+		emu->cg = NULL;
+		emu->lcov = NULL;
+
+		emu->bps = NULL;
+		emu->n_bps = 0;
+		emu->bp_resume = false;
+
+		emu->watch = calloc(WATCH_SPACE, sizeof *emu->watch);
+		emu->watch_addr = 0;
+
+		emu->spm_buf = malloc(dev->spm_pagesize);
+		if (emu->spm_buf)
+			memset(emu->spm_buf, 0xFF, dev->spm_pagesize);
+
+		emu_set_f_cpu(emu, EMU_F_CPU);
+
+		emu->flash_gen = p_flash_gen();
+
+		emu->irq_pending = 0;
+		memset(emu->irq_raised, 0, sizeof emu->irq_raised);
+		emu->irq_check = UINT64_MAX;
+		emu->irq_until = 0;
+		emu->irq_hold = UINT64_MAX;
+		emu->irq_srcs = NULL;
+		emu->n_irq_srcs = 0;
+		emu->irqstat = NULL;
+
+		if (emu->ops == NULL || emu->watch == NULL || emu->spm_buf == NULL
+				|| data_hook(hw->data, SREG, p_sreg_read, p_sreg_write,
+					emu) == -1)
 		{
+			free(emu->ops);
+			free(emu->watch);
+			free(emu->spm_buf);
 			free(emu);
+			emu = NULL;
 		}
 	}
 
+	if (emu == NULL)
+		hw->destroy(&hw);
+
 	return emu;
 }
 
+hw_t *
+emu_hw(emu_t *emu)
+{
+	return emu->hw;
+}
+
+uint64_t
+emu_cycles(const emu_t *emu)
+{
+	return emu->cycles;
+}
+
+const char *
+emu_stop_str(emu_stop_t stop)
+{
+	static const char *STOP_STR_LUT[] =
+	{
+		"none", "break", "sleep", "crash", "segfault", "budget",
+		"breakpoint", "watchpoint"
+	};
+
+	if (stop > EMU_STOP_WATCHPOINT)
+		stop = EMU_STOP_NONE;
+
+	return STOP_STR_LUT[stop];
+}
+
+void
+emu_set_coverage(emu_t *emu, uint8_t *map, size_t size)
+{
+	emu->cov = map;
+	emu->cov_mask = (size) ? size - 1 : 0;
+	emu->cov_prev = 0;
+	emu->cov_shift = 0;
+	emu->cov_touched = 0;
+
+	/* 64 equally sized slices */
+	while ((size >> emu->cov_shift) > 64)
+		++emu->cov_shift;
+}
+
+uint64_t
+emu_coverage_touched(emu_t *emu)
+{
+	uint64_t touched = emu->cov_touched;
+
+	emu->cov_touched = 0;
+
+	return touched;
+}
+
+void
+emu_set_profiler(emu_t *emu, prof_t *prof)
+{
+	emu->prof = prof;
+}
+
+void
+emu_set_callgraph(emu_t *emu, callgraph_t *cg)
+{
+	emu->cg = cg;
+}
+
+void
+emu_set_lcov(emu_t *emu, lcov_t *lcov)
+{
+	emu->lcov = lcov;
+}
+
+void
+emu_set_trace(emu_t *emu, trace_t *trace)
+{
+	emu->trace = trace;
+}
+
+void
+emu_set_irqstat(emu_t *emu, irqstat_t *st)
+{
+	emu->irqstat = st;
+}
+
+int
+emu_set_f_cpu(emu_t *emu, uint64_t hz)
+{
+	if (hz == 0)
+		return -1;
+
+	emu->f_cpu = hz;
+	emu->spm_prog_cycles = hz * SPM_PROG_US / 1000000;
+
+	return 0;
+}
+
+uint64_t
+emu_f_cpu(const emu_t *emu)
+{
+	return emu->f_cpu;
+}
+
+int
+emu_irq_raise(emu_t *emu, uint8_t vector)
+{
+	if (vector == 0 || vector >= emu->hw->dev->n_vectors
+			|| vector >= EMU_MAX_VECTORS)
+		return -1;
+
+	p_irq_flag(emu, vector, emu->cycles);
+	emu->irq_check = 0;
+	emu->irq_until = 0;
+
+	return 0;
+}
+
+int
+emu_irq_schedule(emu_t *emu, uint8_t vector, uint64_t first, uint64_t period)
+{
+	if (vector == 0 || vector >= emu->hw->dev->n_vectors
+			|| vector >= EMU_MAX_VECTORS)
+		return -1;
+
+	struct irq_source *srcs = realloc(emu->irq_srcs,
+			(emu->n_irq_srcs + 1) * sizeof *srcs);
+	if (srcs == NULL)
+		return -1;
+
+	srcs[emu->n_irq_srcs++] = (struct irq_source)
+	{
+		.vector = vector, .first = first, .period = period
+	};
+	emu->irq_srcs = srcs;
+
+	p_irq_rearm(emu);
+
+	return 0;
+}
+
+/* Groups that include addr have to be redone when its op changes */
+static void
+p_refuse_at(emu_t *emu, uint32_t addr)
+{
+	avr_fuse_range(emu->hw, emu->ops, (addr > 2) ? addr - 2 : 0, addr);
+}
+
+int
+emu_break_set(emu_t *emu, uint32_t addr)
+{
+	if (addr > emu->core.pcmask)
+		return -1;
+
+	if (emu->ops[addr].instr == TRAP)
+		return 0;
+
+	struct breakpoint *bps = realloc(emu->bps, (emu->n_bps + 1) * sizeof *bps);
+	if (bps == NULL)
+		return -1;
+
+	bps[emu->n_bps].addr = addr;
+	bps[emu->n_bps].op = emu->ops[addr];
+
+	emu->bps = bps;
+	++emu->n_bps;
+
+	emu->ops[addr].instr = TRAP;
+	p_refuse_at(emu, addr);
+
+	return 0;
+}
+
+int
+emu_break_clear(emu_t *emu, uint32_t addr)
+{
+	for (uint32_t i = 0; i < emu->n_bps; i++)
+	{
+		if (emu->bps[i].addr == addr)
+		{
+			emu->ops[addr] = emu->bps[i].op;
+			emu->bps[i] = emu->bps[--emu->n_bps];
+			p_refuse_at(emu, addr);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+int
+emu_watch_set(emu_t *emu, uint32_t addr, uint8_t flags)
+{
+	if (addr >= WATCH_SPACE)
+		return -1;
+
+	emu->watch[addr] = flags;
+
+	return 0;
+}
+
+uint8_t
+emu_watch_flags(const emu_t *emu, uint32_t addr)
+{
+	return (addr < WATCH_SPACE) ? emu->watch[addr] : 0;
+}
+
+uint32_t
+emu_watch_addr(const emu_t *emu)
+{
+	return emu->watch_addr;
+}
+
+/* Breakpoint and watchpoint stops are resumable; a breakpoint resumes by
+ * executing the instruction it replaced.
+ */
+static void
+p_resume(emu_t *emu)
+{
+	if (emu->exc == EMU_EXC_BREAKPOINT || emu->exc == EMU_EXC_WATCHPOINT)
+	{
+		emu->bp_resume = (emu->exc == EMU_EXC_BREAKPOINT)
+			&& (emu->ops[emu->hw->pc].instr == TRAP);
+		emu->exc = EMU_EXC_NONE;
+	}
+}
+
+/* Stopped for good, i.e. not just asleep until an interrupt */
+static bool
+p_stopped(const emu_t *emu)
+{
+	emu_stop_t stop = p_stop_reason(emu);
+
+	return stop != EMU_STOP_NONE
+		&& !(stop == EMU_STOP_SLEEP && p_irq_can_wake(emu));
+}
+
+emu_stop_t
+emu_step(emu_t *emu)
+{
+	p_resume(emu);
+
+	if (p_stopped(emu))
+		return p_stop_reason(emu);
+
+	/* A sleeping core steps straight into the interrupt that wakes it */
+	if (emu->hw->state == AVR_SLEEP && emu->irq_check > emu->cycles)
+		p_idle(emu, emu->irq_check);
+
+	if (emu->cycles >= emu->irq_check)
+		p_irq_poll(emu, emu->core);
+
+	/* A breakpoint on the stepped instruction must not stop the step */
+	if (emu->ops[emu->hw->pc].instr == TRAP)
+		emu->bp_resume = true;
+
+	p_step(emu, emu->core);
+
+	return p_stop_reason(emu);
+}
+
+emu_stop_t
+emu_run_for(emu_t *emu, uint64_t budget)
+{
+	p_resume(emu);
+
+	if (p_stopped(emu))
+		return p_stop_reason(emu);
+
+	return emu->run(emu, emu->cycles + budget);
+}
+
 int
 emu_run(emu_t *emu)
 {
@@ -1007,11 +2379,13 @@ emu_run(emu_t *emu)
 	hw_t *hw = emu->hw;
 	bool should_continue = true;
 
+	log_set_level(LOG_EMU, LOG_LVL_TRACE);
+
 	while (should_continue)
 	{
-		op_t op = avr_decode(hw, hw->pc);
+		p_step(emu, emu->core);
+		log_flush();
 
-		p_run_once(emu, op);
 		printf("PC %X\n", hw->pc);
 		printf("SP %X%X\n", hw->sp[1], hw->sp[0]);
 		printf("SREG %u%u%u%u %u%u%u%u\n",
@@ -1025,6 +2399,7 @@ emu_run(emu_t *emu)
 				hw->sreg.z);
 		data_dump(hw->data, 0, 32);
 		data_dump(hw->data, 0x800, 0x8FF);
+		fflush(stdout);
 
 		if (emu->exc != EMU_EXC_NONE || hw->state == AVR_BREAK)
 		{
@@ -1038,6 +2413,263 @@ emu_run(emu_t *emu)
 	return status; // TODO
 }
 
+/* Snapshots are told apart by ID rather than address, which a new snapshot
+ * may reuse after an old one is freed. IDs are never 0.
+ */
+static uint64_t
+p_snapshot_id(void)
+{
+	static uint64_t last;
+
+	return __atomic_add_fetch(&last, 1, __ATOMIC_RELAXED);
+}
+
+emu_snapshot_t *
+emu_snapshot(emu_t *emu)
+{
+	hw_t *hw = emu->hw;
+
+	size_t n_data = data_state_size(hw->data);
+	size_t n_eeprom = hw->e2size;
+	size_t n_flash = flash_state_size(hw->flash);
+	size_t n_page = hw->dev->spm_pagesize;
+	size_t size = sizeof(emu_snapshot_t) + n_data + n_eeprom + n_flash
+		+ n_page;
+
+	emu_snapshot_t *snap = malloc(size);
+	if (snap)
+	{
+		snap->magic = EMU_SNAPSHOT_MAGIC;
+		snap->version = EMU_SNAPSHOT_VERSION;
+		snap->size = size;
+		memcpy(snap->signature, hw->signature, sizeof snap->signature);
+		snap->flashend = hw->flashend;
+		snap->ramstart = hw->dev->ramstart + DEV_DATA_OFFSET(hw->dev->features);
+		snap->ramend = hw->ramend;
+		snap->e2size = hw->e2size;
+		snap->spm_pagesize = n_page;
+		snap->id = p_snapshot_id();
+
+		snap->pc = hw->pc;
+		memcpy(snap->sp, hw->sp, sizeof snap->sp);
+		snap->sreg = hw->sreg;
+		snap->state = hw->state;
+		snap->exc = emu->exc;
+		snap->cycles = emu->cycles;
+		snap->flash_gen = emu->flash_gen;
+		snap->irq_pending = emu->irq_pending;
+		memcpy(snap->irq_raised, emu->irq_raised, sizeof snap->irq_raised);
+
+		data_save(hw->data, snap->mem);
+		data_mark_clean(hw->data);
+		if (n_eeprom)
+			memcpy(snap->mem + n_data, hw->eeprom, n_eeprom);
+		flash_save(hw->flash, snap->mem + n_data + n_eeprom);
+		memcpy(snap->mem + n_data + n_eeprom + n_flash, emu->spm_buf, n_page);
+
+		emu->base_id = snap->id;
+	}
+
+	return snap;
+}
+
+/* Flash only changes through SPM, so it is left alone unless it has been
+ * reprogrammed since the snapshot.
+ */
+static void
+p_restore_flash(emu_t *emu, const emu_snapshot_t *snap, const uint8_t *image)
+{
+	if (snap->flash_gen == emu->flash_gen)
+		return;
+
+	flash_load(emu->hw->flash, image);
+	p_flash_changed(emu, 0, emu->hw->flashend + 1);
+
+	emu->flash_gen = snap->flash_gen;
+}
+
+int
+emu_restore(emu_t *emu, const emu_snapshot_t *snap)
+{
+	hw_t *hw = emu->hw;
+
+	size_t n_data = data_state_size(hw->data);
+	size_t n_eeprom = hw->e2size;
+	size_t n_flash = flash_state_size(hw->flash);
+	size_t n_page = hw->dev->spm_pagesize;
+
+	if (snap->magic != EMU_SNAPSHOT_MAGIC ||
+		snap->version != EMU_SNAPSHOT_VERSION ||
+		snap->size != sizeof(emu_snapshot_t) + n_data + n_eeprom + n_flash
+			+ n_page ||
+		memcmp(snap->signature, hw->signature, sizeof snap->signature) ||
+		snap->flashend != hw->flashend ||
+		snap->ramend != hw->ramend)
+	{
+		return -1;
+	}
+
+	hw->pc = snap->pc;
+	memcpy(hw->sp, snap->sp, sizeof hw->sp);
+	hw->sreg = snap->sreg;
+	hw->state = snap->state;
+	emu->exc = snap->exc;
+	emu->cycles = snap->cycles;
+	emu->irq_pending = snap->irq_pending;
+	memcpy(emu->irq_raised, snap->irq_raised, sizeof emu->irq_raised);
+	emu->irq_hold = UINT64_MAX;
+	p_irq_rearm(emu);
+
+	data_load(hw->data, snap->mem);
+	if (n_eeprom)
+		memcpy(hw->eeprom, snap->mem + n_data, n_eeprom);
+
+	p_restore_flash(emu, snap, snap->mem + n_data + n_eeprom);
+	memcpy(emu->spm_buf, snap->mem + n_data + n_eeprom + n_flash, n_page);
+
+	/* Queued host input is not machine state */
+	if (hw->usart)
+		usart_flush(hw->usart);
+
+	emu->base_id = snap->id;
+
+	return 0;
+}
+
+int
+emu_reset_to(emu_t *emu, const emu_snapshot_t *snap)
+{
+	hw_t *hw = emu->hw;
+
+	if (snap->id != emu->base_id)
+		return emu_restore(emu, snap);
+
+	size_t n_data = data_state_size(hw->data);
+	size_t n_eeprom = hw->e2size;
+	size_t n_flash = flash_state_size(hw->flash);
+
+	hw->pc = snap->pc;
+	memcpy(hw->sp, snap->sp, sizeof hw->sp);
+	hw->sreg = snap->sreg;
+	hw->state = snap->state;
+	emu->exc = snap->exc;
+	emu->cycles = snap->cycles;
+	emu->irq_pending = snap->irq_pending;
+	memcpy(emu->irq_raised, snap->irq_raised, sizeof emu->irq_raised);
+	emu->irq_hold = UINT64_MAX;
+	p_irq_rearm(emu);
+
+	data_load_dirty(hw->data, snap->mem);
+
+	/* EEPROM is not written through data_t, so it is not tracked */
+	if (n_eeprom)
+		memcpy(hw->eeprom, snap->mem + n_data, n_eeprom);
+
+	p_restore_flash(emu, snap, snap->mem + n_data + n_eeprom);
+
+	/* Neither is the page buffer, which is small */
+	memcpy(emu->spm_buf, snap->mem + n_data + n_eeprom + n_flash,
+			hw->dev->spm_pagesize);
+
+	if (hw->usart)
+		usart_flush(hw->usart);
+
+	return 0;
+}
+
+size_t
+emu_snapshot_size(const emu_snapshot_t *snap)
+{
+	return snap->size;
+}
+
+int
+emu_snapshot_write(const emu_snapshot_t *snap, const char *path)
+{
+	FILE *fp = fopen(path, "wb");
+	if (fp == NULL)
+		return -1;
+
+	size_t n = fwrite(snap, 1, snap->size, fp);
+
+	if (fclose(fp) != 0 || n != snap->size)
+		return -1;
+
+	return 0;
+}
+
+/* Bytes following the header that hold data_save()'s image, which is larger
+ * than the data space when the writer was built with USE_MEMTRACK
+ */
+static size_t
+p_snapshot_data_size(const emu_snapshot_t *snap)
+{
+	return snap->size - sizeof(emu_snapshot_t) - snap->e2size
+		- (snap->flashend + 1) - snap->spm_pagesize;
+}
+
+emu_snapshot_t *
+emu_snapshot_read(const char *path)
+{
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL)
+		return NULL;
+
+	emu_snapshot_t header;
+	emu_snapshot_t *snap = NULL;
+
+	if (fread(&header, sizeof header, 1, fp) == 1
+			&& header.magic == EMU_SNAPSHOT_MAGIC
+			&& header.version == EMU_SNAPSHOT_VERSION
+			&& header.ramstart <= header.ramend
+			&& header.size >= sizeof header + (header.ramend + 1)
+				+ header.e2size
+				+ (header.flashend + 1) + header.spm_pagesize
+			&& (snap = malloc(header.size)) != NULL)
+	{
+		size_t rest = header.size - sizeof header;
+
+		memcpy(snap, &header, sizeof header);
+		snap->id = p_snapshot_id();
+		snap->flash_gen = p_flash_gen();
+
+		if (fread(snap->mem, 1, rest, fp) != rest || fgetc(fp) != EOF)
+			emu_snapshot_destroy(&snap);
+	}
+
+	fclose(fp);
+
+	return snap;
+}
+
+void
+emu_snapshot_state(const emu_snapshot_t *snap, emu_state_t *state)
+{
+	memcpy(state->signature, snap->signature, sizeof state->signature);
+
+	state->pc = snap->pc;
+	state->sp = snap->sp[0] | (snap->sp[1] << 8);
+	state->sreg = snap->sreg;
+	state->cycles = snap->cycles;
+
+	state->ramstart = snap->ramstart;
+	state->ramend = snap->ramend;
+	state->e2size = snap->e2size;
+
+	state->data = snap->mem;
+	state->eeprom = (snap->e2size) ? snap->mem + p_snapshot_data_size(snap) : NULL;
+}
+
+void
+emu_snapshot_destroy(emu_snapshot_t **snap)
+{
+	if (*snap)
+	{
+		free(*snap);
+		*snap = NULL;
+	}
+}
+
 void
 emu_destroy(emu_t **emu)
 {
@@ -1045,7 +2677,13 @@ emu_destroy(emu_t **emu)
 
 	if (_emu)
 	{
-		_emu->hw->destroy(&_emu->hw);
+		hw_t *hw = _emu->hw;
+		hw->destroy(&hw);
+		free(_emu->ops);
+		free(_emu->bps);
+		free(_emu->watch);
+		free(_emu->spm_buf);
+		free(_emu->irq_srcs);
 		free(_emu);
 		*emu = NULL;
 	}
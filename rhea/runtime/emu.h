@@ -2,16 +2,213 @@
 #define RHEA_EMU_H
 
 #include "rhea_load.h"
+#include "hw/devices.h"
+#include "runtime/callgraph.h"
+#include "runtime/irqstat.h"
+#include "runtime/lcov.h"
+#include "runtime/prof.h"
+#include "runtime/trace.h"
+
+#include <stddef.h>
 
 typedef struct emulator emu_t;
 
+typedef enum emu_stop
+{
+	EMU_STOP_NONE = 0,
+	EMU_STOP_BREAK,
+	EMU_STOP_SLEEP,
+	EMU_STOP_CRASH,
+	EMU_STOP_SEGFAULT,
+	EMU_STOP_BUDGET,
+	EMU_STOP_BREAKPOINT,
+	EMU_STOP_WATCHPOINT
+} emu_stop_t;
+
+/* Clock a new emulator assumes, see emu_set_f_cpu() */
+#define EMU_F_CPU		16000000
+
+/* Interrupt vectors the executor can deliver, enough for every catalog part */
+#define EMU_MAX_VECTORS		64
+
+/* Watchpoint flags, checked by the data-space instructions (LD/ST/LDD/STD,
+ * PUSH/POP, IN/OUT)
+ */
+#define EMU_WATCH_READ		(1 << 0)
+#define EMU_WATCH_WRITE		(1 << 1)
+#define EMU_WATCH_CHANGE	(1 << 2)	/* writes of a different value */
+
+/* Flat, versioned image of all mutable machine state (PC, SP, SREG, register
+ * file, I/O, SRAM, EEPROM, flash, the SPM page buffer, pending interrupts and
+ * the cycle counter). The blob is self-contained and may be written to disk
+ * as-is; emu_snapshot_size() gives its length.
+ */
+typedef struct emu_snapshot emu_snapshot_t;
+
+/* Machine state held by a snapshot, see emu_snapshot_state(). Data addresses
+ * are rhea's (see DEV_DATA_OFFSET()): r0-r31 below 0x20, I/O up to ramstart
+ * and SRAM from there to ramend. SPL/SPH in data are stale, use sp.
+ */
+typedef struct emu_state
+{
+	uint8_t signature[3];
+
+	uint32_t pc;
+	uint16_t sp;
+	sreg_t sreg;
+	uint64_t cycles;
+
+	uint32_t ramstart;
+	uint32_t ramend;
+	uint32_t e2size;
+
+	const uint8_t *data;	/* [0, ramend] */
+	const uint8_t *eeprom;	/* e2size bytes, NULL without EEPROM */
+} emu_state_t;
+
 emu_t *
 emu_init(const char *mcu, chunk_t *chunks, uint32_t n);
 
 int
 emu_run(emu_t *emu);
 
+/* Runs without tracing until the core stops or at least budget cycles have
+ * elapsed.
+ */
+emu_stop_t
+emu_run_for(emu_t *emu, uint64_t budget);
+
+/* Executes exactly one instruction, ignoring a breakpoint at the current PC.
+ * Returns EMU_STOP_NONE if the core can keep running.
+ */
+emu_stop_t
+emu_step(emu_t *emu);
+
+hw_t *
+emu_hw(emu_t *emu);
+
+uint64_t
+emu_cycles(const emu_t *emu);
+
+const char *
+emu_stop_str(emu_stop_t stop);
+
+/* Counts executed instructions and cycles per PC into prof; NULL disables */
+void
+emu_set_profiler(emu_t *emu, prof_t *prof);
+
+/* Maintains a shadow call stack from CALL/RCALL/ICALL/RET; NULL disables */
+void
+emu_set_callgraph(emu_t *emu, callgraph_t *cg);
+
+/* Records executed words and branch outcomes into lcov; NULL disables */
+void
+emu_set_lcov(emu_t *emu, lcov_t *lcov);
+
+/* Streams a binary instruction/memory trace into trace; NULL disables */
+void
+emu_set_trace(emu_t *emu, trace_t *trace);
+
+/* Records interrupt latency, handler time and interrupts-disabled windows
+ * into st; NULL disables
+ */
+void
+emu_set_irqstat(emu_t *emu, irqstat_t *st);
+
+/* Sets the clock the part runs at in Hz, which converts timed operations such
+ * as SPM page programming into cycles. Returns -1 for 0 Hz.
+ */
+int
+emu_set_f_cpu(emu_t *emu, uint64_t hz);
+
+uint64_t
+emu_f_cpu(const emu_t *emu);
+
+/* Sets the interrupt flag of vector, 1 up to the device's n_vectors - 1.
+ *
+ * Pending vectors are taken lowest first between instructions while SREG.I
+ * is set, and never right after SEI or RETI: the return address is pushed, I
+ * is cleared and execution continues at the vector 4 cycles later (5 with a
+ * 22-bit PC, 4 more when waking up from SLEEP). A SLEEP that something is
+ * still scheduled to wake idles until then instead of stopping the run.
+ */
+int
+emu_irq_raise(emu_t *emu, uint8_t vector);
+
+/* Raises vector at cycle first and every period cycles after, or only once
+ * for a period of 0
+ */
+int
+emu_irq_schedule(emu_t *emu, uint8_t vector, uint64_t first, uint64_t period);
+
+/* Breakpoints stop emu_run_for() with EMU_STOP_BREAKPOINT before the
+ * instruction at the word address executes; calling emu_run_for() again
+ * executes it and continues.
+ */
+int
+emu_break_set(emu_t *emu, uint32_t addr);
+
+int
+emu_break_clear(emu_t *emu, uint32_t addr);
+
+/* Watchpoints stop with EMU_STOP_WATCHPOINT after the accessing instruction
+ * has completed. flags of 0 removes the watchpoint.
+ */
+int
+emu_watch_set(emu_t *emu, uint32_t addr, uint8_t flags);
+
+uint8_t
+emu_watch_flags(const emu_t *emu, uint32_t addr);
+
+/* Data address of the most recent watchpoint hit */
+uint32_t
+emu_watch_addr(const emu_t *emu);
+
+/* Records AFL-style edge hit counts into map on every non-sequential change
+ * of the PC. size must be a power of two; a NULL map disables coverage.
+ */
+void
+emu_set_coverage(emu_t *emu, uint8_t *map, size_t size);
+
+/* Returns and clears a mask of which 1/64th slices of the coverage map have
+ * been written since the last call, so callers only need to scan those.
+ */
+uint64_t
+emu_coverage_touched(emu_t *emu);
+
 void
 emu_destroy(emu_t **emu);
 
+emu_snapshot_t *
+emu_snapshot(emu_t *emu);
+
+int
+emu_restore(emu_t *emu, const emu_snapshot_t *snap);
+
+/* Fast path for emu_restore(): only the data blocks written since snap was
+ * taken or last restored are copied back. Falls back to emu_restore() if snap
+ * is not the emulator's current base snapshot.
+ */
+int
+emu_reset_to(emu_t *emu, const emu_snapshot_t *snap);
+
+size_t
+emu_snapshot_size(const emu_snapshot_t *snap);
+
+int
+emu_snapshot_write(const emu_snapshot_t *snap, const char *path);
+
+/* Reads a snapshot written by emu_snapshot_write(); NULL if the file is not
+ * one or comes from a different snapshot version.
+ */
+emu_snapshot_t *
+emu_snapshot_read(const char *path);
+
+/* Fills state with pointers into snap, valid for the lifetime of snap */
+void
+emu_snapshot_state(const emu_snapshot_t *snap, emu_state_t *state);
+
+void
+emu_snapshot_destroy(emu_snapshot_t **snap);
+
 #endif
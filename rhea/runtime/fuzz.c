@@ -0,0 +1,376 @@
+#include "runtime/fuzz.h"
+
+#include "hw/data.h"
+#include "hw/usart.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FUZZ_MAX_INPUT 1024
+
+struct fuzz
+{
+	emu_t *emu;
+	hw_t *hw;
+
+	fuzz_config_t cfg;
+	emu_snapshot_t *snap;
+
+	uint8_t *map;
+
+	/* State of fuzz_loop() */
+	uint8_t *virgin;
+	uint64_t rng;
+
+	uint8_t **corpus;
+	size_t *sizes;
+	size_t n_corpus;
+	size_t cap_corpus;
+};
+
+int
+fuzz_parse_source(const char *spec, fuzz_config_t *cfg)
+{
+	const char *region = NULL;
+
+	if (strcmp(spec, "usart") == 0)
+	{
+		cfg->source = FUZZ_SRC_USART;
+		return 0;
+	}
+	else if (strncmp(spec, "sram:", 5) == 0)
+	{
+		cfg->source = FUZZ_SRC_SRAM;
+		region = spec + 5;
+	}
+	else if (strncmp(spec, "eeprom:", 7) == 0)
+	{
+		cfg->source = FUZZ_SRC_EEPROM;
+		region = spec + 7;
+	}
+	else
+	{
+		return -1;
+	}
+
+	char *end;
+	cfg->addr = strtoul(region, &end, 0);
+	if (*end != ':')
+		return -1;
+
+	cfg->len = strtoul(end + 1, &end, 0);
+	if (*end != '\0' || cfg->len == 0)
+		return -1;
+
+	return 0;
+}
+
+fuzz_t *
+fuzz_init(emu_t *emu, const fuzz_config_t *cfg, uint8_t *map)
+{
+	hw_t *hw = emu_hw(emu);
+
+	if (cfg->source == FUZZ_SRC_USART && hw->usart == NULL)
+		return NULL;
+
+	if (cfg->source == FUZZ_SRC_SRAM &&
+		(cfg->addr < 32 || cfg->addr + cfg->len - 1 > hw->ramend))
+		return NULL;
+
+	if (cfg->source == FUZZ_SRC_EEPROM &&
+		cfg->addr + cfg->len > hw->e2size)
+		return NULL;
+
+	fuzz_t *fuzz = calloc(1, sizeof *fuzz);
+	if (fuzz)
+	{
+		fuzz->emu = emu;
+		fuzz->hw = hw;
+		fuzz->cfg = *cfg;
+		fuzz->map = map;
+		fuzz->snap = emu_snapshot(emu);
+
+		if (fuzz->snap == NULL)
+		{
+			free(fuzz);
+			fuzz = NULL;
+		}
+	}
+
+	return fuzz;
+}
+
+void
+fuzz_destroy(fuzz_t **fuzz)
+{
+	fuzz_t *_fuzz = *fuzz;
+
+	if (_fuzz)
+	{
+		emu_snapshot_t *snap = _fuzz->snap;
+
+		emu_set_coverage(_fuzz->emu, NULL, 0);
+		emu_snapshot_destroy(&snap);
+
+		for (size_t i = 0; i < _fuzz->n_corpus; i++)
+			free(_fuzz->corpus[i]);
+
+		free(_fuzz->corpus);
+		free(_fuzz->sizes);
+		free(_fuzz->virgin);
+		free(_fuzz);
+		*fuzz = NULL;
+	}
+}
+
+emu_stop_t
+fuzz_one(fuzz_t *fuzz, const uint8_t *input, size_t size)
+{
+	hw_t *hw = fuzz->hw;
+	const fuzz_config_t *cfg = &fuzz->cfg;
+
+	emu_reset_to(fuzz->emu, fuzz->snap);
+	emu_set_coverage(fuzz->emu, fuzz->map, FUZZ_MAP_SIZE);
+
+	switch (cfg->source)
+	{
+		case FUZZ_SRC_USART:
+			usart_feed(hw->usart, input, size);
+			break;
+		case FUZZ_SRC_SRAM:
+			/* Unused tail is zeroed so every run sees the same region */
+			for (uint32_t i = 0; i < cfg->len; i++)
+				data_write(hw->data, cfg->addr + i, (i < size) ? input[i] : 0);
+			break;
+		case FUZZ_SRC_EEPROM:
+		{
+			size_t n = (size < cfg->len) ? size : cfg->len;
+
+			memcpy(hw->eeprom + cfg->addr, input, n);
+			memset(hw->eeprom + cfg->addr + n, 0xFF, cfg->len - n);
+			break;
+		}
+	}
+
+	return emu_run_for(fuzz->emu, cfg->budget);
+}
+
+static uint64_t
+p_rand(fuzz_t *fuzz)
+{
+	/* xorshift64* */
+	fuzz->rng ^= fuzz->rng >> 12;
+	fuzz->rng ^= fuzz->rng << 25;
+	fuzz->rng ^= fuzz->rng >> 27;
+
+	return fuzz->rng * 0x2545F4914F6CDD1DULL;
+}
+
+/* AFL hit-count buckets */
+static uint8_t
+p_bucket(uint8_t hits)
+{
+	if (hits == 0) return 0;
+	if (hits == 1) return 1;
+	if (hits == 2) return 2;
+	if (hits == 3) return 4;
+	if (hits < 8) return 8;
+	if (hits < 16) return 16;
+	if (hits < 32) return 32;
+	if (hits < 128) return 64;
+	return 128;
+}
+
+/* Merges the run's hit counts into the virgin map and clears them again.
+ * Only the slices of the map the executor reports as touched are visited.
+ */
+static size_t
+p_collect_coverage(fuzz_t *fuzz)
+{
+	const size_t slice = FUZZ_MAP_SIZE / 64;
+
+	size_t found = 0;
+	uint64_t touched = emu_coverage_touched(fuzz->emu);
+
+	while (touched)
+	{
+		size_t from = __builtin_ctzll(touched) * slice;
+
+		for (size_t i = from; i < from + slice; i++)
+		{
+			if (fuzz->map[i] == 0)
+				continue;
+
+			uint8_t b = p_bucket(fuzz->map[i]);
+			if (b & ~fuzz->virgin[i])
+			{
+				fuzz->virgin[i] |= b;
+				++found;
+			}
+		}
+
+		memset(fuzz->map + from, 0, slice);
+		touched &= touched - 1;
+	}
+
+	return found;
+}
+
+static int
+p_corpus_add(fuzz_t *fuzz, const uint8_t *input, size_t size)
+{
+	if (fuzz->n_corpus == fuzz->cap_corpus)
+	{
+		size_t cap = (fuzz->cap_corpus) ? fuzz->cap_corpus * 2 : 64;
+
+		uint8_t **corpus = realloc(fuzz->corpus, cap * sizeof *corpus);
+		if (corpus == NULL)
+			return -1;
+		fuzz->corpus = corpus;
+
+		size_t *sizes = realloc(fuzz->sizes, cap * sizeof *sizes);
+		if (sizes == NULL)
+			return -1;
+		fuzz->sizes = sizes;
+
+		fuzz->cap_corpus = cap;
+	}
+
+	uint8_t *copy = malloc(size + 1);
+	if (copy == NULL)
+		return -1;
+
+	memcpy(copy, input, size);
+	fuzz->corpus[fuzz->n_corpus] = copy;
+	fuzz->sizes[fuzz->n_corpus] = size;
+	++fuzz->n_corpus;
+
+	return 0;
+}
+
+static size_t
+p_mutate(fuzz_t *fuzz, uint8_t *buf, size_t size)
+{
+	static const uint8_t INTERESTING[] = { 0x00, 0x01, 0x7F, 0x80, 0xFF, '\n' };
+
+	int rounds = 1 + p_rand(fuzz) % 4;
+
+	while (rounds--)
+	{
+		size_t pos = (size) ? p_rand(fuzz) % size : 0;
+
+		switch (p_rand(fuzz) % 5)
+		{
+			case 0:
+				if (size)
+					buf[pos] ^= 1 << (p_rand(fuzz) % 8);
+				break;
+			case 1:
+				if (size)
+					buf[pos] = p_rand(fuzz);
+				break;
+			case 2:
+				if (size < FUZZ_MAX_INPUT)
+				{
+					memmove(buf + pos + 1, buf + pos, size - pos);
+					buf[pos] = p_rand(fuzz);
+					++size;
+				}
+				break;
+			case 3:
+				if (size)
+				{
+					memmove(buf + pos, buf + pos + 1, size - pos - 1);
+					--size;
+				}
+				break;
+			case 4:
+				if (size)
+					buf[pos] = INTERESTING[p_rand(fuzz) % sizeof INTERESTING];
+				break;
+		}
+	}
+
+	return size;
+}
+
+static void
+p_save_crash(uint64_t run, emu_stop_t stop, const uint8_t *input, size_t size)
+{
+	char path[64];
+	snprintf(path, sizeof path, "crash-%s-%06" PRIu64 ".bin",
+			(stop == EMU_STOP_SEGFAULT) ? "segv" : "undef", run);
+
+	FILE *fp = fopen(path, "wb");
+	if (fp)
+	{
+		fwrite(input, 1, size, fp);
+		fclose(fp);
+	}
+
+	fprintf(stderr, "fuzz: crash in run %" PRIu64 " saved to %s\n", run, path);
+}
+
+int
+fuzz_loop(fuzz_t *fuzz, uint64_t runs, uint64_t seed)
+{
+	int crashes = 0;
+	size_t edges = 0;
+
+	uint8_t buf[FUZZ_MAX_INPUT + 1];
+	struct timespec t0, t1;
+
+	fuzz->rng = (seed) ? seed : 0x9E3779B97F4A7C15ULL;
+
+	if (fuzz->virgin == NULL)
+	{
+		fuzz->virgin = calloc(FUZZ_MAP_SIZE, 1);
+		if (fuzz->virgin == NULL)
+			return -1;
+	}
+
+	if (fuzz->n_corpus == 0 && p_corpus_add(fuzz, (const uint8_t *) "", 0) == -1)
+		return -1;
+
+	memset(fuzz->map, 0, FUZZ_MAP_SIZE);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (uint64_t run = 0; run < runs; run++)
+	{
+		size_t pick = p_rand(fuzz) % fuzz->n_corpus;
+		size_t size = fuzz->sizes[pick];
+
+		memcpy(buf, fuzz->corpus[pick], size);
+		size = p_mutate(fuzz, buf, size);
+
+		emu_stop_t stop = fuzz_one(fuzz, buf, size);
+		size_t found = p_collect_coverage(fuzz);
+
+		if (stop == EMU_STOP_CRASH || stop == EMU_STOP_SEGFAULT)
+		{
+			p_save_crash(run, stop, buf, size);
+			++crashes;
+		}
+		else if (found)
+		{
+			edges += found;
+			p_corpus_add(fuzz, buf, size);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	printf("fuzz: %" PRIu64 " runs in %.2fs (%.0f exec/s), "
+			"corpus %zu, coverage %zu, crashes %d\n",
+			runs, secs, (secs > 0) ? runs / secs : 0.0,
+			fuzz->n_corpus, edges, crashes);
+
+	return crashes;
+}
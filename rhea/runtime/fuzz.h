@@ -0,0 +1,59 @@
+#ifndef RHEA_FUZZ_H
+#define RHEA_FUZZ_H
+
+#include "runtime/emu.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FUZZ_MAP_SIZE (1 << 16)
+
+typedef enum fuzz_source
+{
+	FUZZ_SRC_USART = 0,
+	FUZZ_SRC_SRAM,
+	FUZZ_SRC_EEPROM
+} fuzz_source_t;
+
+typedef struct fuzz_config
+{
+	fuzz_source_t source;
+
+	/* Target region for FUZZ_SRC_SRAM/FUZZ_SRC_EEPROM */
+	uint32_t addr;
+	uint32_t len;
+
+	/* Cycle budget per execution */
+	uint64_t budget;
+} fuzz_config_t;
+
+typedef struct fuzz fuzz_t;
+
+/* Parses "usart", "sram:ADDR:LEN" or "eeprom:ADDR:LEN" */
+int
+fuzz_parse_source(const char *spec, fuzz_config_t *cfg);
+
+/* Takes the snapshot every execution starts from, i.e. the emulator should
+ * already be at the point where input is consumed. Coverage is written into
+ * map, which must hold FUZZ_MAP_SIZE bytes.
+ */
+fuzz_t *
+fuzz_init(emu_t *emu, const fuzz_config_t *cfg, uint8_t *map);
+
+void
+fuzz_destroy(fuzz_t **fuzz);
+
+/* Restores the snapshot, injects input and runs until BREAK, SLEEP, a crash
+ * or the cycle budget. Same contract as LLVMFuzzerTestOneInput() except that
+ * the stop reason is returned.
+ */
+emu_stop_t
+fuzz_one(fuzz_t *fuzz, const uint8_t *input, size_t size);
+
+/* Built-in coverage-guided loop; crashing inputs are written to the current
+ * directory. Returns the number of crashes found.
+ */
+int
+fuzz_loop(fuzz_t *fuzz, uint64_t runs, uint64_t seed);
+
+#endif
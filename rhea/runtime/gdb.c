@@ -0,0 +1,768 @@
+#include "runtime/gdb.h"
+
+#include "rhea_log.h"
+#include "hw/data.h"
+#include "hw/flash.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define GDB_BUF_SIZE	4096
+
+/* Cycles executed between checks for a Ctrl-C from the debugger */
+#define GDB_SLICE	100000
+
+#define GDB_DATA_BASE	0x800000
+#define GDB_EEPROM_BASE	0x810000
+#define GDB_EEPROM_END	0x820000
+
+#define GDB_REG_SREG	32
+#define GDB_REG_SP	33
+#define GDB_REG_PC	34
+
+#define GDB_SIGINT	2
+#define GDB_SIGILL	4
+#define GDB_SIGTRAP	5
+#define GDB_SIGSEGV	11
+
+struct gdb
+{
+	emu_t *emu;
+	int fd;
+
+	uint8_t in[GDB_BUF_SIZE];
+	size_t in_pos;
+	size_t in_len;
+
+	char pkt[GDB_BUF_SIZE];
+	char reply[GDB_BUF_SIZE];
+
+	emu_stop_t last;
+	bool interrupted;
+};
+
+static const char HEX[] = "0123456789abcdef";
+
+static int
+p_listen(const char *where)
+{
+	int fd = -1;
+	bool is_port = *where && strspn(where, "0123456789") == strlen(where);
+
+	if (is_port)
+	{
+		struct sockaddr_in addr = { 0 };
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(atoi(where));
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		int one = 1;
+		if ((fd = socket(AF_INET, SOCK_STREAM, 0)) != -1)
+		{
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+			if (bind(fd, (struct sockaddr *) &addr, sizeof addr) == -1)
+			{
+				close(fd);
+				fd = -1;
+			}
+		}
+	}
+	else
+	{
+		struct sockaddr_un addr = { 0 };
+		addr.sun_family = AF_UNIX;
+
+		if (strlen(where) >= sizeof addr.sun_path)
+			return -1;
+		strcpy(addr.sun_path, where);
+
+		unlink(where);
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) != -1
+				&& bind(fd, (struct sockaddr *) &addr, sizeof addr) == -1)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	if (fd != -1 && listen(fd, 1) == -1)
+	{
+		close(fd);
+		fd = -1;
+	}
+
+	return fd;
+}
+
+static int
+p_getc(struct gdb *gdb)
+{
+	if (gdb->in_pos == gdb->in_len)
+	{
+		ssize_t n = recv(gdb->fd, gdb->in, sizeof gdb->in, 0);
+		if (n <= 0)
+			return -1;
+
+		gdb->in_pos = 0;
+		gdb->in_len = n;
+	}
+
+	return gdb->in[gdb->in_pos++];
+}
+
+/* Non-blocking check for the 0x03 interrupt byte while the target runs */
+static bool
+p_poll_interrupt(struct gdb *gdb)
+{
+	struct pollfd pfd = { .fd = gdb->fd, .events = POLLIN };
+
+	while (gdb->in_pos == gdb->in_len && poll(&pfd, 1, 0) > 0)
+	{
+		if (p_getc(gdb) == -1)
+			return true;
+		--gdb->in_pos;
+	}
+
+	while (gdb->in_pos < gdb->in_len)
+	{
+		if (gdb->in[gdb->in_pos++] == 0x03)
+			return true;
+	}
+
+	return false;
+}
+
+static int
+p_send(struct gdb *gdb, const char *data, size_t len)
+{
+	while (len)
+	{
+		ssize_t n = send(gdb->fd, data, len, MSG_NOSIGNAL);
+		if (n <= 0)
+			return -1;
+
+		data += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int
+p_send_packet(struct gdb *gdb, const char *data)
+{
+	size_t len = strlen(data);
+	uint8_t sum = 0;
+
+	for (size_t i = 0; i < len; i++)
+		sum += data[i];
+
+	char tail[3] = { '#', HEX[sum >> 4], HEX[sum & 0xF] };
+
+	for (;;)
+	{
+		if (p_send(gdb, "$", 1) == -1
+				|| p_send(gdb, data, len) == -1
+				|| p_send(gdb, tail, sizeof tail) == -1)
+			return -1;
+
+		int ack = p_getc(gdb);
+		if (ack == '+')
+			return 0;
+		else if (ack != '-')
+			return -1;
+	}
+}
+
+static int
+p_hex(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+/* Reads one packet into gdb->pkt and acknowledges it. Returns its length, or
+ * -1 once the connection is gone.
+ */
+static int
+p_read_packet(struct gdb *gdb)
+{
+	for (;;)
+	{
+		int c;
+		while ((c = p_getc(gdb)) != '$')
+		{
+			if (c == -1)
+				return -1;
+		}
+
+		size_t len = 0;
+		uint8_t sum = 0;
+
+		while ((c = p_getc(gdb)) != '#')
+		{
+			if (c == -1)
+				return -1;
+
+			if (len < sizeof gdb->pkt - 1)
+				gdb->pkt[len++] = c;
+			sum += c;
+		}
+
+		int hi = p_hex(p_getc(gdb));
+		int lo = p_hex(p_getc(gdb));
+
+		if (hi == -1 || lo == -1 || ((hi << 4) | lo) != sum)
+		{
+			if (p_send(gdb, "-", 1) == -1)
+				return -1;
+			continue;
+		}
+
+		gdb->pkt[len] = '\0';
+
+		return (p_send(gdb, "+", 1) == -1) ? -1 : (int) len;
+	}
+}
+
+static char *
+p_put_byte(char *out, uint8_t byte)
+{
+	*out++ = HEX[byte >> 4];
+	*out++ = HEX[byte & 0xF];
+
+	return out;
+}
+
+static int
+p_get_byte(const char **in)
+{
+	int hi = p_hex((*in)[0]);
+	int lo = (hi == -1) ? -1 : p_hex((*in)[1]);
+
+	if (lo == -1)
+		return -1;
+
+	*in += 2;
+
+	return (hi << 4) | lo;
+}
+
+/* sreg_t is a bit-field in declaration order; gdb wants the SREG layout */
+static uint8_t
+p_sreg_pack(const sreg_t *sreg)
+{
+	return (sreg->i << 7) | (sreg->t << 6) | (sreg->h << 5) | (sreg->s << 4)
+		| (sreg->v << 3) | (sreg->n << 2) | (sreg->z << 1) | sreg->c;
+}
+
+static void
+p_sreg_unpack(sreg_t *sreg, uint8_t val)
+{
+	sreg->i = val >> 7;
+	sreg->t = val >> 6;
+	sreg->h = val >> 5;
+	sreg->s = val >> 4;
+	sreg->v = val >> 3;
+	sreg->n = val >> 2;
+	sreg->z = val >> 1;
+	sreg->c = val;
+}
+
+/* Register n as little-endian bytes, returns its width */
+static int
+p_reg_read(const hw_t *hw, unsigned n, uint8_t bytes[static 4])
+{
+	uint32_t pc = hw->pc * 2;
+
+	if (n < 32)
+	{
+		bytes[0] = data_peek(hw->data, n);
+		return 1;
+	}
+
+	switch (n)
+	{
+		case GDB_REG_SREG:
+			bytes[0] = p_sreg_pack(&hw->sreg);
+			return 1;
+		case GDB_REG_SP:
+			bytes[0] = hw->sp[0];
+			bytes[1] = hw->sp[1];
+			return 2;
+		case GDB_REG_PC:
+			for (int i = 0; i < 4; i++)
+				bytes[i] = pc >> (8 * i);
+			return 4;
+		default:
+			return -1;
+	}
+}
+
+static int
+p_reg_write(hw_t *hw, unsigned n, const uint8_t bytes[static 4])
+{
+	if (n < 32)
+	{
+		data_write(hw->data, n, bytes[0]);
+		return 1;
+	}
+
+	switch (n)
+	{
+		case GDB_REG_SREG:
+			p_sreg_unpack(&hw->sreg, bytes[0]);
+			return 1;
+		case GDB_REG_SP:
+			hw->sp[0] = bytes[0];
+			hw->sp[1] = bytes[1];
+			return 2;
+		case GDB_REG_PC:
+		{
+			uint32_t pc = bytes[0] | (bytes[1] << 8)
+				| (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+			hw->pc = (pc / 2) & (hw->flashend >> 1);
+			return 4;
+		}
+		default:
+			return -1;
+	}
+}
+
+static int
+p_mem_read(const hw_t *hw, uint32_t addr, uint8_t *byte)
+{
+	if (addr >= GDB_EEPROM_BASE && addr < GDB_EEPROM_END)
+	{
+		addr -= GDB_EEPROM_BASE;
+		if (addr >= hw->e2size)
+			return -1;
+		*byte = hw->eeprom[addr];
+	}
+	else if (addr >= GDB_DATA_BASE)
+	{
+		addr -= GDB_DATA_BASE;
+		if (addr > hw->ramend)
+			return -1;
+		*byte = data_peek(hw->data, addr);
+	}
+	else
+	{
+		if (addr > hw->flashend)
+			return -1;
+		uint16_t word = flash_peek_word(hw->flash, addr / 2);
+		*byte = (addr & 1) ? word >> 8 : word;
+	}
+
+	return 0;
+}
+
+/* Flash is read-only for the debugger; breakpoints use Z packets */
+static int
+p_mem_write(hw_t *hw, uint32_t addr, uint8_t byte)
+{
+	if (addr >= GDB_EEPROM_BASE && addr < GDB_EEPROM_END)
+	{
+		addr -= GDB_EEPROM_BASE;
+		if (addr >= hw->e2size)
+			return -1;
+		hw->eeprom[addr] = byte;
+	}
+	else if (addr >= GDB_DATA_BASE)
+	{
+		addr -= GDB_DATA_BASE;
+		if (addr > hw->ramend)
+			return -1;
+		data_write(hw->data, addr, byte);
+	}
+	else
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+p_stop_reply(struct gdb *gdb, emu_stop_t stop)
+{
+	int sig = GDB_SIGTRAP;
+
+	if (gdb->interrupted)
+		sig = GDB_SIGINT;
+	else if (stop == EMU_STOP_CRASH)
+		sig = GDB_SIGILL;
+	else if (stop == EMU_STOP_SEGFAULT)
+		sig = GDB_SIGSEGV;
+
+	if (stop == EMU_STOP_WATCHPOINT && !gdb->interrupted)
+	{
+		uint32_t addr = emu_watch_addr(gdb->emu);
+		uint8_t flags = emu_watch_flags(gdb->emu, addr);
+
+		const char *kind = "watch";
+		if ((flags & EMU_WATCH_READ) && (flags & EMU_WATCH_WRITE))
+			kind = "awatch";
+		else if (flags & EMU_WATCH_READ)
+			kind = "rwatch";
+
+		snprintf(gdb->reply, sizeof gdb->reply, "T%02x%s:%x;",
+				sig, kind, addr + GDB_DATA_BASE);
+	}
+	else
+	{
+		snprintf(gdb->reply, sizeof gdb->reply, "S%02x", sig);
+	}
+}
+
+/* A BREAK instruction or SLEEP parks the core; continuing from the debugger
+ * resumes it at the next instruction.
+ */
+static void
+p_wake(hw_t *hw)
+{
+	if (hw->state != AVR_NORMAL)
+		hw->state = AVR_NORMAL;
+}
+
+static emu_stop_t
+p_continue(struct gdb *gdb)
+{
+	emu_stop_t stop;
+
+	p_wake(emu_hw(gdb->emu));
+
+	while ((stop = emu_run_for(gdb->emu, GDB_SLICE)) == EMU_STOP_BUDGET)
+	{
+		if (p_poll_interrupt(gdb))
+		{
+			gdb->interrupted = true;
+			break;
+		}
+	}
+
+	return stop;
+}
+
+static void
+p_cmd_regs(struct gdb *gdb)
+{
+	hw_t *hw = emu_hw(gdb->emu);
+	char *out = gdb->reply;
+
+	for (unsigned n = 0; n <= GDB_REG_PC; n++)
+	{
+		uint8_t bytes[4];
+		int width = p_reg_read(hw, n, bytes);
+
+		for (int i = 0; i < width; i++)
+			out = p_put_byte(out, bytes[i]);
+	}
+
+	*out = '\0';
+}
+
+static void
+p_cmd_write_regs(struct gdb *gdb, const char *in)
+{
+	hw_t *hw = emu_hw(gdb->emu);
+
+	for (unsigned n = 0; n <= GDB_REG_PC && *in; n++)
+	{
+		uint8_t bytes[4] = { 0 };
+		uint8_t tmp[4];
+		int width = p_reg_read(hw, n, tmp);
+
+		for (int i = 0; i < width; i++)
+		{
+			int b = p_get_byte(&in);
+			if (b == -1)
+			{
+				strcpy(gdb->reply, "E01");
+				return;
+			}
+			bytes[i] = b;
+		}
+
+		p_reg_write(hw, n, bytes);
+	}
+
+	strcpy(gdb->reply, "OK");
+}
+
+static void
+p_cmd_reg(struct gdb *gdb, const char *in)
+{
+	uint8_t bytes[4];
+	int width = p_reg_read(emu_hw(gdb->emu), strtoul(in, NULL, 16), bytes);
+
+	if (width == -1)
+	{
+		strcpy(gdb->reply, "E01");
+		return;
+	}
+
+	char *out = gdb->reply;
+	for (int i = 0; i < width; i++)
+		out = p_put_byte(out, bytes[i]);
+	*out = '\0';
+}
+
+static void
+p_cmd_write_reg(struct gdb *gdb, const char *in)
+{
+	char *end;
+	unsigned n = strtoul(in, &end, 16);
+	uint8_t bytes[4] = { 0 };
+	uint8_t tmp[4];
+
+	int width = p_reg_read(emu_hw(gdb->emu), n, tmp);
+	if (*end != '=' || width == -1)
+	{
+		strcpy(gdb->reply, "E01");
+		return;
+	}
+
+	in = end + 1;
+	for (int i = 0; i < width; i++)
+	{
+		int b = p_get_byte(&in);
+		if (b == -1)
+		{
+			strcpy(gdb->reply, "E01");
+			return;
+		}
+		bytes[i] = b;
+	}
+
+	p_reg_write(emu_hw(gdb->emu), n, bytes);
+	strcpy(gdb->reply, "OK");
+}
+
+static void
+p_cmd_mem(struct gdb *gdb, const char *in)
+{
+	char *end;
+	uint32_t addr = strtoul(in, &end, 16);
+	uint32_t len = (*end == ',') ? strtoul(end + 1, NULL, 16) : 0;
+
+	if (len > (sizeof gdb->reply - 1) / 2)
+		len = (sizeof gdb->reply - 1) / 2;
+
+	char *out = gdb->reply;
+	for (uint32_t i = 0; i < len; i++)
+	{
+		uint8_t byte;
+		if (p_mem_read(emu_hw(gdb->emu), addr + i, &byte) == -1)
+			break;
+		out = p_put_byte(out, byte);
+	}
+
+	if (out == gdb->reply && len)
+		strcpy(gdb->reply, "E01");
+	else
+		*out = '\0';
+}
+
+static void
+p_cmd_write_mem(struct gdb *gdb, const char *in)
+{
+	char *end;
+	uint32_t addr = strtoul(in, &end, 16);
+	uint32_t len = (*end == ',') ? strtoul(end + 1, &end, 16) : 0;
+
+	if (*end != ':')
+	{
+		strcpy(gdb->reply, "E01");
+		return;
+	}
+
+	in = end + 1;
+	for (uint32_t i = 0; i < len; i++)
+	{
+		int b = p_get_byte(&in);
+		if (b == -1 || p_mem_write(emu_hw(gdb->emu), addr + i, b) == -1)
+		{
+			strcpy(gdb->reply, "E01");
+			return;
+		}
+	}
+
+	strcpy(gdb->reply, "OK");
+}
+
+/* Z/z packets: type 0/1 are breakpoints, 2/3/4 write/read/access watches */
+static void
+p_cmd_point(struct gdb *gdb, const char *in, bool insert)
+{
+	char *end;
+	unsigned type = strtoul(in, &end, 16);
+	uint32_t addr = (*end == ',') ? strtoul(end + 1, &end, 16) : 0;
+	uint32_t len = (*end == ',') ? strtoul(end + 1, &end, 16) : 1;
+
+	int status = 0;
+
+	if (type <= 1)
+	{
+		status = insert ? emu_break_set(gdb->emu, addr / 2)
+			: emu_break_clear(gdb->emu, addr / 2);
+	}
+	else if (type <= 4 && addr >= GDB_DATA_BASE && addr < GDB_EEPROM_BASE)
+	{
+		uint8_t kind = (type == 2) ? EMU_WATCH_WRITE
+			: (type == 3) ? EMU_WATCH_READ
+			: EMU_WATCH_READ | EMU_WATCH_WRITE;
+
+		addr -= GDB_DATA_BASE;
+		for (uint32_t i = 0; i < len && status == 0; i++)
+		{
+			uint8_t flags = emu_watch_flags(gdb->emu, addr + i);
+			flags = insert ? (flags | kind) : (flags & ~kind);
+			status = emu_watch_set(gdb->emu, addr + i, flags);
+		}
+	}
+	else
+	{
+		/* Unsupported type, empty reply */
+		gdb->reply[0] = '\0';
+		return;
+	}
+
+	strcpy(gdb->reply, (status == 0) ? "OK" : "E01");
+}
+
+/* Returns false once the session is over */
+static bool
+p_dispatch(struct gdb *gdb)
+{
+	const char *pkt = gdb->pkt;
+
+	gdb->reply[0] = '\0';
+
+	switch (pkt[0])
+	{
+		case '?':
+			p_stop_reply(gdb, gdb->last);
+			break;
+		case 'g':
+			p_cmd_regs(gdb);
+			break;
+		case 'G':
+			p_cmd_write_regs(gdb, pkt + 1);
+			break;
+		case 'p':
+			p_cmd_reg(gdb, pkt + 1);
+			break;
+		case 'P':
+			p_cmd_write_reg(gdb, pkt + 1);
+			break;
+		case 'm':
+			p_cmd_mem(gdb, pkt + 1);
+			break;
+		case 'M':
+			p_cmd_write_mem(gdb, pkt + 1);
+			break;
+		case 'Z':
+		case 'z':
+			p_cmd_point(gdb, pkt + 1, pkt[0] == 'Z');
+			break;
+		case 'c':
+		case 's':
+		{
+			hw_t *hw = emu_hw(gdb->emu);
+			if (pkt[1])
+				hw->pc = (strtoul(pkt + 1, NULL, 16) / 2) & (hw->flashend >> 1);
+
+			gdb->interrupted = false;
+			if (pkt[0] == 'c')
+			{
+				gdb->last = p_continue(gdb);
+			}
+			else
+			{
+				p_wake(hw);
+				gdb->last = emu_step(gdb->emu);
+			}
+
+			log_flush();
+			p_stop_reply(gdb, gdb->last);
+			break;
+		}
+		case 'H':
+			strcpy(gdb->reply, "OK");
+			break;
+		case 'q':
+			if (strncmp(pkt, "qSupported", 10) == 0)
+				snprintf(gdb->reply, sizeof gdb->reply, "PacketSize=%x",
+						GDB_BUF_SIZE - 1);
+			else if (strcmp(pkt, "qAttached") == 0)
+				strcpy(gdb->reply, "1");
+			break;
+		case 'D':
+			p_send_packet(gdb, "OK");
+			return false;
+		case 'k':
+			return false;
+		default:
+			break;
+	}
+
+	return p_send_packet(gdb, gdb->reply) == 0;
+}
+
+int
+gdb_serve(emu_t *emu, const char *where)
+{
+	int lfd = p_listen(where);
+	if (lfd == -1)
+	{
+		LOG_ERROR(LOG_EMU, "cannot listen for gdb on %s", where);
+		return -1;
+	}
+
+	struct gdb *gdb = malloc(sizeof *gdb);
+	if (gdb == NULL)
+	{
+		close(lfd);
+		return -1;
+	}
+
+	gdb->emu = emu;
+	gdb->in_pos = gdb->in_len = 0;
+	gdb->last = EMU_STOP_NONE;
+	gdb->interrupted = false;
+
+	gdb->fd = accept(lfd, NULL, NULL);
+	close(lfd);
+
+	int status = -1;
+	if (gdb->fd != -1)
+	{
+		while (p_read_packet(gdb) != -1 && p_dispatch(gdb))
+			;
+
+		close(gdb->fd);
+		status = 0;
+	}
+
+	if (where[strspn(where, "0123456789")] != '\0')
+		unlink(where);
+
+	free(gdb);
+
+	return status;
+}
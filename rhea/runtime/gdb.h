@@ -0,0 +1,17 @@
+#ifndef RHEA_GDB_H
+#define RHEA_GDB_H
+
+#include "runtime/emu.h"
+
+/* GDB remote serial protocol stub using avr-gdb's memory map: flash at 0,
+ * data space at 0x800000 and EEPROM at 0x810000. The register file is
+ * r0-r31, SREG, SP and a 32-bit byte-addressed PC.
+ *
+ * where is either a TCP port, which is bound to 127.0.0.1 only, or the path
+ * of a unix socket. A single debugger session is served; the target runs
+ * freely between stops and can be interrupted with Ctrl-C.
+ */
+int
+gdb_serve(emu_t *emu, const char *where);
+
+#endif
@@ -0,0 +1,85 @@
+#include "runtime/hist.h"
+
+#include <inttypes.h>
+
+static uint32_t
+p_bucket(uint64_t val)
+{
+	if (val < HIST_SUB)
+		return val;
+
+	unsigned shift = 63 - __builtin_clzll(val) - HIST_SUB_BITS;
+
+	return shift * HIST_SUB + (val >> shift);
+}
+
+static uint64_t
+p_bucket_from(uint32_t bucket)
+{
+	if (bucket < HIST_SUB)
+		return bucket;
+
+	unsigned shift = bucket / HIST_SUB - 1;
+
+	return (uint64_t) (bucket % HIST_SUB + HIST_SUB) << shift;
+}
+
+static uint64_t
+p_bucket_to(uint32_t bucket)
+{
+	if (bucket < HIST_SUB)
+		return bucket;
+
+	unsigned shift = bucket / HIST_SUB - 1;
+
+	return p_bucket_from(bucket) + ((uint64_t) 1 << shift) - 1;
+}
+
+void
+hist_add(hist_t *hist, uint64_t val)
+{
+	if (hist->count == 0 || val < hist->min)
+		hist->min = val;
+	if (val > hist->max)
+		hist->max = val;
+
+	++hist->count;
+	hist->sum += val;
+	++hist->buckets[p_bucket(val)];
+}
+
+uint64_t
+hist_percentile(const hist_t *hist, double pct)
+{
+	if (hist->count == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t) (pct / 100 * hist->count + 0.5);
+	uint64_t seen = 0;
+
+	if (rank == 0)
+		rank = 1;
+
+	for (uint32_t b = 0; b < HIST_BUCKETS; b++)
+	{
+		seen += hist->buckets[b];
+
+		if (seen >= rank)
+			return (p_bucket_to(b) < hist->max) ? p_bucket_to(b) : hist->max;
+	}
+
+	return hist->max;
+}
+
+void
+hist_write(const hist_t *hist, const char *name, FILE *fp)
+{
+	fprintf(fp, "# %s: %" PRIu64 " samples\n", name, hist->count);
+
+	for (uint32_t b = 0; b < HIST_BUCKETS; b++)
+	{
+		if (hist->buckets[b])
+			fprintf(fp, "%" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+					p_bucket_from(b), p_bucket_to(b), hist->buckets[b]);
+	}
+}
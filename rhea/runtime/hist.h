@@ -0,0 +1,40 @@
+#ifndef RHEA_HIST_H
+#define RHEA_HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Log-linear histogram of cycle counts. Values below HIST_SUB are counted
+ * exactly; above that every power of two is split into HIST_SUB buckets, so
+ * a bucket is never wider than 1/HIST_SUB of the values in it.
+ */
+#define HIST_SUB_BITS	4
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct hist
+{
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+
+	uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+void
+hist_add(hist_t *hist, uint64_t val);
+
+/* Upper bound of the bucket holding the pct-th percentile, capped at max;
+ * 0 for an empty histogram.
+ */
+uint64_t
+hist_percentile(const hist_t *hist, double pct);
+
+/* One "<from> <to> <count>" line per non-empty bucket, after a header line
+ * naming the histogram
+ */
+void
+hist_write(const hist_t *hist, const char *name, FILE *fp);
+
+#endif
@@ -0,0 +1,257 @@
+#include "runtime/irqstat.h"
+
+#include "runtime/hist.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct irq_vector
+{
+	hist_t latency;
+	hist_t duration;	/* including nested handlers */
+
+	uint64_t busy;		/* excluding nested handlers */
+	unsigned max_depth;
+};
+
+struct irq_frame
+{
+	uint8_t vector;
+	uint64_t start;
+	uint64_t since;		/* last (re)entry, for busy */
+};
+
+struct irqstat
+{
+	struct irq_vector *vectors;
+	uint8_t n_vectors;
+
+	struct irq_frame *stack;
+	uint32_t depth;
+	uint32_t cap_stack;
+
+	uint64_t first;
+	uint64_t last;
+
+	/* Windows with SREG.I clear; one opened before we were attached is not
+	 * counted since its start is unknown.
+	 */
+	hist_t disabled;
+	bool is_disabled;
+	uint32_t disabled_pc;
+	uint64_t disabled_since;
+
+	uint64_t longest;
+	uint32_t longest_pc;
+};
+
+irqstat_t *
+irqstat_init(uint8_t n_vectors, uint64_t now)
+{
+	irqstat_t *st = calloc(1, sizeof *st);
+	if (st == NULL)
+		return NULL;
+
+	st->vectors = calloc(n_vectors, sizeof *st->vectors);
+	if (st->vectors == NULL)
+	{
+		free(st);
+		return NULL;
+	}
+
+	st->n_vectors = n_vectors;
+	st->first = now;
+	st->last = now;
+
+	return st;
+}
+
+void
+irqstat_destroy(irqstat_t **st)
+{
+	irqstat_t *_st = *st;
+
+	if (_st)
+	{
+		free(_st->vectors);
+		free(_st->stack);
+		free(_st);
+		*st = NULL;
+	}
+}
+
+void
+irqstat_enter(irqstat_t *st, uint8_t vector, uint64_t raised, uint64_t start,
+		uint64_t now)
+{
+	if (st->depth == st->cap_stack)
+	{
+		uint32_t cap = (st->cap_stack) ? st->cap_stack * 2 : 8;
+		struct irq_frame *stack = realloc(st->stack, cap * sizeof *stack);
+		if (stack == NULL)
+			return;
+
+		st->stack = stack;
+		st->cap_stack = cap;
+	}
+
+	if (st->depth)
+	{
+		struct irq_frame *top = &st->stack[st->depth - 1];
+
+		st->vectors[top->vector].busy += start - top->since;
+	}
+
+	struct irq_vector *vec = &st->vectors[vector];
+
+	st->stack[st->depth++] = (struct irq_frame)
+	{
+		.vector = vector, .start = start, .since = start
+	};
+
+	hist_add(&vec->latency, now - raised);
+
+	if (st->depth > vec->max_depth)
+		vec->max_depth = st->depth;
+}
+
+void
+irqstat_reti(irqstat_t *st, uint64_t now)
+{
+	/* A RETI without a vector taken, e.g. used as a plain return */
+	if (st->depth == 0)
+		return;
+
+	struct irq_frame *frame = &st->stack[--st->depth];
+	struct irq_vector *vec = &st->vectors[frame->vector];
+
+	vec->busy += now - frame->since;
+	hist_add(&vec->duration, now - frame->start);
+
+	if (st->depth)
+		st->stack[st->depth - 1].since = now;
+}
+
+void
+irqstat_disable(irqstat_t *st, uint32_t pc, uint64_t now)
+{
+	st->is_disabled = true;
+	st->disabled_pc = pc;
+	st->disabled_since = now;
+}
+
+void
+irqstat_enable(irqstat_t *st, uint64_t now)
+{
+	if (!st->is_disabled)
+		return;
+
+	uint64_t window = now - st->disabled_since;
+
+	hist_add(&st->disabled, window);
+
+	if (window > st->longest)
+	{
+		st->longest = window;
+		st->longest_pc = st->disabled_pc;
+	}
+
+	st->is_disabled = false;
+}
+
+void
+irqstat_finish(irqstat_t *st, uint64_t now)
+{
+	if (st->depth)
+	{
+		struct irq_frame *top = &st->stack[st->depth - 1];
+
+		st->vectors[top->vector].busy += now - top->since;
+		top->since = now;
+	}
+
+	st->last = now;
+}
+
+static void
+p_write_name(const symtab_t *symtab, uint32_t pc, FILE *fp)
+{
+	const elf_sym_t *sym = symtab_lookup(symtab, pc * 2);
+
+	if (sym && sym->addr == pc * 2)
+		fprintf(fp, "0x%04" PRIX32 " (%s)", pc * 2, sym->name);
+	else if (sym)
+		fprintf(fp, "0x%04" PRIX32 " (%s+0x%" PRIX32 ")", pc * 2, sym->name,
+				pc * 2 - sym->addr);
+	else
+		fprintf(fp, "0x%04" PRIX32, pc * 2);
+}
+
+void
+irqstat_write_summary(const irqstat_t *st, const symtab_t *symtab, FILE *fp)
+{
+	uint64_t total = st->last - st->first;
+
+	fprintf(fp, "# %4s %8s %8s %8s %8s %8s %8s %8s %8s %8s %4s %7s\n",
+			"vec", "taken", "lat.min", "lat.avg", "lat.p99", "lat.max",
+			"dur.min", "dur.avg", "dur.p99", "dur.max", "nest", "cpu%");
+
+	for (uint8_t v = 0; v < st->n_vectors; v++)
+	{
+		const struct irq_vector *vec = &st->vectors[v];
+		const hist_t *lat = &vec->latency;
+		const hist_t *dur = &vec->duration;
+
+		if (lat->count == 0)
+			continue;
+
+		fprintf(fp, "  %4u %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64
+				" %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64
+				" %8" PRIu64 " %4u %7.3f\n",
+				v, lat->count, lat->min, lat->sum / lat->count,
+				hist_percentile(lat, 99), lat->max,
+				dur->min, (dur->count) ? dur->sum / dur->count : 0,
+				hist_percentile(dur, 99), dur->max, vec->max_depth,
+				(total) ? 100.0 * vec->busy / total : 0.0);
+	}
+
+	if (st->disabled.count)
+	{
+		fprintf(fp, "# interrupts disabled %" PRIu64 " times, longest %"
+				PRIu64 " cycles from ", st->disabled.count, st->longest);
+		p_write_name(symtab, st->longest_pc, fp);
+		fputc('\n', fp);
+	}
+
+	if (st->is_disabled)
+	{
+		fprintf(fp, "# interrupts still disabled at exit, for %" PRIu64
+				" cycles from ", st->last - st->disabled_since);
+		p_write_name(symtab, st->disabled_pc, fp);
+		fputc('\n', fp);
+	}
+}
+
+void
+irqstat_write_hists(const irqstat_t *st, FILE *fp)
+{
+	char name[32];
+
+	for (uint8_t v = 0; v < st->n_vectors; v++)
+	{
+		const struct irq_vector *vec = &st->vectors[v];
+
+		if (vec->latency.count == 0)
+			continue;
+
+		snprintf(name, sizeof name, "vector %u latency", v);
+		hist_write(&vec->latency, name, fp);
+
+		snprintf(name, sizeof name, "vector %u duration", v);
+		hist_write(&vec->duration, name, fp);
+	}
+
+	hist_write(&st->disabled, "interrupts disabled", fp);
+}
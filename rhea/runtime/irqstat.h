@@ -0,0 +1,54 @@
+#ifndef RHEA_IRQSTAT_H
+#define RHEA_IRQSTAT_H
+
+#include "rhea_elf.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Interrupt timing fed by the executor's interrupt delivery: per vector the
+ * latency from its flag being raised to the first instruction at the vector,
+ * the time until the matching RETI, how deeply it nested and its share of
+ * the CPU, plus the windows with SREG.I clear.
+ */
+typedef struct irqstat irqstat_t;
+
+irqstat_t *
+irqstat_init(uint8_t n_vectors, uint64_t now);
+
+void
+irqstat_destroy(irqstat_t **st);
+
+/* The core started taking vector at start, raised being when its flag was
+ * set and now when the first instruction at the vector starts
+ */
+void
+irqstat_enter(irqstat_t *st, uint8_t vector, uint64_t raised, uint64_t start,
+		uint64_t now);
+
+/* now is the cycle count after the RETI */
+void
+irqstat_reti(irqstat_t *st, uint64_t now);
+
+/* SREG.I was cleared by the instruction at word address pc, or by taking the
+ * vector at pc
+ */
+void
+irqstat_disable(irqstat_t *st, uint32_t pc, uint64_t now);
+
+void
+irqstat_enable(irqstat_t *st, uint64_t now);
+
+/* Charges handlers still running to their vectors before reporting */
+void
+irqstat_finish(irqstat_t *st, uint64_t now);
+
+/* One row per vector taken and the longest interrupts-disabled window */
+void
+irqstat_write_summary(const irqstat_t *st, const symtab_t *symtab, FILE *fp);
+
+/* Latency and duration histograms per vector and the disabled windows' */
+void
+irqstat_write_hists(const irqstat_t *st, FILE *fp);
+
+#endif
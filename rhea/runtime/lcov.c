@@ -0,0 +1,280 @@
+#include "runtime/lcov.h"
+
+#include "runtime/decode.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A line range, a conditional instruction or a function entry, attributed to
+ * a source line
+ */
+struct lcov_rec
+{
+	uint32_t file;
+	uint32_t line;
+	uint32_t addr;
+	uint8_t flags;
+	const char *name;
+};
+
+struct lcov_recs
+{
+	struct lcov_rec *recs;
+	size_t n;
+	size_t cap;
+};
+
+lcov_t *
+lcov_init(uint32_t n_words)
+{
+	lcov_t *lcov = malloc(sizeof *lcov);
+	if (lcov)
+	{
+		lcov->n = n_words;
+		lcov->map = calloc(n_words, sizeof *lcov->map);
+
+		if (lcov->map == NULL)
+			lcov_destroy(&lcov);
+	}
+
+	return lcov;
+}
+
+void
+lcov_destroy(lcov_t **lcov)
+{
+	lcov_t *_lcov = *lcov;
+
+	if (_lcov)
+	{
+		free(_lcov->map);
+		free(_lcov);
+		*lcov = NULL;
+	}
+}
+
+static bool
+p_is_conditional(instr_t instr)
+{
+	return instr == CPSE
+		|| (instr >= SBRC && instr <= SBIS)
+		|| (instr >= BRBS && instr <= BRSH);
+}
+
+static int
+p_push(struct lcov_recs *recs, struct lcov_rec rec)
+{
+	if (recs->n == recs->cap)
+	{
+		size_t cap = (recs->cap) ? recs->cap * 2 : 256;
+		struct lcov_rec *grown = realloc(recs->recs, cap * sizeof *grown);
+		if (grown == NULL)
+			return -1;
+
+		recs->recs = grown;
+		recs->cap = cap;
+	}
+
+	recs->recs[recs->n++] = rec;
+
+	return 0;
+}
+
+static int
+p_compare_rec(const void *a, const void *b)
+{
+	const struct lcov_rec *ra = a;
+	const struct lcov_rec *rb = b;
+
+	if (ra->file != rb->file)
+		return (ra->file > rb->file) - (ra->file < rb->file);
+	if (ra->line != rb->line)
+		return (ra->line > rb->line) - (ra->line < rb->line);
+
+	return (ra->addr > rb->addr) - (ra->addr < rb->addr);
+}
+
+/* Walks the instructions of every line range */
+static int
+p_collect(const lcov_t *lcov, const hw_t *hw, const linetab_t *lines,
+		struct lcov_recs *stmts, struct lcov_recs *branches)
+{
+	for (size_t i = 0; i < linetab_count(lines); i++)
+	{
+		const elf_line_t *range = linetab_at(lines, i);
+		uint32_t end = (range->end + 1) / 2;
+
+		if (range->addr / 2 >= lcov->n)
+			continue;
+		if (end > lcov->n)
+			end = lcov->n;
+
+		struct lcov_rec rec =
+		{
+			.file = range->file, .line = range->line, .addr = range->addr
+		};
+
+		for (uint32_t pc = range->addr / 2; pc < end; )
+		{
+			op_t op = avr_decode(hw, pc);
+
+			rec.flags |= lcov->map[pc];
+
+			if (p_is_conditional(op.instr))
+			{
+				struct lcov_rec branch = rec;
+
+				branch.addr = pc * 2;
+				branch.flags = lcov->map[pc];
+
+				if (p_push(branches, branch) == -1)
+					return -1;
+			}
+
+			pc += 1 + OP_IS_32(op);
+		}
+
+		if (p_push(stmts, rec) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+p_collect_funcs(const lcov_t *lcov, const linetab_t *lines,
+		const symtab_t *symtab, struct lcov_recs *funcs)
+{
+	for (size_t i = 0; i < symtab_count(symtab); i++)
+	{
+		const elf_sym_t *sym = symtab_at(symtab, i);
+		const elf_line_t *range = linetab_lookup(lines, sym->addr);
+
+		if (range == NULL || sym->addr / 2 >= lcov->n)
+			continue;
+
+		struct lcov_rec rec =
+		{
+			.file = range->file, .line = range->line, .addr = sym->addr,
+			.flags = lcov->map[sym->addr / 2], .name = sym->name
+		};
+
+		if (p_push(funcs, rec) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Number of leading records of recs[from, n) that belong to file */
+static size_t
+p_span(const struct lcov_recs *recs, size_t from, uint32_t file)
+{
+	size_t to = from;
+
+	while (to < recs->n && recs->recs[to].file == file)
+		++to;
+
+	return to - from;
+}
+
+static void
+p_write_file(const struct lcov_rec *stmts, size_t n_stmts,
+		const struct lcov_rec *branches, size_t n_branches,
+		const struct lcov_rec *funcs, size_t n_funcs, FILE *fp)
+{
+	size_t hit = 0;
+
+	for (size_t i = 0; i < n_funcs; i++)
+		fprintf(fp, "FN:%" PRIu32 ",%s\n", funcs[i].line, funcs[i].name);
+	for (size_t i = 0; i < n_funcs; i++)
+	{
+		fprintf(fp, "FNDA:%u,%s\n", funcs[i].flags != 0, funcs[i].name);
+		hit += funcs[i].flags != 0;
+	}
+	fprintf(fp, "FNF:%zu\nFNH:%zu\n", n_funcs, hit);
+
+	/* Blocks number the conditionals of a line, branch 0 is taken */
+	hit = 0;
+	for (size_t i = 0, block = 0; i < n_branches; i++)
+	{
+		const struct lcov_rec *br = &branches[i];
+
+		block = (i && br->line == branches[i - 1].line) ? block + 1 : 0;
+
+		if (br->flags == 0)
+		{
+			fprintf(fp, "BRDA:%" PRIu32 ",%zu,0,-\n", br->line, block);
+			fprintf(fp, "BRDA:%" PRIu32 ",%zu,1,-\n", br->line, block);
+			continue;
+		}
+
+		bool taken = br->flags & LCOV_JUMP;
+		bool fell = br->flags & LCOV_FALL;
+
+		fprintf(fp, "BRDA:%" PRIu32 ",%zu,0,%u\n", br->line, block, taken);
+		fprintf(fp, "BRDA:%" PRIu32 ",%zu,1,%u\n", br->line, block, fell);
+		hit += taken + fell;
+	}
+	fprintf(fp, "BRF:%zu\nBRH:%zu\n", 2 * n_branches, hit);
+
+	size_t found = 0;
+	hit = 0;
+	for (size_t i = 0; i < n_stmts; )
+	{
+		uint32_t line = stmts[i].line;
+		bool executed = false;
+
+		for (; i < n_stmts && stmts[i].line == line; i++)
+			executed |= stmts[i].flags != 0;
+
+		fprintf(fp, "DA:%" PRIu32 ",%u\n", line, executed);
+		++found;
+		hit += executed;
+	}
+	fprintf(fp, "LF:%zu\nLH:%zu\n", found, hit);
+}
+
+void
+lcov_write(const lcov_t *lcov, const hw_t *hw, const linetab_t *lines,
+		const symtab_t *symtab, FILE *fp)
+{
+	struct lcov_recs stmts = { 0 };
+	struct lcov_recs branches = { 0 };
+	struct lcov_recs funcs = { 0 };
+
+	if (p_collect(lcov, hw, lines, &stmts, &branches) == 0
+			&& p_collect_funcs(lcov, lines, symtab, &funcs) == 0)
+	{
+		qsort(stmts.recs, stmts.n, sizeof *stmts.recs, p_compare_rec);
+		qsort(branches.recs, branches.n, sizeof *branches.recs, p_compare_rec);
+		qsort(funcs.recs, funcs.n, sizeof *funcs.recs, p_compare_rec);
+
+		size_t s = 0, b = 0, f = 0;
+
+		for (uint32_t file = 0; file < linetab_files(lines); file++)
+		{
+			size_t n_stmts = p_span(&stmts, s, file);
+			size_t n_branches = p_span(&branches, b, file);
+			size_t n_funcs = p_span(&funcs, f, file);
+
+			if (n_stmts == 0)
+				continue;
+
+			fprintf(fp, "TN:\nSF:%s\n", linetab_file(lines, file));
+			p_write_file(stmts.recs + s, n_stmts, branches.recs + b,
+					n_branches, funcs.recs + f, n_funcs, fp);
+			fprintf(fp, "end_of_record\n");
+
+			s += n_stmts;
+			b += n_branches;
+			f += n_funcs;
+		}
+	}
+
+	free(stmts.recs);
+	free(branches.recs);
+	free(funcs.recs);
+}
@@ -0,0 +1,38 @@
+#ifndef RHEA_LCOV_H
+#define RHEA_LCOV_H
+
+#include "rhea_elf.h"
+#include "hw/devices.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Outcome flags the executor ORs into map[pc] after every instruction. Any
+ * flag means the word was executed; for conditional branches and skips the
+ * two form the not-taken/taken pair.
+ */
+#define LCOV_FALL	(1 << 0)	/* continued at pc + 1 */
+#define LCOV_JUMP	(1 << 1)	/* anywhere else */
+
+/* Statement and branch coverage, indexed by flash word address */
+typedef struct lcov
+{
+	uint32_t n;
+	uint8_t *map;
+} lcov_t;
+
+lcov_t *
+lcov_init(uint32_t n_words);
+
+void
+lcov_destroy(lcov_t **lcov);
+
+/* lcov tracefile with line (DA), branch (BRDA) and, given symtab, function
+ * (FN/FNDA) records. Hit counts are 0 or 1. Flash is decoded through hw to
+ * find the branches and skips of each line.
+ */
+void
+lcov_write(const lcov_t *lcov, const hw_t *hw, const linetab_t *lines,
+		const symtab_t *symtab, FILE *fp);
+
+#endif
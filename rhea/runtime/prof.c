@@ -0,0 +1,193 @@
+#include "runtime/prof.h"
+
+#include "runtime/decode.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROF_TOP_INSNS 32
+
+struct func_total
+{
+	const elf_sym_t *sym;
+	uint32_t addr;
+	uint64_t insns;
+	uint64_t cycles;
+};
+
+prof_t *
+prof_init(uint32_t n_words)
+{
+	prof_t *prof = malloc(sizeof *prof);
+	if (prof)
+	{
+		prof->n = n_words;
+		prof->insns = calloc(n_words, sizeof *prof->insns);
+		prof->cycles = calloc(n_words, sizeof *prof->cycles);
+
+		if (prof->insns == NULL || prof->cycles == NULL)
+			prof_destroy(&prof);
+	}
+
+	return prof;
+}
+
+void
+prof_destroy(prof_t **prof)
+{
+	prof_t *_prof = *prof;
+
+	if (_prof)
+	{
+		free(_prof->insns);
+		free(_prof->cycles);
+		free(_prof);
+		*prof = NULL;
+	}
+}
+
+static int
+p_compare_total(const void *a, const void *b)
+{
+	const struct func_total *fa = a;
+	const struct func_total *fb = b;
+
+	return (fa->cycles < fb->cycles) - (fa->cycles > fb->cycles);
+}
+
+void
+prof_write_flat(const prof_t *prof, const hw_t *hw, const symtab_t *symtab,
+		FILE *fp)
+{
+	uint64_t total_insns = 0;
+	uint64_t total_cycles = 0;
+
+	/* One bucket per symbol plus one for code outside any symbol */
+	size_t n_funcs = symtab_count(symtab) + 1;
+	struct func_total *funcs = calloc(n_funcs, sizeof *funcs);
+	if (funcs == NULL)
+		return;
+
+	for (size_t i = 0; i + 1 < n_funcs; i++)
+	{
+		funcs[i].sym = symtab_at(symtab, i);
+		funcs[i].addr = funcs[i].sym->addr;
+	}
+
+	for (uint32_t pc = 0; pc < prof->n; pc++)
+	{
+		if (prof->insns[pc] == 0)
+			continue;
+
+		const elf_sym_t *sym = symtab_lookup(symtab, pc * 2);
+		struct func_total *f = (sym) ?
+			&funcs[sym - symtab_at(symtab, 0)] : &funcs[n_funcs - 1];
+
+		f->insns += prof->insns[pc];
+		f->cycles += prof->cycles[pc];
+
+		total_insns += prof->insns[pc];
+		total_cycles += prof->cycles[pc];
+	}
+
+	qsort(funcs, n_funcs, sizeof *funcs, p_compare_total);
+
+	fprintf(fp, "# %" PRIu64 " instructions, %" PRIu64 " cycles\n",
+			total_insns, total_cycles);
+	fprintf(fp, "#\n# %%cycles %12s %12s  function\n", "cycles", "insns");
+
+	for (size_t i = 0; i < n_funcs && funcs[i].insns; i++)
+	{
+		fprintf(fp, "%9.2f %12" PRIu64 " %12" PRIu64 "  %s\n",
+				100.0 * funcs[i].cycles / total_cycles,
+				funcs[i].cycles, funcs[i].insns,
+				(funcs[i].sym) ? funcs[i].sym->name : "??");
+	}
+
+	free(funcs);
+
+	/* Hottest instructions, selected by repeatedly taking the maximum so no
+	 * copy of the counter arrays is needed.
+	 */
+	fprintf(fp, "#\n# %%cycles %12s %12s  address  instruction\n",
+			"cycles", "insns");
+
+	uint64_t ceiling = UINT64_MAX;
+	uint32_t last = UINT32_MAX;
+
+	for (int n = 0; n < PROF_TOP_INSNS; n++)
+	{
+		uint32_t best = UINT32_MAX;
+
+		for (uint32_t pc = 0; pc < prof->n; pc++)
+		{
+			uint64_t c = prof->cycles[pc];
+
+			if (prof->insns[pc] == 0 || c > ceiling ||
+				(c == ceiling && pc <= last))
+			{
+				continue;
+			}
+
+			if (best == UINT32_MAX || c > prof->cycles[best])
+				best = pc;
+		}
+
+		if (best == UINT32_MAX)
+			break;
+
+		const elf_sym_t *sym = symtab_lookup(symtab, best * 2);
+		op_t op = avr_decode(hw, best);
+
+		fprintf(fp, "%9.2f %12" PRIu64 " %12" PRIu64 "  %06X  %-8s",
+				100.0 * prof->cycles[best] / total_cycles,
+				prof->cycles[best], prof->insns[best],
+				best * 2, avr_op_str(op.instr));
+
+		if (sym)
+			fprintf(fp, " <%s+0x%X>", sym->name, best * 2 - sym->addr);
+
+		fprintf(fp, "\n");
+
+		ceiling = prof->cycles[best];
+		last = best;
+	}
+}
+
+void
+prof_write_callgrind(const prof_t *prof, const symtab_t *symtab,
+		const char *image, FILE *fp)
+{
+	const elf_sym_t *current = NULL;
+	bool first = true;
+
+	fprintf(fp, "version: 1\n");
+	fprintf(fp, "creator: rhea\n");
+	fprintf(fp, "positions: instr\n");
+	fprintf(fp, "events: Ir Cycles\n\n");
+	fprintf(fp, "ob=%s\n", (image) ? image : "firmware");
+
+	for (uint32_t pc = 0; pc < prof->n; pc++)
+	{
+		if (prof->insns[pc] == 0)
+			continue;
+
+		const elf_sym_t *sym = symtab_lookup(symtab, pc * 2);
+
+		if (first || sym != current)
+		{
+			if (sym)
+				fprintf(fp, "fn=%s\n", sym->name);
+			else
+				fprintf(fp, "fn=0x%06X\n", pc * 2);
+
+			current = sym;
+			first = false;
+		}
+
+		fprintf(fp, "0x%X %" PRIu64 " %" PRIu64 "\n",
+				pc * 2, prof->insns[pc], prof->cycles[pc]);
+	}
+}
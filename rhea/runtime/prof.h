@@ -0,0 +1,40 @@
+#ifndef RHEA_PROF_H
+#define RHEA_PROF_H
+
+#include "rhea_elf.h"
+#include "hw/devices.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Flat per-PC profile. The executor bumps the counters directly, indexed by
+ * flash word address.
+ */
+typedef struct prof
+{
+	uint32_t n;
+	uint64_t *insns;
+	uint64_t *cycles;
+} prof_t;
+
+prof_t *
+prof_init(uint32_t n_words);
+
+void
+prof_destroy(prof_t **prof);
+
+/* Per-function totals followed by the hottest instructions. symtab may be
+ * NULL, in which case everything is attributed to raw addresses.
+ */
+void
+prof_write_flat(const prof_t *prof, const hw_t *hw, const symtab_t *symtab,
+		FILE *fp);
+
+/* callgrind format with instruction-level positions, for kcachegrind and
+ * callgrind_annotate.
+ */
+void
+prof_write_callgrind(const prof_t *prof, const symtab_t *symtab,
+		const char *image, FILE *fp);
+
+#endif
@@ -0,0 +1,150 @@
+#include "runtime/realtime.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NS_PER_S	1000000000ULL
+
+struct realtime
+{
+	uint64_t f_cpu;
+	uint64_t tolerance_ns;
+	uint64_t batch;
+
+	struct timespec t0;
+	uint64_t cycles0;
+
+	/* Drift is emulated time minus wall-clock time at the end of each
+	 * batch, before pacing sleeps it off: positive when the emulator runs
+	 * ahead, negative when it lags behind.
+	 */
+	uint64_t batches;
+	uint64_t late;
+	int64_t drift_max;
+	int64_t drift_min;
+	int64_t drift_last;
+	uint64_t drift_abs_sum;
+	uint64_t slept_ns;
+};
+
+static uint64_t
+p_ns(const struct timespec *ts)
+{
+	return (uint64_t) ts->tv_sec * NS_PER_S + ts->tv_nsec;
+}
+
+static struct timespec
+p_timespec(uint64_t ns)
+{
+	struct timespec ts = { .tv_sec = ns / NS_PER_S, .tv_nsec = ns % NS_PER_S };
+	return ts;
+}
+
+/* x * num / den without overflowing for x up to years of cycles */
+static uint64_t
+p_scale(uint64_t x, uint64_t num, uint64_t den)
+{
+	return (x / den) * num + (x % den) * num / den;
+}
+
+realtime_t *
+realtime_init(uint64_t f_cpu, uint64_t tolerance_ns)
+{
+	if (f_cpu == 0 || tolerance_ns == 0)
+		return NULL;
+
+	realtime_t *rt = calloc(1, sizeof *rt);
+	if (rt)
+	{
+		rt->f_cpu = f_cpu;
+		rt->tolerance_ns = tolerance_ns;
+
+		rt->batch = p_scale(tolerance_ns / 2, f_cpu, NS_PER_S);
+		if (rt->batch == 0)
+			rt->batch = 1;
+	}
+
+	return rt;
+}
+
+void
+realtime_destroy(realtime_t **rt)
+{
+	free(*rt);
+	*rt = NULL;
+}
+
+uint64_t
+realtime_batch(const realtime_t *rt)
+{
+	return rt->batch;
+}
+
+void
+realtime_start(realtime_t *rt, uint64_t cycles)
+{
+	clock_gettime(CLOCK_MONOTONIC, &rt->t0);
+	rt->cycles0 = cycles;
+}
+
+void
+realtime_pace(realtime_t *rt, uint64_t cycles)
+{
+	uint64_t emu_ns = p_scale(cycles - rt->cycles0, NS_PER_S, rt->f_cpu);
+
+	struct timespec deadline = p_timespec(p_ns(&rt->t0) + emu_ns);
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	int64_t drift = (int64_t) (p_ns(&deadline) - p_ns(&now));
+
+	if (rt->batches == 0 || drift > rt->drift_max)
+		rt->drift_max = drift;
+	if (rt->batches == 0 || drift < rt->drift_min)
+		rt->drift_min = drift;
+
+	rt->drift_last = drift;
+	rt->drift_abs_sum += (drift < 0) ? -drift : drift;
+
+	if (drift < -(int64_t) rt->tolerance_ns)
+		++rt->late;
+
+	++rt->batches;
+
+	if (drift > 0)
+	{
+		uint64_t before = p_ns(&now);
+
+		/* Signals are handled by the caller once the batch is over */
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+					NULL) == EINTR)
+			;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		rt->slept_ns += p_ns(&now) - before;
+	}
+}
+
+void
+realtime_write_summary(const realtime_t *rt, FILE *fp)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	uint64_t wall = p_ns(&now) - p_ns(&rt->t0);
+	uint64_t mean = (rt->batches) ? rt->drift_abs_sum / rt->batches : 0;
+	double busy = (wall) ? 100.0 * (wall - rt->slept_ns) / wall : 0;
+
+	fprintf(fp, "realtime: %" PRIu64 " Hz, %" PRIu64 " batches of %" PRIu64
+			" cycles, host busy %.1f%%\n",
+			rt->f_cpu, rt->batches, rt->batch, busy);
+	fprintf(fp, "realtime: drift mean %" PRIu64 " us, min %" PRId64
+			" us, max %" PRId64 " us, last %" PRId64 " us\n",
+			mean / 1000, rt->drift_min / 1000, rt->drift_max / 1000,
+			rt->drift_last / 1000);
+	fprintf(fp, "realtime: %" PRIu64 " batches beyond the %" PRIu64
+			" us tolerance\n", rt->late, rt->tolerance_ns / 1000);
+}
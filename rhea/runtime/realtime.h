@@ -0,0 +1,37 @@
+#ifndef RHEA_REALTIME_H
+#define RHEA_REALTIME_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Paces emulation to wall-clock time. The caller runs the core in batches of
+ * realtime_batch() cycles and reports the cycle count after each; the host
+ * thread then sleeps until the monotonic deadline at which real silicon
+ * running at f_cpu would have got there. Batches are half the tolerance
+ * long, so a core keeping up never drifts further than that.
+ */
+typedef struct realtime realtime_t;
+
+realtime_t *
+realtime_init(uint64_t f_cpu, uint64_t tolerance_ns);
+
+void
+realtime_destroy(realtime_t **rt);
+
+uint64_t
+realtime_batch(const realtime_t *rt);
+
+/* Anchors emulated time `cycles` to the current wall-clock time */
+void
+realtime_start(realtime_t *rt, uint64_t cycles);
+
+/* Records the drift of emulated time `cycles` against the wall clock, then
+ * sleeps until it is due
+ */
+void
+realtime_pace(realtime_t *rt, uint64_t cycles);
+
+void
+realtime_write_summary(const realtime_t *rt, FILE *fp);
+
+#endif
@@ -0,0 +1,182 @@
+#include "runtime/semihost.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct semihost
+{
+	emu_t *emu;
+	hw_t *hw;
+	uint32_t base;
+	FILE *out;
+
+	uint16_t ptr;
+	uint32_t cycles;	/* latched by reading CYCLES */
+
+	bool exited;
+	int status;
+};
+
+/* Ends the run after the current instruction */
+static void
+p_stop(semihost_t *sh, int status)
+{
+	sh->exited = true;
+	sh->status = status;
+	sh->hw->state = AVR_BREAK;
+
+	fflush(sh->out);
+}
+
+static void
+p_write_buffer(semihost_t *sh, uint8_t len)
+{
+	const data_t *data = sh->hw->data;
+	uint32_t addr = sh->ptr + DEV_DATA_OFFSET(sh->hw->dev->features);
+	uint32_t end = (len) ? addr + len : sh->hw->ramend + 1;
+
+	for (; addr < end && addr <= sh->hw->ramend; addr++)
+	{
+		uint8_t byte = data_peek(data, addr);
+
+		if (len == 0 && byte == '\0')
+			break;
+
+		fputc(byte, sh->out);
+	}
+}
+
+static void
+p_write(void *ctx, uint32_t addr, uint8_t val)
+{
+	semihost_t *sh = ctx;
+
+	switch (addr - sh->base)
+	{
+		case SEMIHOST_PUTC:
+			fputc(val, sh->out);
+			break;
+		case SEMIHOST_EXIT:
+			p_stop(sh, val);
+			break;
+		case SEMIHOST_ASSERT:
+			fflush(sh->out);
+			fprintf(stderr, "assertion failed at 0x%04X (code %u) after %llu "
+					"cycles\n", sh->hw->pc * 2, val,
+					(unsigned long long) emu_cycles(sh->emu));
+			p_stop(sh, EXIT_FAILURE);
+			break;
+		case SEMIHOST_PTRL:
+			sh->ptr = (sh->ptr & 0xFF00) | val;
+			break;
+		case SEMIHOST_PTRH:
+			sh->ptr = (sh->ptr & 0x00FF) | (val << 8);
+			break;
+		case SEMIHOST_WRITE:
+			p_write_buffer(sh, val);
+			break;
+	}
+}
+
+static uint8_t
+p_read(void *ctx, uint32_t addr, uint8_t val)
+{
+	semihost_t *sh = ctx;
+	uint32_t byte = addr - sh->base - SEMIHOST_CYCLES;
+
+	if (byte == 0)
+		sh->cycles = emu_cycles(sh->emu);
+
+	return sh->cycles >> (8 * byte);
+}
+
+/* True if addr is a register the catalog knows the part has. The USART is
+ * taken as the whole block from UCSRA to UDR.
+ */
+static bool
+p_catalogued(const device_t *dev, uint32_t addr)
+{
+	const uint32_t offset = DEV_DATA_OFFSET(dev->features);
+	const uint16_t regs[] = { dev->io.rampz, dev->io.eind, dev->io.spmcsr };
+
+	if (addr == SPL || addr == SPH || addr == SREG)
+		return true;
+
+	for (size_t i = 0; i < sizeof regs / sizeof *regs; i++)
+	{
+		if (regs[i] && addr == regs[i] + offset)
+			return true;
+	}
+
+	return dev->io.ucsra && dev->io.udr && addr >= dev->io.ucsra + offset
+		&& addr <= dev->io.udr + offset;
+}
+
+uint32_t
+semihost_base(emu_t *emu)
+{
+	const device_t *dev = emu_hw(emu)->dev;
+
+	return (dev->reserved.size >= SEMIHOST_SIZE) ? dev->reserved.start : 0;
+}
+
+semihost_t *
+semihost_init(emu_t *emu, uint32_t base, FILE *out)
+{
+	for (uint32_t i = 0; i < SEMIHOST_SIZE; i++)
+	{
+		if (p_catalogued(emu_hw(emu)->dev, base + i))
+			return NULL;
+	}
+
+	semihost_t *sh = calloc(1, sizeof *sh);
+	if (sh == NULL)
+		return NULL;
+
+	sh->emu = emu;
+	sh->hw = emu_hw(emu);
+	sh->base = base;
+	sh->out = out;
+
+	for (uint32_t i = 0; i < SEMIHOST_SIZE; i++)
+	{
+		io_read_t read = (i >= SEMIHOST_CYCLES) ? p_read : NULL;
+		io_write_t write = (i < SEMIHOST_CYCLES) ? p_write : NULL;
+
+		if (data_hook(sh->hw->data, base + i, read, write, sh) == -1)
+		{
+			while (i--)
+				data_hook(sh->hw->data, base + i, NULL, NULL, NULL);
+
+			free(sh);
+			return NULL;
+		}
+	}
+
+	return sh;
+}
+
+void
+semihost_destroy(semihost_t **sh)
+{
+	semihost_t *_sh = *sh;
+
+	if (_sh)
+	{
+		for (uint32_t i = 0; i < SEMIHOST_SIZE; i++)
+			data_hook(_sh->hw->data, _sh->base + i, NULL, NULL, NULL);
+
+		fflush(_sh->out);
+		free(_sh);
+		*sh = NULL;
+	}
+}
+
+bool
+semihost_exited(const semihost_t *sh, int *status)
+{
+	if (sh->exited)
+		*status = sh->status;
+
+	return sh->exited;
+}
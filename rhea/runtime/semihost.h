@@ -0,0 +1,59 @@
+#ifndef RHEA_SEMIHOST_H
+#define RHEA_SEMIHOST_H
+
+#include "runtime/emu.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Semihosting registers, as offsets from a base data address. Test firmware
+ * talks to the host with plain OUT/STS instead of going through an emulated
+ * peripheral:
+ *
+ *	PUTC	w	writes the byte to the host's output
+ *	EXIT	w	stops the run; the value is rhea's exit status
+ *	ASSERT	w	reports a failed assertion at the current PC with the
+ *			value as a code and stops the run with a failure status
+ *	PTRL/H	w	address of a buffer in data space
+ *	WRITE	w	writes that many bytes from the buffer, or up to a NUL
+ *			if 0
+ *	CYCLES	r	reading the lowest byte latches the cycle counter, the
+ *			three above return the rest of the latched value
+ */
+#define SEMIHOST_PUTC		0
+#define SEMIHOST_EXIT		1
+#define SEMIHOST_ASSERT		2
+#define SEMIHOST_PTRL		3
+#define SEMIHOST_PTRH		4
+#define SEMIHOST_WRITE		5
+#define SEMIHOST_CYCLES		6
+#define SEMIHOST_SIZE		10
+
+typedef struct semihost semihost_t;
+
+/* Default base: the start of the part's reserved extended I/O, which only STS
+ * and LDS reach but shadows nothing. 0 if the part has no such range, as the
+ * tinies don't, and the caller has to pick a base itself.
+ */
+uint32_t
+semihost_base(emu_t *emu);
+
+/* Hooks SEMIHOST_SIZE registers from base, which has to lie below ramstart
+ * and clear of SP, SREG, the registers the catalog lists for the part and
+ * registers that are already hooked. Output goes to out.
+ */
+semihost_t *
+semihost_init(emu_t *emu, uint32_t base, FILE *out);
+
+/* Removes the hooks again */
+void
+semihost_destroy(semihost_t **sh);
+
+/* True once the firmware wrote EXIT or ASSERT; status is then set to the
+ * exit status it asked for.
+ */
+bool
+semihost_exited(const semihost_t *sh, int *status);
+
+#endif
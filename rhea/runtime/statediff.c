@@ -0,0 +1,308 @@
+#include "runtime/statediff.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Bytes shown per side of a range before eliding the rest */
+#define SHOW_BYTES	16
+
+/* Unchanged memory is skipped WIDE bytes at a time; GCC lowers the vector
+ * operations to whatever SIMD width the host has.
+ */
+typedef uint64_t wide_t __attribute__((vector_size(32)));
+#define WIDE sizeof(wide_t)
+
+static const char *AREA_STR[] =
+{
+	"pc", "sp", "sreg", "cycles", "regs", "io", "sram", "eeprom"
+};
+
+static uint8_t
+p_sreg_byte(sreg_t sreg)
+{
+	return (sreg.i << 7) | (sreg.t << 6) | (sreg.h << 5) | (sreg.s << 4)
+		| (sreg.v << 3) | (sreg.n << 2) | (sreg.z << 1) | sreg.c;
+}
+
+static int
+p_add(statediff_t *diff, uint8_t area, uint32_t addr, uint32_t len)
+{
+	if (diff->n_ranges == diff->cap_ranges)
+	{
+		uint32_t cap = (diff->cap_ranges) ? diff->cap_ranges * 2 : 64;
+		statediff_range_t *ranges = realloc(diff->ranges, cap * sizeof *ranges);
+		if (ranges == NULL)
+			return -1;
+
+		diff->ranges = ranges;
+		diff->cap_ranges = cap;
+	}
+
+	diff->ranges[diff->n_ranges++] = (statediff_range_t)
+	{
+		.area = area, .addr = addr, .len = len
+	};
+	diff->n_bytes += len;
+
+	return 0;
+}
+
+/* First index in [from, to) at which a and b differ, to if none */
+static uint32_t
+p_next_diff(const uint8_t *a, const uint8_t *b, uint32_t from, uint32_t to)
+{
+	uint32_t i = from;
+
+	for (; i + WIDE <= to; i += WIDE)
+	{
+		wide_t x, y;
+		uint64_t lanes[WIDE / sizeof(uint64_t)];
+
+		memcpy(&x, a + i, WIDE);
+		memcpy(&y, b + i, WIDE);
+
+		x ^= y;
+		memcpy(lanes, &x, WIDE);
+
+		if (lanes[0] | lanes[1] | lanes[2] | lanes[3])
+			break;
+	}
+
+	while (i < to && a[i] == b[i])
+		++i;
+
+	return i;
+}
+
+static int
+p_compare(statediff_t *diff, uint8_t area, const uint8_t *a, const uint8_t *b,
+		uint32_t from, uint32_t to)
+{
+	uint32_t i = from;
+
+	while ((i = p_next_diff(a, b, i, to)) < to)
+	{
+		uint32_t start = i;
+
+		while (i < to && a[i] != b[i])
+			++i;
+
+		if (p_add(diff, area, start, i - start) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+p_scalars(statediff_t *diff, uint8_t areas)
+{
+	const emu_state_t *a = &diff->a;
+	const emu_state_t *b = &diff->b;
+
+	if ((areas & STATE_PC) && a->pc != b->pc
+			&& p_add(diff, STATE_PC, 0, 0) == -1)
+		return -1;
+
+	if ((areas & STATE_SP) && a->sp != b->sp
+			&& p_add(diff, STATE_SP, 0, 0) == -1)
+		return -1;
+
+	if ((areas & STATE_SREG) && p_sreg_byte(a->sreg) != p_sreg_byte(b->sreg)
+			&& p_add(diff, STATE_SREG, 0, 0) == -1)
+		return -1;
+
+	if ((areas & STATE_CYCLES) && a->cycles != b->cycles
+			&& p_add(diff, STATE_CYCLES, 0, 0) == -1)
+		return -1;
+
+	return 0;
+}
+
+statediff_t *
+statediff(const emu_snapshot_t *a, const emu_snapshot_t *b, uint8_t areas)
+{
+	statediff_t *diff = calloc(1, sizeof *diff);
+	if (diff == NULL)
+		return NULL;
+
+	emu_snapshot_state(a, &diff->a);
+	emu_snapshot_state(b, &diff->b);
+
+	const emu_state_t *sa = &diff->a;
+	const emu_state_t *sb = &diff->b;
+
+	if (memcmp(sa->signature, sb->signature, sizeof sa->signature)
+			|| sa->ramstart != sb->ramstart
+			|| sa->ramend != sb->ramend
+			|| sa->e2size != sb->e2size)
+	{
+		statediff_destroy(&diff);
+		return NULL;
+	}
+
+	int status = p_scalars(diff, areas);
+
+	if (status == 0 && (areas & STATE_REGS))
+		status = p_compare(diff, STATE_REGS, sa->data, sb->data, 0, 0x20);
+
+	if (status == 0 && (areas & STATE_IO))
+	{
+		/* SP and SREG live in hw_t and are compared as STATE_SP and
+		 * STATE_SREG
+		 */
+		status = p_compare(diff, STATE_IO, sa->data, sb->data, 0x20, SPL);
+		if (status == 0)
+			status = p_compare(diff, STATE_IO, sa->data, sb->data,
+					SREG + 1, sa->ramstart);
+	}
+
+	if (status == 0 && (areas & STATE_SRAM))
+		status = p_compare(diff, STATE_SRAM, sa->data, sb->data,
+				sa->ramstart, sa->ramend + 1);
+
+	if (status == 0 && (areas & STATE_EEPROM) && sa->eeprom)
+		status = p_compare(diff, STATE_EEPROM, sa->eeprom, sb->eeprom,
+				0, sa->e2size);
+
+	if (status == -1)
+		statediff_destroy(&diff);
+
+	return diff;
+}
+
+void
+statediff_destroy(statediff_t **diff)
+{
+	if (*diff)
+	{
+		free((*diff)->ranges);
+		free(*diff);
+		*diff = NULL;
+	}
+}
+
+int
+statediff_parse_areas(const char *spec, uint8_t *areas)
+{
+	uint8_t mask = 0;
+
+	while (*spec)
+	{
+		size_t len = strcspn(spec, ",");
+		size_t i;
+
+		if (len == 3 && strncmp(spec, "all", 3) == 0)
+			mask = STATE_ALL;
+		else
+		{
+			for (i = 0; i < sizeof AREA_STR / sizeof *AREA_STR; i++)
+			{
+				if (strlen(AREA_STR[i]) == len && strncmp(AREA_STR[i], spec, len) == 0)
+					break;
+			}
+
+			if (i == sizeof AREA_STR / sizeof *AREA_STR)
+				return -1;
+
+			mask |= 1 << i;
+		}
+
+		spec += len;
+		if (*spec == ',')
+			++spec;
+	}
+
+	if (mask == 0)
+		return -1;
+
+	*areas = mask;
+
+	return 0;
+}
+
+static void
+p_write_bytes(const uint8_t *mem, const statediff_range_t *range, char sign,
+		FILE *fp)
+{
+	static const char HEX[] = "0123456789ABCDEF";
+	char line[SHOW_BYTES * 3 + 8];
+	uint32_t n = (range->len < SHOW_BYTES) ? range->len : SHOW_BYTES;
+	size_t pos = 0;
+
+	line[pos++] = '\t';
+	line[pos++] = sign;
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		uint8_t byte = mem[range->addr + i];
+
+		line[pos++] = ' ';
+		line[pos++] = HEX[byte >> 4];
+		line[pos++] = HEX[byte & 0xF];
+	}
+
+	if (n < range->len)
+	{
+		memcpy(line + pos, " ...", 4);
+		pos += 4;
+	}
+
+	line[pos++] = '\n';
+	fwrite(line, 1, pos, fp);
+}
+
+static void
+p_write_scalar(const statediff_t *diff, uint8_t area, FILE *fp)
+{
+	const emu_state_t *a = &diff->a;
+	const emu_state_t *b = &diff->b;
+
+	switch (area)
+	{
+		case STATE_PC:
+			fprintf(fp, "pc\n\t- 0x%04" PRIX32 "\n\t+ 0x%04" PRIX32 "\n",
+					a->pc * 2, b->pc * 2);
+			break;
+		case STATE_SP:
+			fprintf(fp, "sp\n\t- 0x%04X\n\t+ 0x%04X\n", a->sp, b->sp);
+			break;
+		case STATE_SREG:
+			fprintf(fp, "sreg\n\t- 0x%02X\n\t+ 0x%02X\n",
+					p_sreg_byte(a->sreg), p_sreg_byte(b->sreg));
+			break;
+		case STATE_CYCLES:
+			fprintf(fp, "cycles\n\t- %" PRIu64 "\n\t+ %" PRIu64 "\n",
+					a->cycles, b->cycles);
+			break;
+	}
+}
+
+void
+statediff_write(const statediff_t *diff, FILE *fp)
+{
+	for (uint32_t i = 0; i < diff->n_ranges; i++)
+	{
+		const statediff_range_t *range = &diff->ranges[i];
+
+		if (range->area < STATE_REGS)
+		{
+			p_write_scalar(diff, range->area, fp);
+			continue;
+		}
+
+		bool eeprom = range->area == STATE_EEPROM;
+
+		fprintf(fp, "%s 0x%04" PRIX32 "..0x%04" PRIX32 " (%" PRIu32 " bytes)\n",
+				AREA_STR[__builtin_ctz(range->area)], range->addr,
+				range->addr + range->len - 1, range->len);
+
+		p_write_bytes((eeprom) ? diff->a.eeprom : diff->a.data, range, '-', fp);
+		p_write_bytes((eeprom) ? diff->b.eeprom : diff->b.data, range, '+', fp);
+	}
+
+	fprintf(fp, "%" PRIu32 " differing ranges, %" PRIu64 " bytes\n",
+			diff->n_ranges, diff->n_bytes);
+}
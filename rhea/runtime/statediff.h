@@ -0,0 +1,62 @@
+#ifndef RHEA_STATEDIFF_H
+#define RHEA_STATEDIFF_H
+
+#include "runtime/emu.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Parts of the machine state that can be compared */
+#define STATE_PC	(1 << 0)
+#define STATE_SP	(1 << 1)
+#define STATE_SREG	(1 << 2)
+#define STATE_CYCLES	(1 << 3)
+#define STATE_REGS	(1 << 4)	/* r0-r31 */
+#define STATE_IO	(1 << 5)	/* 0x20 up to ramstart */
+#define STATE_SRAM	(1 << 6)
+#define STATE_EEPROM	(1 << 7)
+#define STATE_ALL	0xFF
+
+/* A run of differing bytes within one area. addr is a data address for
+ * REGS/IO/SRAM and an offset for EEPROM; the scalar areas are reported as an
+ * empty range at 0.
+ */
+typedef struct statediff_range
+{
+	uint8_t area;
+	uint32_t addr;
+	uint32_t len;
+} statediff_range_t;
+
+typedef struct statediff
+{
+	emu_state_t a;
+	emu_state_t b;
+
+	statediff_range_t *ranges;
+	uint32_t n_ranges;
+	uint32_t cap_ranges;
+
+	uint64_t n_bytes;
+} statediff_t;
+
+/* Compares the areas of a against b. Returns NULL if the snapshots were
+ * taken on different devices or on allocation failure. The result refers to
+ * both snapshots, which must outlive it.
+ */
+statediff_t *
+statediff(const emu_snapshot_t *a, const emu_snapshot_t *b, uint8_t areas);
+
+void
+statediff_destroy(statediff_t **diff);
+
+/* Comma-separated area names, e.g. "regs,sreg,sp,sram", or "all" */
+int
+statediff_parse_areas(const char *spec, uint8_t *areas);
+
+/* One line per range with the values of a ("-") and b ("+") underneath */
+void
+statediff_write(const statediff_t *diff, FILE *fp);
+
+#endif
@@ -0,0 +1,74 @@
+#include "runtime/trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+trace_t *
+trace_init(const char *path, const hw_t *hw, uint32_t n_records)
+{
+	if (n_records == 0)
+		n_records = TRACE_DEFAULT_RECORDS;
+
+	trace_t *trace = malloc(sizeof *trace);
+	if (trace == NULL)
+		return NULL;
+
+	trace->head = 0;
+	trace->n = n_records;
+	trace->total = 0;
+	trace->buf = malloc(n_records * sizeof *trace->buf);
+	trace->fp = fopen(path, "wb");
+
+	if (trace->buf == NULL || trace->fp == NULL)
+	{
+		trace_destroy(&trace);
+		return NULL;
+	}
+
+	struct trace_header header =
+	{
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.rec_size = sizeof(struct trace_rec),
+		.flashend = hw->flashend,
+		.ramend = hw->ramend,
+		.features = hw->dev->features
+	};
+	memcpy(header.signature, hw->signature, sizeof header.signature);
+
+	if (fwrite(&header, sizeof header, 1, trace->fp) != 1)
+		trace_destroy(&trace);
+
+	return trace;
+}
+
+void
+trace_destroy(trace_t **trace)
+{
+	trace_t *_trace = *trace;
+
+	if (_trace)
+	{
+		if (_trace->fp)
+		{
+			if (_trace->buf)
+				trace_flush(_trace);
+			fclose(_trace->fp);
+		}
+
+		free(_trace->buf);
+		free(_trace);
+		*trace = NULL;
+	}
+}
+
+void
+trace_flush(trace_t *trace)
+{
+	if (trace->head)
+	{
+		fwrite(trace->buf, sizeof *trace->buf, trace->head, trace->fp);
+		trace->total += trace->head;
+		trace->head = 0;
+	}
+}
@@ -0,0 +1,88 @@
+#ifndef RHEA_TRACE_H
+#define RHEA_TRACE_H
+
+#include "attributes.h"
+#include "hw/devices.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACE_MAGIC	0x52544852 /* "RHTR" */
+#define TRACE_VERSION	3
+
+#define TRACE_DEFAULT_RECORDS	(1 << 16)
+
+/* Auxiliary records (EXT, LOAD, STORE) are emitted while an instruction
+ * executes and therefore precede the INSN record they belong to. INSN, IRQ
+ * and IDLE each account for the cycles they took, so their sum is the number
+ * of cycles the run advanced while tracing.
+ */
+enum trace_kind
+{
+	TRACE_INSN = 1,		/* arg: cycles, raw: opcode, val: word PC */
+	TRACE_EXT,		/* raw: second word of a 32-bit opcode */
+	TRACE_LOAD,		/* arg: byte read, val: data address */
+	TRACE_STORE,		/* arg: byte written, val: data address */
+	TRACE_IRQ,		/* arg: cycles, raw: vector, val: word PC of the
+				 * vector slot */
+	TRACE_IDLE		/* raw: cycles >> 32, val: cycles asleep */
+};
+
+struct trace_rec
+{
+	uint8_t kind;
+	uint8_t arg;
+	uint16_t raw;
+	uint32_t val;
+};
+
+struct trace_header
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t rec_size;
+	uint8_t signature[3];
+	uint32_t flashend;
+	uint32_t ramend;
+	uint32_t features;	/* selects the decoder variant */
+};
+
+/* Records land in a fixed ring and are written out in one fwrite whenever it
+ * fills, so the executor only ever does a store and a compare per record.
+ */
+typedef struct trace
+{
+	struct trace_rec *buf;
+	uint32_t head;
+	uint32_t n;
+	uint64_t total;
+	FILE *fp;
+} trace_t;
+
+/* n_records of 0 selects TRACE_DEFAULT_RECORDS */
+trace_t *
+trace_init(const char *path, const hw_t *hw, uint32_t n_records);
+
+/* Flushes whatever is left and closes the file */
+void
+trace_destroy(trace_t **trace);
+
+void
+trace_flush(trace_t *trace);
+
+static inline void ATTR_INLINE
+trace_put(trace_t *trace, uint8_t kind, uint8_t arg, uint16_t raw,
+		uint32_t val)
+{
+	struct trace_rec *rec = &trace->buf[trace->head];
+
+	rec->kind = kind;
+	rec->arg = arg;
+	rec->raw = raw;
+	rec->val = val;
+
+	if (++trace->head == trace->n)
+		trace_flush(trace);
+}
+
+#endif